@@ -0,0 +1,66 @@
+/* bench_accumulate.c – throughput of table_manager_particle_to_table in the
+ * critical, atomic and private accumulation modes, across thread counts and
+ * table sizes.
+ *
+ * Usage: bench_accumulate [rays] [recorders]
+ * Prints one row per (mode, bins, threads) with the ray rate in Mrays/s. */
+#include "bench_common.h"
+
+static const char * mode_names[] = {"critical", "private", "atomic"};
+
+/* Records every ray at every recorder with a uniform random time in the
+ * table window and bins it; returns the elapsed seconds. */
+static double run(struct TableManagerData * data, long rays, int threads) {
+    double start = bench_now();
+    #pragma omp parallel num_threads(threads)
+    {
+#ifdef _OPENMP
+        uint64_t rng = 0x9E3779B97F4A7C15ULL * (uint64_t) (omp_get_thread_num() + 1);
+#else
+        uint64_t rng = 0x9E3779B97F4A7C15ULL;
+#endif
+        #pragma omp for schedule(static)
+        for (long r = 0; r < rays; ++r) {
+            _class_particle p = {0};
+            table_manager_particle_alloc(&p, 0.0);
+            p.p = 1.0;
+            for (int i = 0; i < data->recorders; ++i) {
+                p.t = bench_uniform(&rng);
+                table_manager_particle_record(&p, i);
+            }
+            table_manager_particle_to_table(&p, data);
+            table_manager_particle_free(&p);
+        }
+    }
+    table_manager_data_reduce(data);
+    return bench_now() - start;
+}
+
+int main(int argc, char ** argv) {
+    long rays = argc > 1 ? atol(argv[1]) : 1000000;
+    int recorders = argc > 2 ? atoi(argv[2]) : 8;
+    int bin_counts[] = {100, 10000, 1000000};
+    int max_threads = bench_max_threads();
+
+    bench_state_setup(recorders);
+    printf("# rays=%ld recorders=%d max_threads=%d\n", rays, recorders, max_threads);
+    printf("%-9s %9s %7s %12s\n", "mode", "bins", "threads", "Mrays/s");
+    for (int mode = 0; mode < 3; ++mode) {
+        for (size_t b = 0; b < sizeof(bin_counts) / sizeof(bin_counts[0]); ++b) {
+            for (int threads = 1; threads <= max_threads;
+                 threads = threads < max_threads && threads * 2 > max_threads ? max_threads : threads * 2) {
+                struct TableManagerData * data =
+                    table_manager_data_alloc(recorders, bin_counts[b], 0.0, 1.0);
+                if (!data || table_manager_data_set_accumulation(data, mode, 0) != 0)
+                    return 1;
+                double seconds = run(data, rays, threads);
+                printf("%-9s %9d %7d %12.3f\n", mode_names[mode], bin_counts[b], threads,
+                       1e-6 * (double) rays / seconds);
+                fflush(stdout);
+                table_manager_data_free(data);
+            }
+        }
+    }
+    table_manager_state_free();
+    return 0;
+}
@@ -0,0 +1,58 @@
+/* bench_batch.c – table_manager_particle_to_table called once per ray versus
+ * table_manager_particles_to_table on the whole batch, single-threaded, for
+ * a range of recorder counts.  The rays are recorded once up front, so only
+ * the binning is timed.
+ *
+ * Usage: bench_batch [rays] [bins]
+ * Prints one row per recorder count with both ray rates in Mrays/s. */
+#include "bench_common.h"
+
+int main(int argc, char ** argv) {
+    long rays = argc > 1 ? atol(argv[1]) : 200000;
+    int bins = argc > 2 ? atoi(argv[2]) : 1000;
+    int recorder_counts[] = {2, 8, 64};
+    int repeats = 5;
+
+    _class_particle * ps = (_class_particle *) calloc((size_t) rays, sizeof(_class_particle));
+    if (!ps)
+        return 1;
+    printf("# rays=%ld bins=%d repeats=%d\n", rays, bins, repeats);
+    printf("%9s %14s %14s\n", "recorders", "single Mrays/s", "batch Mrays/s");
+    for (size_t c = 0; c < sizeof(recorder_counts) / sizeof(recorder_counts[0]); ++c) {
+        int recorders = recorder_counts[c];
+        bench_state_setup(recorders);
+        uint64_t rng = 0x9E3779B97F4A7C15ULL;
+        for (long r = 0; r < rays; ++r) {
+            table_manager_particle_alloc(&ps[r], 0.0);
+            ps[r].p = 1.0;
+            for (int i = 0; i < recorders; ++i) {
+                ps[r].t = bench_uniform(&rng);
+                table_manager_particle_record(&ps[r], i);
+            }
+        }
+        struct TableManagerData * data = table_manager_data_alloc(recorders, bins, 0.0, 1.0);
+        if (!data)
+            return 1;
+
+        double start = bench_now();
+        for (int k = 0; k < repeats; ++k)
+            for (long r = 0; r < rays; ++r)
+                table_manager_particle_to_table(&ps[r], data);
+        double single = bench_now() - start;
+
+        start = bench_now();
+        for (int k = 0; k < repeats; ++k)
+            table_manager_particles_to_table(ps, (int) rays, data);
+        double batch = bench_now() - start;
+
+        printf("%9d %14.3f %14.3f\n", recorders,
+               1e-6 * (double) (rays * repeats) / single,
+               1e-6 * (double) (rays * repeats) / batch);
+        fflush(stdout);
+        table_manager_data_free(data);
+        table_manager_particles_free(ps, (int) rays);
+        table_manager_state_free();
+    }
+    free(ps);
+    return 0;
+}
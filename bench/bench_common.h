@@ -0,0 +1,110 @@
+/* bench_common.h – small helpers shared by the benchmark executables.
+ *
+ * Benchmarks link tof-table-lib.c against the test particle stub, so they
+ * set up the global state exactly as the Unity tests do (manager index 9). */
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include "tof-table-lib.h"
+#include "particle_stub.h"
+#include <stdint.h>
+#include <time.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/* Wall-clock seconds. */
+static inline double bench_now(void) {
+#ifdef _OPENMP
+    return omp_get_wtime();
+#else
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double) ts.tv_sec + 1e-9 * (double) ts.tv_nsec;
+#endif
+}
+
+static inline int bench_max_threads(void) {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+/* xorshift64*: uniform double in [0, 1). */
+static inline double bench_uniform(uint64_t * state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return (double) ((x * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Hardware cache-miss counter for the calling process (all threads it
+ * starts afterwards).  bench_cache_misses_open returns -1 when the counter is
+ * unavailable (non-Linux, or perf_event_paranoid forbids it); the read then
+ * reports -1. */
+static inline int bench_cache_misses_open(void) {
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+static inline void bench_cache_misses_start(int fd) {
+#ifdef __linux__
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#else
+    (void) fd;
+#endif
+}
+
+static inline long long bench_cache_misses_stop(int fd) {
+#ifdef __linux__
+    long long count = -1;
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) != (ssize_t) sizeof(count))
+            count = -1;
+    }
+    return count;
+#else
+    (void) fd;
+    return -1;
+#endif
+}
+
+/* Fresh global state with n_recorders recorders, finalised for the stub. */
+static inline void bench_state_setup(int n_recorders) {
+    table_manager_state_free();
+    table_manager_state_alloc();
+    for (int i = 0; i < n_recorders; ++i)
+        table_manager_state_add_recorder("bench", (double) (i + 1));
+    table_manager_state_finalize(9, "table_manager_t", "table_manager_p",
+                                 "table_manager_n", "table_manager_z");
+}
+
+#endif /* BENCH_COMMON_H */
@@ -0,0 +1,101 @@
+/* bench_json.c – throughput of the buffered, chunk-parallel JSON matrix
+ * writer against the former one-fprintf-per-value writer, on
+ * multi-million-bin tables.
+ *
+ * Histogram tables are mostly empty, so the table is filled with a given
+ * fraction of non-zero weights (uniform random doubles, which need 15-17
+ * significant digits) and zeros elsewhere.
+ *
+ * Usage: bench_json [bins] [recorders]
+ * Prints one row per (writer, fill fraction, threads) with the output size
+ * and the write rate in MB/s. */
+#include "bench_common.h"
+
+/* The writer as it was before buffering, kept here as the reference. */
+static int fprintf_array_double(FILE * f, double * x, int n) {
+    if (fprintf(f, "[") < 0)
+        return -1;
+    for (int i = 0; i < n; ++i) {
+        if (fprintf(f, "%.15g", x[i]) < 0)
+            return -1;
+        if (i < n - 1 && fprintf(f, ", ") < 0)
+            return -1;
+    }
+    if (fprintf(f, "]") < 0)
+        return -1;
+    return 0;
+}
+
+static int fprintf_matrix_double(FILE * f, double * x, int m, int n, int indent_level) {
+    if (fprintf(f, "[\n") < 0)
+        return -1;
+    for (int i = 0; i < m; ++i) {
+        if (table_manager_json_indent(f, indent_level + 1) < 0)
+            return -1;
+        if (fprintf_array_double(f, &x[(size_t) i * n], n) < 0)
+            return -1;
+        if (fprintf(f, i < m - 1 ? ",\n" : "\n") < 0)
+            return -1;
+    }
+    if (table_manager_json_indent(f, indent_level) < 0)
+        return -1;
+    if (fprintf(f, "]") < 0)
+        return -1;
+    return 0;
+}
+
+typedef int (*matrix_writer)(FILE *, double *, int, int, int);
+
+/* Writes x to a scratch file; returns the elapsed seconds and the size. */
+static double run(matrix_writer write, double * x, int m, int n, long * bytes) {
+    FILE * f = tmpfile();
+    if (!f)
+        return -1.0;
+    double start = bench_now();
+    int ret = write(f, x, m, n, 2);
+    fflush(f);
+    double seconds = bench_now() - start;
+    *bytes = ftell(f);
+    fclose(f);
+    return ret == 0 ? seconds : -1.0;
+}
+
+int main(int argc, char ** argv) {
+    int bins = argc > 1 ? atoi(argv[1]) : 1000000;
+    int recorders = argc > 2 ? atoi(argv[2]) : 4;
+    double fills[] = {0.0, 0.1, 1.0};
+    size_t cells = (size_t) recorders * (size_t) bins;
+    double * x = (double *) malloc(cells * sizeof(double));
+    if (!x)
+        return 1;
+
+    int max_threads = bench_max_threads();
+    printf("# bins=%d recorders=%d max_threads=%d\n", bins, recorders, max_threads);
+    printf("%-9s %6s %7s %10s %10s\n", "writer", "fill", "threads", "MB", "MB/s");
+    for (size_t k = 0; k < sizeof(fills) / sizeof(fills[0]); ++k) {
+        uint64_t rng = 0x9E3779B97F4A7C15ULL;
+        for (size_t i = 0; i < cells; ++i)
+            x[i] = bench_uniform(&rng) < fills[k] ? bench_uniform(&rng) : 0.0;
+        const char * names[] = {"fprintf", "buffered"};
+        matrix_writer writers[] = {fprintf_matrix_double, table_manager_json_matrix_double};
+        for (int w = 0; w < 2; ++w) {
+            /* The fprintf writer is serial; the buffered one formats chunks
+             * on every OpenMP thread. */
+            for (int threads = 1; threads <= (w ? max_threads : 1);
+                 threads = threads < max_threads && threads * 2 > max_threads ? max_threads : threads * 2) {
+#ifdef _OPENMP
+                omp_set_num_threads(threads);
+#endif
+                long bytes = 0;
+                double seconds = run(writers[w], x, recorders, bins, &bytes);
+                if (seconds < 0)
+                    return 1;
+                printf("%-9s %6.2f %7d %10.1f %10.1f\n", names[w], fills[k], threads,
+                       1e-6 * (double) bytes, 1e-6 * (double) bytes / seconds);
+                fflush(stdout);
+            }
+        }
+    }
+    free(x);
+    return 0;
+}
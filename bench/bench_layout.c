@@ -0,0 +1,83 @@
+/* bench_layout.c – ray rate and cache misses of the "soa" and "interleaved"
+ * table layouts, for tables from cache-resident to far larger than L2.
+ *
+ * Every ray hits every recorder at a uniform random time, so successive
+ * updates land in unrelated bins: each hit costs four cache lines in the
+ * soa layout and one in the interleaved layout.  Cache misses are read from
+ * the Linux perf counter when it is available (otherwise run the benchmark
+ * under `perf stat -e cache-misses`).
+ *
+ * Usage: bench_layout [rays] [recorders]
+ * Prints one row per (layout, bins, threads) with the ray rate in Mrays/s
+ * and the cache misses per recorded hit. */
+#include "bench_common.h"
+
+static const char * layout_names[] = {"soa", "interleaved"};
+
+static double run(struct TableManagerData * data, long rays, int threads) {
+    double start = bench_now();
+    #pragma omp parallel num_threads(threads)
+    {
+#ifdef _OPENMP
+        uint64_t rng = 0x9E3779B97F4A7C15ULL * (uint64_t) (omp_get_thread_num() + 1);
+#else
+        uint64_t rng = 0x9E3779B97F4A7C15ULL;
+#endif
+        #pragma omp for schedule(static)
+        for (long r = 0; r < rays; ++r) {
+            _class_particle p = {0};
+            table_manager_particle_alloc(&p, 0.0);
+            p.p = 1.0;
+            for (int i = 0; i < data->recorders; ++i) {
+                p.t = bench_uniform(&rng);
+                table_manager_particle_record(&p, i);
+            }
+            table_manager_particle_to_table(&p, data);
+            table_manager_particle_free(&p);
+        }
+    }
+    return bench_now() - start;
+}
+
+int main(int argc, char ** argv) {
+    long rays = argc > 1 ? atol(argv[1]) : 1000000;
+    int recorders = argc > 2 ? atoi(argv[2]) : 4;
+    int bin_counts[] = {1000, 100000, 1000000};
+    int max_threads = bench_max_threads();
+    int counter = bench_cache_misses_open();
+
+    bench_state_setup(recorders);
+    printf("# rays=%ld recorders=%d max_threads=%d accumulation=atomic%s\n", rays, recorders,
+           max_threads, counter < 0 ? " (cache-miss counter unavailable)" : "");
+    printf("%-12s %9s %7s %12s %14s\n", "layout", "bins", "threads", "Mrays/s", "misses/hit");
+    for (size_t b = 0; b < sizeof(bin_counts) / sizeof(bin_counts[0]); ++b) {
+        for (int layout = 0; layout < 2; ++layout) {
+            for (int threads = 1; threads <= max_threads;
+                 threads = threads < max_threads && threads * 2 > max_threads ? max_threads : threads * 2) {
+                struct TableManagerData * data =
+                    table_manager_data_alloc(recorders, bin_counts[b], 0.0, 1.0);
+                if (!data ||
+                    table_manager_data_set_accumulation(data, TABLE_MANAGER_ACCUMULATE_ATOMIC, 0) != 0 ||
+                    table_manager_data_set_layout(data, layout) != 0)
+                    return 1;
+                /* warm-up pass so page faults are not counted as misses */
+                run(data, rays / 10, threads);
+                bench_cache_misses_start(counter);
+                double seconds = run(data, rays, threads);
+                long long misses = bench_cache_misses_stop(counter);
+                printf("%-12s %9d %7d %12.3f ", layout_names[layout], bin_counts[b], threads,
+                       1e-6 * (double) rays / seconds);
+                if (misses < 0)
+                    printf("%14s\n", "n/a");
+                else
+                    printf("%14.3f\n", (double) misses / ((double) rays * recorders));
+                fflush(stdout);
+                table_manager_data_free(data);
+            }
+        }
+    }
+    table_manager_state_free();
+    if (counter >= 0)
+        close(counter);
+    return 0;
+}
@@ -1,5 +1,7 @@
 #include "particle_stub.h"
 
+int particle_stub_old_inline = 0;
+
 void * particle_getvar_void(_class_particle *p, char *name, int *success){
 #ifndef OPENACC
 #define str_comp strcmp
@@ -11,6 +13,15 @@ void * particle_getvar_void(_class_particle *p, char *name, int *success){
     if (!str_comp("table_manager_t_9", name)){rval=(void * ) & (p->table_manager_t_9);s=0;}
     if (!str_comp("table_manager_p_9", name)){rval=(void * ) & (p->table_manager_p_9);s=0;}
     if (!str_comp("table_manager_n_9", name)){rval=(void * ) & (p->table_manager_n_9);s=0;}
+    if (!str_comp("table_manager_z_9", name)){rval=(void * ) & (p->table_manager_z_9);s=0;}
+    if (!str_comp("table_manager_t_12", name)){rval=(void * ) & (p->table_manager_t_12);s=0;}
+    if (!str_comp("table_manager_p_12", name)){rval=(void * ) & (p->table_manager_p_12);s=0;}
+    if (!str_comp("table_manager_n_12", name)){rval=(void * ) & (p->table_manager_n_12);s=0;}
+    if (!str_comp("table_manager_z_12", name)){rval=(void * ) & (p->table_manager_z_12);s=0;}
+#ifdef TOF_TABLE_MAX_RECORDERS
+    if (!str_comp("table_manager_ray", name)){rval=(void * ) & (p->table_manager_ray);s=0;}
+    if (particle_stub_old_inline && !str_comp("table_manager_inline", name)){rval=(void * ) & (p->table_manager_ray);s=0;}
+#endif
     if (success!=0x0) {*success=s;}
     return rval;
 }
\ No newline at end of file
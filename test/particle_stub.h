@@ -2,10 +2,11 @@
  * tof-table-lib.c to read/write per-particle user fields.
  *
  * Outside of McStas the _struct_particle is defined in tof-table-lib.h with
- * hardcoded field names table_manager_t_9 / _p_9 / _n_9.  Tests must
+ * hardcoded field names table_manager_t_9 / _p_9 / _n_9 / _z_9.  Tests must
  * therefore call table_manager_state_finalize(9, "table_manager_t",
- * "table_manager_p", "table_manager_n") so the state's name strings match
- * the struct field names handled here.
+ * "table_manager_p", "table_manager_n", "table_manager_z") so the state's
+ * name strings match the struct field names handled here.  A second table
+ * group can be finalized for index 12 the same way.
  */
 #ifndef PARTICLE_STUB_H
 #define PARTICLE_STUB_H
@@ -16,5 +17,8 @@
 
 void * particle_getvar_void(_class_particle * p, char * name, int *success);
 
+/* Nonzero makes the stub also resolve the old table_manager_inline name. */
+extern int particle_stub_old_inline;
+
 #endif /* MCSTAS */
 #endif /* PARTICLE_STUB_H */
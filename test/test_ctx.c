@@ -0,0 +1,133 @@
+/* test_ctx.c – Unity tests for explicit contexts: contexts independent of
+ * each other and of the table groups, and threads started outside OpenMP
+ * bound to their own pools and slabs. */
+#include "unity.h"
+#include "tof-table-lib.h"
+#include "particle_stub.h"
+#include <pthread.h>
+
+#define TEST_THREADS  4
+#define TEST_RAYS     1000
+
+void setUp(void)    { }
+void tearDown(void) { table_manager_state_free(); }
+
+static struct TableManagerState * make_ctx(int n_threads, int manager_index, int recorders) {
+    struct TableManagerState * ctx = table_manager_ctx_alloc(n_threads);
+    TEST_ASSERT_NOT_NULL(ctx);
+    for (int r = 0; r < recorders; ++r)
+        TEST_ASSERT_EQUAL_INT(r, table_manager_ctx_add_recorder(ctx, "rec", 1.0 + r));
+    table_manager_ctx_finalize(ctx, manager_index, "table_manager_t", "table_manager_p",
+                               "table_manager_n", "table_manager_z");
+    return ctx;
+}
+
+/* ---- independence ---- */
+
+void test_ctx_is_not_the_group_state(void) {
+    struct TableManagerState * ctx = make_ctx(0, 9, 2);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_state_exists());
+    TEST_ASSERT_EQUAL_INT(2, table_manager_ctx_n_recorders(ctx));
+    TEST_ASSERT_EQUAL_INT(0, table_manager_state_n_recorders());
+    table_manager_ctx_free(ctx);
+}
+
+void test_ctxs_record_independently(void) {
+    struct TableManagerState * a = make_ctx(0, 9, 2);
+    struct TableManagerState * b = make_ctx(0, 12, 1);
+    _class_particle p = {0};
+    table_manager_ctx_particle_alloc(a, &p, 0.0);
+    table_manager_ctx_particle_alloc(b, &p, 0.0);
+    p.t = 1.0;
+    TEST_ASSERT_EQUAL_INT(0, table_manager_ctx_particle_record(a, &p, 1));
+    p.t = 2.0;
+    TEST_ASSERT_EQUAL_INT(0, table_manager_ctx_particle_record(b, &p, 0));
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_ctx_particle_record(b, &p, 1));
+    TEST_ASSERT_EQUAL_INT(2, p.table_manager_n_9);
+    TEST_ASSERT_EQUAL_INT(1, p.table_manager_n_12);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 1.0, p.table_manager_t_9[1]);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 2.0, p.table_manager_t_12[0]);
+    TEST_ASSERT_EQUAL_INT(1, table_manager_ctx_particle_recorded(a, &p, 1));
+    TEST_ASSERT_EQUAL_INT(0, table_manager_ctx_particle_recorded(a, &p, 0));
+
+    struct TableManagerData * data = table_manager_data_alloc(1, 10, 0.0, 10.0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_ctx_particle_to_table(b, &p, data));
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_reduce(data));
+    TEST_ASSERT_EQUAL_INT(1, data->n[2]);
+    table_manager_data_free(data);
+
+    TEST_ASSERT_EQUAL_INT(0, table_manager_ctx_particle_free(a, &p));
+    TEST_ASSERT_EQUAL_INT(0, table_manager_ctx_particle_free(b, &p));
+    table_manager_ctx_free(a);
+    table_manager_ctx_free(b);
+}
+
+void test_ctx_functions_reject_missing_ctx(void) {
+    _class_particle p = {0};
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_ctx_add_recorder(NULL, "rec", 1.0));
+    TEST_ASSERT_EQUAL_INT(0, table_manager_ctx_n_recorders(NULL));
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_ctx_particle_record(NULL, &p, 0));
+    table_manager_ctx_free(NULL);
+}
+
+/* ---- bound threads ---- */
+
+struct worker {
+    struct TableManagerState * ctx;
+    struct TableManagerData *  data;
+    int                        index;
+    int                        failures;
+};
+
+static void * run_worker(void * arg) {
+    struct worker * w = (struct worker *) arg;
+    table_manager_thread_bind(w->index);
+    for (int i = 0; i < TEST_RAYS; ++i) {
+        _class_particle p = {0};
+        table_manager_ctx_particle_alloc(w->ctx, &p, 0.0);
+        p.t = 0.5 + w->index;
+        p.p = 1.0;
+        w->failures += table_manager_ctx_particle_record(w->ctx, &p, 0) != 0;
+        w->failures += table_manager_ctx_particle_to_table(w->ctx, &p, w->data) != 0;
+        w->failures += table_manager_ctx_particle_free(w->ctx, &p) != 0;
+    }
+    table_manager_thread_bind(-1);
+    return NULL;
+}
+
+void test_bound_threads_use_own_pools_and_slabs(void) {
+    struct TableManagerState * ctx = make_ctx(TEST_THREADS, 9, 1);
+    struct TableManagerData * data = table_manager_data_alloc(1, 10, 0.0, 10.0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_set_accumulation(
+                                 data, TABLE_MANAGER_ACCUMULATE_PRIVATE, TEST_THREADS));
+    pthread_t threads[TEST_THREADS];
+    struct worker workers[TEST_THREADS];
+    for (int i = 0; i < TEST_THREADS; ++i) {
+        workers[i] = (struct worker) { ctx, data, i, 0 };
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&threads[i], NULL, run_worker, &workers[i]));
+    }
+    for (int i = 0; i < TEST_THREADS; ++i) {
+        pthread_join(threads[i], NULL);
+        TEST_ASSERT_EQUAL_INT(0, workers[i].failures);
+    }
+
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_reduce(data));
+    for (int i = 0; i < TEST_THREADS; ++i)
+        TEST_ASSERT_EQUAL_INT(TEST_RAYS, data->n[i]);
+    long long hits, misses, reclaimed;
+    table_manager_ctx_pool_stats(ctx, &hits, &misses, &reclaimed);
+    /* Each thread allocates one block and recycles it from its own pool. */
+    TEST_ASSERT_EQUAL_INT(TEST_THREADS * TEST_RAYS, (int) (hits + misses));
+    TEST_ASSERT_EQUAL_INT(TEST_THREADS, (int) misses);
+    table_manager_data_free(data);
+    table_manager_ctx_free(ctx);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_ctx_is_not_the_group_state);
+    RUN_TEST(test_ctxs_record_independently);
+    RUN_TEST(test_ctx_functions_reject_missing_ctx);
+    RUN_TEST(test_bound_threads_use_own_pools_and_slabs);
+    return UNITY_END();
+}
@@ -3,6 +3,7 @@
 #include "unity.h"
 #include "tof-table-lib.h"
 #include "particle_stub.h"
+#include <stdint.h>
 
 void setUp(void)    {}
 void tearDown(void) {}
@@ -20,6 +21,7 @@ void test_data_alloc_sets_correct_fields(void) {
     TEST_ASSERT_EQUAL_INT(8, data->bins);
     TEST_ASSERT_DOUBLE_WITHIN(1e-12, 0.5, data->t_min);
     TEST_ASSERT_DOUBLE_WITHIN(1e-12, 2.5, data->t_max);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 4.0, data->t_scale);
     table_manager_data_free(data);
 }
 
@@ -57,6 +59,437 @@ void test_data_alloc_single_recorder_single_bin(void) {
     table_manager_data_free(data);
 }
 
+/* ---- accumulation modes ---- */
+
+void test_accumulation_from_name(void) {
+    TEST_ASSERT_EQUAL_INT(TABLE_MANAGER_ACCUMULATE_CRITICAL, table_manager_accumulation_from_name(NULL));
+    TEST_ASSERT_EQUAL_INT(TABLE_MANAGER_ACCUMULATE_CRITICAL, table_manager_accumulation_from_name("critical"));
+    TEST_ASSERT_EQUAL_INT(TABLE_MANAGER_ACCUMULATE_PRIVATE,  table_manager_accumulation_from_name("private"));
+    TEST_ASSERT_EQUAL_INT(TABLE_MANAGER_ACCUMULATE_ATOMIC,   table_manager_accumulation_from_name("atomic"));
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_accumulation_from_name("bogus"));
+}
+
+void test_data_alloc_defaults_to_critical(void) {
+    struct TableManagerData * data = table_manager_data_alloc(2, 5, 0.0, 1.0);
+    TEST_ASSERT_EQUAL_INT(TABLE_MANAGER_ACCUMULATE_CRITICAL, data->accumulation);
+    TEST_ASSERT_EQUAL_INT(0, data->n_slabs);
+    TEST_ASSERT_NULL(data->slabs);
+    table_manager_data_free(data);
+}
+
+void test_data_set_private_allocates_slabs(void) {
+    struct TableManagerData * data = table_manager_data_alloc(2, 5, 0.0, 1.0);
+    int ret = table_manager_data_set_accumulation(data, TABLE_MANAGER_ACCUMULATE_PRIVATE, 3);
+    TEST_ASSERT_EQUAL_INT(0, ret);
+    TEST_ASSERT_EQUAL_INT(3, data->n_slabs);
+    for (int s = 0; s < 3; ++s) {
+        TEST_ASSERT_NOT_NULL(data->slabs[s]);
+        TEST_ASSERT_EQUAL_INT(2, data->slabs[s]->recorders);
+        TEST_ASSERT_EQUAL_INT(5, data->slabs[s]->bins);
+    }
+    table_manager_data_free(data);
+}
+
+void test_data_set_atomic_allocates_no_slabs(void) {
+    struct TableManagerData * data = table_manager_data_alloc(2, 5, 0.0, 1.0);
+    table_manager_data_set_accumulation(data, TABLE_MANAGER_ACCUMULATE_PRIVATE, 2);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_set_accumulation(data, TABLE_MANAGER_ACCUMULATE_ATOMIC, 0));
+    TEST_ASSERT_EQUAL_INT(TABLE_MANAGER_ACCUMULATE_ATOMIC, data->accumulation);
+    TEST_ASSERT_EQUAL_INT(0, data->n_slabs);
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_data_set_accumulation(data, 99, 0));
+    table_manager_data_free(data);
+}
+
+void test_data_reduce_sums_and_clears_slabs(void) {
+    struct TableManagerData * data = table_manager_data_alloc(1, 2, 0.0, 1.0);
+    table_manager_data_set_accumulation(data, TABLE_MANAGER_ACCUMULATE_PRIVATE, 2);
+    data->p1[1] = 1.0;
+    data->slabs[0]->p1[1] = 2.0;
+    data->slabs[1]->p1[1] = 3.0;
+    data->slabs[0]->n[0] = 4;
+    data->slabs[1]->n[0] = 5;
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_reduce(data));
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 6.0, data->p1[1]);
+    TEST_ASSERT_EQUAL_INT(9, data->n[0]);
+    /* A second reduce must not count the slabs again. */
+    table_manager_data_reduce(data);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 6.0, data->p1[1]);
+    TEST_ASSERT_EQUAL_INT(0, data->slabs[0]->n[0]);
+    table_manager_data_free(data);
+}
+
+/* ---- per-recorder windows ---- */
+
+void test_data_windows_default_to_table_window(void) {
+    struct TableManagerData * data = table_manager_data_alloc(2, 8, 0.5, 2.5);
+    for (int i = 0; i < 2; ++i) {
+        TEST_ASSERT_DOUBLE_WITHIN(1e-12, 0.5, data->r_min[i]);
+        TEST_ASSERT_DOUBLE_WITHIN(1e-12, 2.5, data->r_max[i]);
+        TEST_ASSERT_DOUBLE_WITHIN(1e-12, 4.0, data->r_scale[i]);
+    }
+    table_manager_data_free(data);
+}
+
+void test_data_set_window_reaches_slabs(void) {
+    struct TableManagerData * data = table_manager_data_alloc(2, 10, 0.0, 1.0);
+    table_manager_data_set_window(data, 0, 2.0, 3.0);
+    table_manager_data_set_accumulation(data, TABLE_MANAGER_ACCUMULATE_PRIVATE, 2);
+    table_manager_data_set_window(data, 1, 4.0, 4.5);
+    for (int s = 0; s < 2; ++s) {
+        TEST_ASSERT_DOUBLE_WITHIN(1e-12, 2.0, data->slabs[s]->r_min[0]);
+        TEST_ASSERT_DOUBLE_WITHIN(1e-12, 4.5, data->slabs[s]->r_max[1]);
+        TEST_ASSERT_DOUBLE_WITHIN(1e-9, 20.0, data->slabs[s]->r_scale[1]);
+    }
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_data_set_window(data, 2, 0.0, 1.0));
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_data_set_window(data, 0, 1.0, 0.0));
+    table_manager_data_free(data);
+}
+
+/* ---- binning ---- */
+
+void test_binning_from_name(void) {
+    TEST_ASSERT_EQUAL_INT(TABLE_MANAGER_BINNING_LINEAR, table_manager_binning_from_name(NULL));
+    TEST_ASSERT_EQUAL_INT(TABLE_MANAGER_BINNING_LINEAR, table_manager_binning_from_name("linear"));
+    TEST_ASSERT_EQUAL_INT(TABLE_MANAGER_BINNING_LOG, table_manager_binning_from_name("log"));
+    TEST_ASSERT_EQUAL_INT(TABLE_MANAGER_BINNING_EDGES, table_manager_binning_from_name("edges"));
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_binning_from_name("bogus"));
+}
+
+void test_data_log_binning_sets_log_scale(void) {
+    struct TableManagerData * data = table_manager_data_alloc(2, 4, 1.0, 16.0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_set_binning(data, TABLE_MANAGER_BINNING_LOG, NULL));
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 4.0 / log(16.0), data->t_scale);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 4.0 / log(16.0), data->r_scale[1]);
+    double edges[5];
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_edges(data, 0, edges));
+    for (int i = 0; i <= 4; ++i)
+        TEST_ASSERT_DOUBLE_WITHIN(1e-12, pow(2.0, i), edges[i]);
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_data_set_window(data, 1, 0.0, 1.0));
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_set_window(data, 1, 2.0, 32.0));
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 4.0 / log(16.0), data->r_scale[1]);
+    table_manager_data_free(data);
+
+    data = table_manager_data_alloc(1, 4, 0.0, 16.0);
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_data_set_binning(data, TABLE_MANAGER_BINNING_LOG, NULL));
+    TEST_ASSERT_EQUAL_INT(TABLE_MANAGER_BINNING_LINEAR, data->binning);
+    table_manager_data_free(data);
+}
+
+void test_data_edge_binning_copies_edges(void) {
+    double edges[4] = {1.0, 2.0, 5.0, 10.0};
+    struct TableManagerData * data = table_manager_data_alloc(2, 3, 0.0, 1.0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_set_binning(data, TABLE_MANAGER_BINNING_EDGES, edges));
+    edges[1] = 3.0;
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 2.0, data->edges[1]);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 1.0, data->r_min[1]);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 10.0, data->t_max);
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_data_set_window(data, 0, 1.0, 2.0));
+    table_manager_data_set_accumulation(data, TABLE_MANAGER_ACCUMULATE_PRIVATE, 2);
+    TEST_ASSERT_EQUAL_INT(TABLE_MANAGER_BINNING_EDGES, data->slabs[1]->binning);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 5.0, data->slabs[1]->edges[2]);
+    table_manager_data_free(data);
+
+    double unsorted[4] = {1.0, 2.0, 2.0, 10.0};
+    data = table_manager_data_alloc(1, 3, 0.0, 1.0);
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_data_set_binning(data, TABLE_MANAGER_BINNING_EDGES, unsorted));
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_data_set_binning(data, TABLE_MANAGER_BINNING_EDGES, NULL));
+    TEST_ASSERT_NULL(data->edges);
+    table_manager_data_free(data);
+}
+
+/* ---- layouts ---- */
+
+void test_layout_from_name(void) {
+    TEST_ASSERT_EQUAL_INT(TABLE_MANAGER_LAYOUT_SOA, table_manager_layout_from_name(NULL));
+    TEST_ASSERT_EQUAL_INT(TABLE_MANAGER_LAYOUT_SOA, table_manager_layout_from_name("soa"));
+    TEST_ASSERT_EQUAL_INT(TABLE_MANAGER_LAYOUT_INTERLEAVED, table_manager_layout_from_name("interleaved"));
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_layout_from_name("bogus"));
+}
+
+void test_data_interleaved_cells_are_aligned_records(void) {
+    struct TableManagerData * data = table_manager_data_alloc(3, 7, 0.0, 1.0);
+    TEST_ASSERT_NULL(data->cells);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_set_layout(data, TABLE_MANAGER_LAYOUT_INTERLEAVED));
+    TEST_ASSERT_EQUAL_INT(32, (int) sizeof(struct TableManagerBin));
+    TEST_ASSERT_NOT_NULL(data->cells);
+    TEST_ASSERT_EQUAL_INT(0, (int) ((uintptr_t) data->cells % 32));
+    /* The cells replace the dense arrays until the table is reduced. */
+    TEST_ASSERT_NULL(data->tp);
+    TEST_ASSERT_NULL(data->n);
+    for (int i = 0; i < 3 * 7; ++i) {
+        TEST_ASSERT_EQUAL_DOUBLE(0.0, data->cells[i].p1);
+        TEST_ASSERT_EQUAL_INT(0, data->cells[i].n);
+    }
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_data_set_layout(data, 99));
+    table_manager_data_free(data);
+}
+
+void test_data_interleaved_layout_applies_to_slabs(void) {
+    /* Either call order must leave every slab interleaved. */
+    struct TableManagerData * before = table_manager_data_alloc(1, 4, 0.0, 1.0);
+    struct TableManagerData * after = table_manager_data_alloc(1, 4, 0.0, 1.0);
+    table_manager_data_set_layout(before, TABLE_MANAGER_LAYOUT_INTERLEAVED);
+    table_manager_data_set_accumulation(before, TABLE_MANAGER_ACCUMULATE_PRIVATE, 2);
+    table_manager_data_set_accumulation(after, TABLE_MANAGER_ACCUMULATE_PRIVATE, 2);
+    table_manager_data_set_layout(after, TABLE_MANAGER_LAYOUT_INTERLEAVED);
+    for (int s = 0; s < 2; ++s) {
+        TEST_ASSERT_NOT_NULL(before->slabs[s]->cells);
+        TEST_ASSERT_NOT_NULL(after->slabs[s]->cells);
+        TEST_ASSERT_NULL(before->slabs[s]->p1);
+        TEST_ASSERT_NULL(after->slabs[s]->p1);
+    }
+    table_manager_data_free(before);
+    table_manager_data_free(after);
+}
+
+void test_data_reduce_converts_interleaved_to_arrays(void) {
+    struct TableManagerData * data = table_manager_data_alloc(1, 2, 0.0, 1.0);
+    table_manager_data_set_accumulation(data, TABLE_MANAGER_ACCUMULATE_PRIVATE, 2);
+    table_manager_data_set_layout(data, TABLE_MANAGER_LAYOUT_INTERLEAVED);
+    data->cells[1].p1 = 1.0;
+    data->slabs[0]->cells[1].p1 = 2.0;
+    data->slabs[1]->cells[1].tp = 3.0;
+    data->slabs[1]->cells[0].n = 5;
+    struct TableManagerBin bin;
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_get_bin(data, 0, 1, &bin));
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 1.0, bin.p1);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_reduce(data));
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 3.0, data->p1[1]);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 3.0, data->tp[1]);
+    TEST_ASSERT_EQUAL_INT(5, data->n[0]);
+    /* A second reduce must not count the records again. */
+    table_manager_data_reduce(data);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 3.0, data->p1[1]);
+    TEST_ASSERT_EQUAL_INT(5, data->n[0]);
+    table_manager_data_free(data);
+}
+
+/* ---- sparse layout ---- */
+
+void test_data_sparse_layout_drops_dense_arrays(void) {
+    struct TableManagerData * data = table_manager_data_alloc(4, 1000, 0.0, 1.0);
+    TEST_ASSERT_EQUAL_INT(TABLE_MANAGER_LAYOUT_SPARSE, table_manager_layout_from_name("sparse"));
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_set_layout(data, TABLE_MANAGER_LAYOUT_SPARSE));
+    TEST_ASSERT_NULL(data->tp);
+    TEST_ASSERT_NULL(data->n);
+    TEST_ASSERT_NOT_NULL(data->blocks);
+    TEST_ASSERT_EQUAL_size_t((4000 + TABLE_MANAGER_SPARSE_BLOCK - 1) / TABLE_MANAGER_SPARSE_BLOCK, data->n_blocks);
+    for (size_t b = 0; b < data->n_blocks; ++b)
+        TEST_ASSERT_NULL(data->blocks[b]);
+    /* Back to the dense layout: zeroed arrays again. */
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_set_layout(data, TABLE_MANAGER_LAYOUT_SOA));
+    TEST_ASSERT_NULL(data->blocks);
+    TEST_ASSERT_NOT_NULL(data->tp);
+    TEST_ASSERT_EQUAL_INT(0, data->n[3999]);
+    table_manager_data_free(data);
+}
+
+void test_data_alloc_layout_allocates_only_its_storage(void) {
+    struct TableManagerData * data =
+        table_manager_data_alloc_layout(4, 1000, 0.0, 1.0, TABLE_MANAGER_LAYOUT_SPARSE);
+    TEST_ASSERT_NOT_NULL(data);
+    TEST_ASSERT_EQUAL_INT(TABLE_MANAGER_LAYOUT_SPARSE, data->layout);
+    TEST_ASSERT_NULL(data->tp);
+    TEST_ASSERT_NULL(data->cells);
+    TEST_ASSERT_NOT_NULL(data->blocks);
+    /* Neither the thread slabs nor a table allocated like it get dense arrays. */
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_set_accumulation(data, TABLE_MANAGER_ACCUMULATE_PRIVATE, 2));
+    for (int s = 0; s < 2; ++s) {
+        TEST_ASSERT_NULL(data->slabs[s]->tp);
+        TEST_ASSERT_NOT_NULL(data->slabs[s]->blocks);
+    }
+    struct TableManagerData * like = table_manager_data_alloc_like(data);
+    TEST_ASSERT_NOT_NULL(like);
+    TEST_ASSERT_NULL(like->tp);
+    TEST_ASSERT_NOT_NULL(like->blocks);
+    table_manager_data_free(like);
+    table_manager_data_free(data);
+
+    data = table_manager_data_alloc_layout(2, 8, 0.0, 1.0, TABLE_MANAGER_LAYOUT_INTERLEAVED);
+    TEST_ASSERT_NOT_NULL(data);
+    TEST_ASSERT_NULL(data->tp);
+    TEST_ASSERT_NOT_NULL(data->cells);
+    table_manager_data_free(data);
+    TEST_ASSERT_NULL(table_manager_data_alloc_layout(2, 8, 0.0, 1.0, 99));
+}
+
+void test_data_sparse_rejects_atomic(void) {
+    struct TableManagerData * data = table_manager_data_alloc(1, 10, 0.0, 1.0);
+    table_manager_data_set_accumulation(data, TABLE_MANAGER_ACCUMULATE_ATOMIC, 0);
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_data_set_layout(data, TABLE_MANAGER_LAYOUT_SPARSE));
+    table_manager_data_set_accumulation(data, TABLE_MANAGER_ACCUMULATE_CRITICAL, 0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_set_layout(data, TABLE_MANAGER_LAYOUT_SPARSE));
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_data_set_accumulation(data, TABLE_MANAGER_ACCUMULATE_ATOMIC, 0));
+    table_manager_data_free(data);
+}
+
+void test_data_reduce_folds_sparse_slabs(void) {
+    struct TableManagerData * data = table_manager_data_alloc(1, 2 * TABLE_MANAGER_SPARSE_BLOCK, 0.0, 1.0);
+    table_manager_data_set_layout(data, TABLE_MANAGER_LAYOUT_SPARSE);
+    table_manager_data_set_accumulation(data, TABLE_MANAGER_ACCUMULATE_PRIVATE, 2);
+    TEST_ASSERT_NOT_NULL(data->slabs[0]->blocks);
+    /* Block 0 only in slab 0 (handed over); block 1 in both slabs (added). */
+    for (int s = 0; s < 2; ++s)
+        for (int b = s ? 1 : 0; b < 2; ++b) {
+            data->slabs[s]->blocks[b] = (struct TableManagerBin *)
+                calloc(TABLE_MANAGER_SPARSE_BLOCK, sizeof(struct TableManagerBin));
+            data->slabs[s]->blocks[b][3].p1 = 1.5;
+            data->slabs[s]->blocks[b][3].n = 2;
+        }
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_reduce(data));
+    struct TableManagerBin bin;
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_get_bin(data, 0, 3, &bin));
+    TEST_ASSERT_EQUAL_INT(2, bin.n);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_get_bin(data, 0, TABLE_MANAGER_SPARSE_BLOCK + 3, &bin));
+    TEST_ASSERT_EQUAL_INT(4, bin.n);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 3.0, bin.p1);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_get_bin(data, 0, 4, &bin));
+    TEST_ASSERT_EQUAL_INT(0, bin.n);
+    for (int s = 0; s < 2; ++s)
+        for (int b = 0; b < 2; ++b)
+            TEST_ASSERT_NULL(data->slabs[s]->blocks[b]);
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_data_get_bin(data, 1, 0, &bin));
+    table_manager_data_free(data);
+}
+
+/* ---- merging runs ---- */
+
+void test_data_alloc_like_copies_binning(void) {
+    struct TableManagerData * data = table_manager_data_alloc(2, 8, 1.0, 9.0);
+    table_manager_data_set_window(data, 1, 2.0, 4.0);
+    table_manager_data_set_binning(data, TABLE_MANAGER_BINNING_LOG, NULL);
+    table_manager_data_set_layout(data, TABLE_MANAGER_LAYOUT_SPARSE);
+    struct TableManagerData * like = table_manager_data_alloc_like(data);
+    TEST_ASSERT_NOT_NULL(like);
+    TEST_ASSERT_EQUAL_INT(8, like->bins);
+    TEST_ASSERT_EQUAL_INT(TABLE_MANAGER_BINNING_LOG, like->binning);
+    TEST_ASSERT_EQUAL_INT(TABLE_MANAGER_LAYOUT_SPARSE, like->layout);
+    TEST_ASSERT_EQUAL_DOUBLE(2.0, like->r_min[1]);
+    TEST_ASSERT_EQUAL_DOUBLE(data->r_scale[1], like->r_scale[1]);
+    table_manager_data_free(like);
+    table_manager_data_free(data);
+}
+
+void test_data_merge_sums_across_layouts(void) {
+    struct TableManagerData * dst = table_manager_data_alloc(1, 2 * TABLE_MANAGER_SPARSE_BLOCK, 0.0, 1.0);
+    struct TableManagerData * src = table_manager_data_alloc_like(dst);
+    table_manager_data_set_layout(dst, TABLE_MANAGER_LAYOUT_SPARSE);
+    dst->clip_low[0] = 1;
+    src->clip_low[0] = 2;
+    src->p1[5] = 1.5;
+    src->n[5] = 3;
+    /* Dense into sparse: only the block of bin 5 gets allocated. */
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_merge(dst, src));
+    TEST_ASSERT_NOT_NULL(dst->blocks[0]);
+    TEST_ASSERT_NULL(dst->blocks[1]);
+    /* And sparse back into dense. */
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_merge(src, dst));
+    TEST_ASSERT_EQUAL_INT(6, src->n[5]);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 3.0, src->p1[5]);
+    TEST_ASSERT_EQUAL_INT(0, src->n[6]);
+    TEST_ASSERT_EQUAL_INT(5, (int) src->clip_low[0]);
+    struct TableManagerBin bin;
+    table_manager_data_get_bin(dst, 0, 5, &bin);
+    TEST_ASSERT_EQUAL_INT(3, bin.n);
+    table_manager_data_free(src);
+    table_manager_data_free(dst);
+}
+
+void test_data_merge_rejects_different_bins(void) {
+    struct TableManagerData * dst = table_manager_data_alloc(2, 10, 0.0, 1.0);
+    struct TableManagerData * other_bins = table_manager_data_alloc(2, 20, 0.0, 1.0);
+    struct TableManagerData * other_window = table_manager_data_alloc(2, 10, 0.0, 1.0);
+    table_manager_data_set_window(other_window, 1, 0.0, 2.0);
+    struct TableManagerData * other_binning = table_manager_data_alloc(2, 10, 0.0, 1.0);
+    double edges[11] = {0, .1, .2, .3, .4, .5, .6, .7, .8, .9, 1};
+    table_manager_data_set_binning(other_binning, TABLE_MANAGER_BINNING_EDGES, edges);
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_data_merge(dst, other_bins));
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_data_merge(dst, other_window));
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_data_merge(dst, other_binning));
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_data_merge(dst, NULL));
+    table_manager_data_free(other_binning);
+    table_manager_data_free(other_window);
+    table_manager_data_free(other_bins);
+    table_manager_data_free(dst);
+}
+
+/* ---- relative error ---- */
+
+void test_data_rel_error_weights_bins_by_probability(void) {
+    struct TableManagerData * data = table_manager_data_alloc(2, 4, 0.0, 1.0);
+    double error = 0.0;
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_rel_error(data, 1.0, &error));
+    TEST_ASSERT_TRUE(isinf(error));
+    /* Four rays of weight 1 (error 1/2) and one of weight 1 (error 1). */
+    data->p1[1] = 4.0;
+    data->p2[1] = 4.0;
+    data->n[1]  = 4;
+    data->p1[6] = 1.0;
+    data->p2[6] = 1.0;
+    data->n[6]  = 1;
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_rel_error(data, 1.0, &error));
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 1.0, error);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_rel_error(data, 0.5, &error));
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 0.5, error);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_rel_error(data, 0.9, &error));
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 1.0, error);
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_data_rel_error(data, 0.0, &error));
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_data_rel_error(data, 1.5, &error));
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_data_rel_error(NULL, 1.0, &error));
+    table_manager_data_free(data);
+}
+
+void test_data_rel_error_reads_unreduced_slabs(void) {
+    struct TableManagerData * data = table_manager_data_alloc(1, 4, 0.0, 1.0);
+    table_manager_data_set_accumulation(data, TABLE_MANAGER_ACCUMULATE_PRIVATE, 2);
+    table_manager_data_set_layout(data, TABLE_MANAGER_LAYOUT_INTERLEAVED);
+    data->slabs[0]->cells[2].p1 = 1.0;
+    data->slabs[0]->cells[2].p2 = 1.0;
+    data->slabs[0]->cells[2].n  = 1;
+    data->slabs[1]->cells[2].p1 = 3.0;
+    data->slabs[1]->cells[2].p2 = 3.0;
+    data->slabs[1]->cells[2].n  = 3;
+    double before = 0.0, after = 0.0;
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_rel_error(data, 1.0, &before));
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 0.5, before);
+    table_manager_data_reduce(data);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_rel_error(data, 1.0, &after));
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, before, after);
+    table_manager_data_free(data);
+}
+
+void test_data_rel_error_step_spreads_a_pass(void) {
+    struct TableManagerData * data = table_manager_data_alloc(2, TABLE_MANAGER_ERROR_CHUNK, 0.0, 1.0);
+    struct TableManagerErrorScan scan;
+    memset(&scan, 0, sizeof(scan));
+    double error = 0.0;
+    /* Four rays of weight 1 (error 1/2) and one of weight 1 (error 1). */
+    data->p1[1] = 4.0;
+    data->p2[1] = 4.0;
+    data->n[1]  = 4;
+    data->p1[TABLE_MANAGER_ERROR_CHUNK + 6] = 1.0;
+    data->p2[TABLE_MANAGER_ERROR_CHUNK + 6] = 1.0;
+    data->n[TABLE_MANAGER_ERROR_CHUNK + 6]  = 1;
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_rel_error_step(data, &scan, 0.5, &error));
+    TEST_ASSERT_EQUAL_size_t(TABLE_MANAGER_ERROR_CHUNK, scan.next);
+    TEST_ASSERT_EQUAL_INT(1, table_manager_data_rel_error_step(data, &scan, 0.5, &error));
+    /* The bucket's upper edge: at most 2^(1/8) above the exact quantile. */
+    TEST_ASSERT_TRUE(error >= 0.5 && error <= 0.5 * exp2(0.125));
+    TEST_ASSERT_EQUAL_size_t(0, scan.next);
+    table_manager_data_rel_error_step(data, &scan, 1.0, &error);
+    TEST_ASSERT_EQUAL_INT(1, table_manager_data_rel_error_step(data, &scan, 1.0, &error));
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 1.0, error);
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_data_rel_error_step(data, &scan, 0.0, &error));
+    table_manager_data_free(data);
+
+    /* Unallocated sparse blocks cost one visit each; no hits gives INFINITY. */
+    data = table_manager_data_alloc_layout(1, TABLE_MANAGER_ERROR_CHUNK * TABLE_MANAGER_SPARSE_BLOCK,
+                                           0.0, 1.0, TABLE_MANAGER_LAYOUT_SPARSE);
+    TEST_ASSERT_EQUAL_INT(1, table_manager_data_rel_error_step(data, &scan, 0.95, &error));
+    TEST_ASSERT_TRUE(isinf(error));
+    table_manager_data_free(data);
+}
+
 int main(void) {
     UNITY_BEGIN();
     RUN_TEST(test_data_alloc_returns_non_null);
@@ -65,5 +498,29 @@ int main(void) {
     RUN_TEST(test_data_free_null_does_not_crash);
     RUN_TEST(test_data_alloc_arrays_are_zero_initialised);
     RUN_TEST(test_data_alloc_single_recorder_single_bin);
+    RUN_TEST(test_accumulation_from_name);
+    RUN_TEST(test_data_alloc_defaults_to_critical);
+    RUN_TEST(test_data_set_private_allocates_slabs);
+    RUN_TEST(test_data_set_atomic_allocates_no_slabs);
+    RUN_TEST(test_data_reduce_sums_and_clears_slabs);
+    RUN_TEST(test_data_windows_default_to_table_window);
+    RUN_TEST(test_data_set_window_reaches_slabs);
+    RUN_TEST(test_binning_from_name);
+    RUN_TEST(test_data_log_binning_sets_log_scale);
+    RUN_TEST(test_data_edge_binning_copies_edges);
+    RUN_TEST(test_layout_from_name);
+    RUN_TEST(test_data_interleaved_cells_are_aligned_records);
+    RUN_TEST(test_data_interleaved_layout_applies_to_slabs);
+    RUN_TEST(test_data_reduce_converts_interleaved_to_arrays);
+    RUN_TEST(test_data_sparse_layout_drops_dense_arrays);
+    RUN_TEST(test_data_alloc_layout_allocates_only_its_storage);
+    RUN_TEST(test_data_sparse_rejects_atomic);
+    RUN_TEST(test_data_reduce_folds_sparse_slabs);
+    RUN_TEST(test_data_alloc_like_copies_binning);
+    RUN_TEST(test_data_merge_sums_across_layouts);
+    RUN_TEST(test_data_merge_rejects_different_bins);
+    RUN_TEST(test_data_rel_error_weights_bins_by_probability);
+    RUN_TEST(test_data_rel_error_reads_unreduced_slabs);
+    RUN_TEST(test_data_rel_error_step_spreads_a_pass);
     return UNITY_END();
 }
@@ -0,0 +1,139 @@
+/* test_events.c – Unity tests for event streaming: the file layout, ring
+ * back-pressure and concurrent producers.  Files are read back with stdio. */
+#include "unity.h"
+#include "tof-table-lib.h"
+#include "particle_stub.h"
+#include <stdint.h>
+#include <string.h>
+
+#define TEST_MANAGER_IDX  9
+#define EVENT_FILE        "test_events_tmp.bin"
+
+void setUp(void) {
+    table_manager_state_alloc();
+    table_manager_state_add_recorder("rec0", 1.0);
+    table_manager_state_add_recorder("rec1", 2.0);
+    table_manager_state_finalize(TEST_MANAGER_IDX, "table_manager_t", "table_manager_p",
+                                 "table_manager_n", "table_manager_z");
+}
+
+void tearDown(void) {
+    table_manager_state_free();
+    remove(EVENT_FILE);
+}
+
+/* Helper: read the whole event file; returns the number of bytes read. */
+static size_t read_events(unsigned char * buf, size_t buf_size) {
+    FILE * f = fopen(EVENT_FILE, "rb");
+    TEST_ASSERT_NOT_NULL(f);
+    size_t n = fread(buf, 1, buf_size, f);
+    fclose(f);
+    return n;
+}
+
+static double record_value(const unsigned char * buf, size_t record, int recorders, int k) {
+    double x;
+    memcpy(&x, buf + 64 + (record * 2 * (size_t) recorders + (size_t) k) * sizeof(double), sizeof(x));
+    return x;
+}
+
+/* ---- file layout ---- */
+
+void test_events_header_layout(void) {
+    struct TableManagerEvents * ev = table_manager_events_open(EVENT_FILE, 3, 1 << 16);
+    TEST_ASSERT_NOT_NULL(ev);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_events_close(ev));
+    unsigned char buf[128];
+    TEST_ASSERT_EQUAL_INT(64, (int) read_events(buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_INT(0, memcmp(buf, "TOFEVENT", 8));
+    uint32_t fields[4];
+    memcpy(fields, buf + 8, sizeof(fields));
+    TEST_ASSERT_EQUAL_INT(1, (int) fields[0]);
+    TEST_ASSERT_EQUAL_INT(3, (int) fields[1]);
+    TEST_ASSERT_EQUAL_INT(48, (int) fields[2]);
+    TEST_ASSERT_EQUAL_INT(0x01020304, (int) fields[3]);
+}
+
+void test_events_open_rejects_no_recorders(void) {
+    TEST_ASSERT_NULL(table_manager_events_open(EVENT_FILE, 0, 1 << 16));
+    TEST_ASSERT_NULL(table_manager_events_open(NULL, 2, 1 << 16));
+}
+
+void test_events_unreached_recorders_are_nan(void) {
+    _class_particle p = {0};
+    struct TableManagerEvents * ev = table_manager_events_open(EVENT_FILE, 2, 1 << 16);
+    table_manager_particle_alloc(&p, 0.0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_to_events(&p, ev));
+    p.t = 1.5;
+    p.p = 0.25;
+    table_manager_particle_record(&p, 1);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_to_events(&p, ev));
+    table_manager_particle_free(&p);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_events_close(ev));
+
+    unsigned char buf[256];
+    TEST_ASSERT_EQUAL_INT(64 + 32, (int) read_events(buf, sizeof(buf)));
+    TEST_ASSERT_TRUE(isnan(record_value(buf, 0, 2, 0)));
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 1.5, record_value(buf, 0, 2, 1));
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 0.0, record_value(buf, 0, 2, 2));
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 0.25, record_value(buf, 0, 2, 3));
+}
+
+/* ---- rings ---- */
+
+void test_events_full_ring_waits_and_keeps_order(void) {
+    enum { EVENTS = 1000 };
+    /* A ring_bytes of 0 leaves two slots per ring. */
+    struct TableManagerEvents * ev = table_manager_events_open(EVENT_FILE, 1, 0);
+    double hits = 0.0;
+    uint64_t bit = 1;
+    memcpy(&hits, &bit, sizeof(bit));
+    for (int i = 0; i < EVENTS; ++i) {
+        double t = i, p = 1.0;
+        TEST_ASSERT_EQUAL_INT(0, table_manager_events_push(ev, &t, &p, &hits));
+    }
+    TEST_ASSERT_EQUAL_INT(0, table_manager_events_close(ev));
+
+    static unsigned char buf[64 + EVENTS * 16 + 16];
+    TEST_ASSERT_EQUAL_INT(64 + EVENTS * 16, (int) read_events(buf, sizeof(buf)));
+    for (int i = 0; i < EVENTS; ++i)
+        TEST_ASSERT_EQUAL_DOUBLE((double) i, record_value(buf, (size_t) i, 1, 0));
+}
+
+void test_events_parallel_producers_write_every_ray(void) {
+    enum { EVENTS = 20000 };
+    struct TableManagerEvents * ev = table_manager_events_open(EVENT_FILE, 1, 4096);
+    double hits = 0.0;
+    uint64_t bit = 1;
+    memcpy(&hits, &bit, sizeof(bit));
+    int failures = 0;
+    #pragma omp parallel for reduction(+:failures)
+    for (int i = 0; i < EVENTS; ++i) {
+        double t = i, p = 2.0;
+        failures += table_manager_events_push(ev, &t, &p, &hits) != 0;
+    }
+    TEST_ASSERT_EQUAL_INT(0, failures);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_events_close(ev));
+
+    static unsigned char buf[64 + EVENTS * 16 + 16];
+    TEST_ASSERT_EQUAL_INT(64 + EVENTS * 16, (int) read_events(buf, sizeof(buf)));
+    static unsigned char seen[EVENTS];
+    memset(seen, 0, sizeof(seen));
+    for (int i = 0; i < EVENTS; ++i) {
+        int t = (int) record_value(buf, (size_t) i, 1, 0);
+        TEST_ASSERT_TRUE(t >= 0 && t < EVENTS);
+        seen[t]++;
+    }
+    for (int i = 0; i < EVENTS; ++i)
+        TEST_ASSERT_EQUAL_INT(1, seen[i]);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_events_header_layout);
+    RUN_TEST(test_events_open_rejects_no_recorders);
+    RUN_TEST(test_events_unreached_recorders_are_nan);
+    RUN_TEST(test_events_full_ring_waits_and_keeps_order);
+    RUN_TEST(test_events_parallel_producers_write_every_ray);
+    return UNITY_END();
+}
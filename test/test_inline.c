@@ -0,0 +1,139 @@
+/* test_inline.c – Unity tests for inline per-particle storage.
+ *
+ * Built with TOF_TABLE_MAX_RECORDERS=4, which adds the table_manager_ray
+ * array to the stub _struct_particle so the state finalizes into inline
+ * mode. */
+#include "unity.h"
+#include "tof-table-lib.h"
+#include "particle_stub.h"
+
+#define TEST_MANAGER_IDX  9
+#define T_BASE  "table_manager_t"
+#define P_BASE  "table_manager_p"
+#define N_BASE  "table_manager_n"
+#define Z_BASE  "table_manager_z"
+
+void setUp(void) {
+    table_manager_state_alloc();
+    table_manager_state_add_recorder("rec0", 1.0);
+    table_manager_state_add_recorder("rec1", 2.0);
+    table_manager_state_finalize(TEST_MANAGER_IDX, T_BASE, P_BASE, N_BASE, Z_BASE);
+}
+
+void tearDown(void) {
+    table_manager_state_free();
+}
+
+void test_inline_alloc_uses_particle_storage(void) {
+    _class_particle p = {0};
+    table_manager_particle_alloc(&p, 0.5);
+    TEST_ASSERT_EQUAL_INT(0, p.table_manager_n_9);
+    p.t = 1.0;
+    p.p = 0.25;
+    table_manager_particle_record(&p, 1);
+    TEST_ASSERT_EQUAL_INT(2, p.table_manager_n_9);
+    TEST_ASSERT_NULL(p.table_manager_t_9);
+    TEST_ASSERT_NULL(p.table_manager_p_9);
+    TEST_ASSERT_EQUAL_PTR(&p.table_manager_ray[0], table_manager_particle_t_array(&p));
+    TEST_ASSERT_EQUAL_PTR(&p.table_manager_ray[4], table_manager_particle_p_array(&p));
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 1.5, p.table_manager_ray[1]);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 0.25, p.table_manager_ray[5]);
+    table_manager_particle_free(&p);
+}
+
+void test_inline_never_touches_the_pool(void) {
+    for (int i = 0; i < 10; ++i) {
+        _class_particle p = {0};
+        table_manager_particle_alloc(&p, 0.0);
+        table_manager_particle_record(&p, 0);
+        table_manager_particle_free(&p);
+    }
+    long long hits, misses;
+    table_manager_state_pool_stats(&hits, &misses, NULL);
+    TEST_ASSERT_EQUAL_INT(0, hits);
+    TEST_ASSERT_EQUAL_INT(0, misses);
+}
+
+void test_inline_record_and_bin_from_a_copy(void) {
+    struct TableManagerData * data = table_manager_data_alloc(2, 10, 0.0, 1.0);
+    _class_particle p = {0};
+    table_manager_particle_alloc(&p, 0.0);
+    p.t = 0.15;
+    p.p = 1.0;
+    table_manager_particle_record(&p, 0);
+    p.t = 0.35;
+    table_manager_particle_record(&p, 1);
+
+    /* A struct copy carries its own recorded values. */
+    _class_particle copy = p;
+    p.table_manager_ray[1] = 0.95;
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_to_table(&copy, data));
+    TEST_ASSERT_EQUAL_INT(1, data->n[0 * 10 + 1]);
+    TEST_ASSERT_EQUAL_INT(1, data->n[1 * 10 + 3]);
+    TEST_ASSERT_EQUAL_INT(0, data->n[1 * 10 + 9]);
+
+    table_manager_particle_free(&copy);
+    TEST_ASSERT_EQUAL_INT(0, copy.table_manager_n_9);
+    TEST_ASSERT_NULL(table_manager_particle_t_array(&copy));
+    table_manager_particle_free(&p);
+    table_manager_data_free(data);
+}
+
+void test_inline_too_many_recorders_falls_back_to_heap(void) {
+    table_manager_state_free();
+    table_manager_state_alloc();
+    for (int i = 0; i < 5; ++i)
+        table_manager_state_add_recorder("rec", (double) i);
+    table_manager_state_finalize(TEST_MANAGER_IDX, T_BASE, P_BASE, N_BASE, Z_BASE);
+
+    _class_particle p = {0};
+    table_manager_particle_alloc(&p, 0.0);
+    table_manager_particle_record(&p, 4);
+    TEST_ASSERT_NOT_NULL(p.table_manager_t_9);
+    TEST_ASSERT_EQUAL_PTR(p.table_manager_t_9, table_manager_particle_t_array(&p));
+    table_manager_particle_free(&p);
+}
+
+void test_inline_old_array_name_is_refused(void) {
+    table_manager_state_free();
+    table_manager_state_alloc();
+    table_manager_state_add_recorder("rec0", 1.0);
+    particle_stub_old_inline = 1;
+    table_manager_state_finalize(TEST_MANAGER_IDX, T_BASE, P_BASE, N_BASE, Z_BASE);
+    particle_stub_old_inline = 0;
+    _class_particle p = {0};
+    table_manager_particle_alloc(&p, 0.0);
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_particle_record(&p, 0));
+}
+
+void test_inline_goes_to_one_of_concurrent_contexts(void) {
+    table_manager_state_free();
+    struct TableManagerState * ctx[8];
+    #pragma omp parallel for
+    for (int i = 0; i < 8; ++i) {
+        ctx[i] = table_manager_ctx_alloc(1);
+        table_manager_ctx_add_recorder(ctx[i], "rec0", 1.0);
+        table_manager_ctx_finalize(ctx[i], TEST_MANAGER_IDX, T_BASE, P_BASE, N_BASE, Z_BASE);
+    }
+    int owners = 0;
+    for (int i = 0; i < 8; ++i) {
+        _class_particle p = {0};
+        table_manager_ctx_particle_alloc(ctx[i], &p, 0.0);
+        TEST_ASSERT_EQUAL_INT(0, table_manager_ctx_particle_record(ctx[i], &p, 0));
+        owners += table_manager_ctx_particle_t_array(ctx[i], &p) == &p.table_manager_ray[0];
+        table_manager_ctx_particle_free(ctx[i], &p);
+        table_manager_ctx_free(ctx[i]);
+    }
+    TEST_ASSERT_EQUAL_INT(1, owners);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_inline_alloc_uses_particle_storage);
+    RUN_TEST(test_inline_never_touches_the_pool);
+    RUN_TEST(test_inline_record_and_bin_from_a_copy);
+    RUN_TEST(test_inline_too_many_recorders_falls_back_to_heap);
+    RUN_TEST(test_inline_old_array_name_is_refused);
+    RUN_TEST(test_inline_goes_to_one_of_concurrent_contexts);
+    return UNITY_END();
+}
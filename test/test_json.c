@@ -1,10 +1,15 @@
-/* test_json.c – Unity tests for the JSON helper functions and the output
- * file writer.  File content is checked via tmpfile() + rewind(). */
+/* test_json.c – Unity tests for the JSON and .npy helper functions and the
+ * output file writer.  File content is checked via tmpfile() + rewind(). */
 #include "unity.h"
 #include "tof-table-lib.h"
 #include "particle_stub.h"
+#include <stdint.h>
 #include <string.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 /* Helper: read the full content of a rewound FILE* into a caller-supplied
  * buffer.  Returns the number of bytes read. */
 static size_t read_tmpfile(FILE * f, char * buf, size_t buf_size) {
@@ -104,6 +109,61 @@ void test_json_array_string_values(void) {
     fclose(f);
 }
 
+void test_json_array_double_matches_15g_when_exact(void) {
+    double arr[] = {0.0, -0.0, 1.0, -42.0, 0.1, 2.5e-7, 123456.789, 1e15, 6.02214076e23};
+    int n = (int) (sizeof(arr) / sizeof(arr[0]));
+    FILE * f = tmpfile();
+    table_manager_json_array_double(f, arr, n);
+    char buf[512], expected[512];
+    read_tmpfile(f, buf, sizeof(buf));
+    fclose(f);
+    int len = snprintf(expected, sizeof(expected), "[");
+    for (int i = 0; i < n; ++i)
+        len += snprintf(expected + len, sizeof(expected) - (size_t) len, i < n - 1 ? "%.15g, " : "%.15g", arr[i]);
+    snprintf(expected + len, sizeof(expected) - (size_t) len, "]");
+    TEST_ASSERT_EQUAL_STRING(expected, buf);
+}
+
+void test_json_array_double_spells_non_finite_values(void) {
+    FILE * f = tmpfile();
+    TEST_ASSERT_NOT_NULL(f);
+    double x[3] = {NAN, INFINITY, -INFINITY};
+    table_manager_json_array_double(f, x, 3);
+    char buf[64];
+    read_tmpfile(f, buf, sizeof(buf));
+    fclose(f);
+    TEST_ASSERT_EQUAL_STRING("[NaN, Infinity, -Infinity]", buf);
+}
+
+void test_json_array_double_round_trips_exactly(void) {
+    /* Values that need 16 or 17 significant digits. */
+    enum { N = 1000 };
+    static double arr[N];
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < N; ++i) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        arr[i] = (double) (state >> 11) * 0x1.0p-53 * pow(10.0, (double) (i % 40 - 20));
+    }
+    arr[0] = 0.1 + 0.2;
+    FILE * f = tmpfile();
+    TEST_ASSERT_EQUAL_INT(0, table_manager_json_array_double(f, arr, N));
+    static char buf[N * 32];
+    read_tmpfile(f, buf, sizeof(buf));
+    fclose(f);
+    TEST_ASSERT_NOT_NULL(strstr(buf, "[0.30000000000000004, "));
+    char * s = buf + 1;
+    for (int i = 0; i < N; ++i) {
+        char * end;
+        double v = strtod(s, &end);
+        TEST_ASSERT_TRUE(end != s);
+        TEST_ASSERT_TRUE(v == arr[i]);
+        s = end + (i < N - 1 ? 2 : 0);
+    }
+    TEST_ASSERT_EQUAL_STRING("]", s);
+}
+
 /* ---- json_matrix_double ---- */
 
 void test_json_matrix_double_shape(void) {
@@ -120,6 +180,49 @@ void test_json_matrix_double_shape(void) {
     fclose(f);
 }
 
+void test_json_matrix_double_chunks_match_rows(void) {
+    /* Large enough to span several chunks, with chunk boundaries falling
+     * inside rows; the result must equal the rows written one by one. */
+    enum { M = 3, N = 50000 };
+    static double mat[M * N];
+    for (int i = 0; i < M * N; ++i)
+        mat[i] = i % 7 ? 0.0 : i * 0.1;
+#ifdef _OPENMP
+    int threads = omp_get_max_threads();
+    omp_set_num_threads(4);
+#endif
+    FILE * f = tmpfile();
+    TEST_ASSERT_EQUAL_INT(0, table_manager_json_matrix_double(f, mat, M, N, 1));
+    FILE * g = tmpfile();
+    fprintf(g, "[\n");
+    for (int i = 0; i < M; ++i) {
+        table_manager_json_indent(g, 2);
+        table_manager_json_array_double(g, &mat[i * N], N);
+        fprintf(g, i < M - 1 ? ",\n" : "\n");
+    }
+    table_manager_json_indent(g, 1);
+    fprintf(g, "]");
+#ifdef _OPENMP
+    omp_set_num_threads(threads);
+#endif
+    static char buf[M * N * 24], expected[M * N * 24];
+    size_t n = read_tmpfile(f, buf, sizeof(buf));
+    size_t n_expected = read_tmpfile(g, expected, sizeof(expected));
+    fclose(f);
+    fclose(g);
+    TEST_ASSERT_EQUAL_size_t(n_expected, n);
+    TEST_ASSERT_EQUAL_MEMORY(expected, buf, n);
+}
+
+void test_json_matrix_empty_rows(void) {
+    FILE * f = tmpfile();
+    TEST_ASSERT_EQUAL_INT(0, table_manager_json_matrix_int(f, NULL, 2, 0, 0));
+    char buf[64];
+    read_tmpfile(f, buf, sizeof(buf));
+    fclose(f);
+    TEST_ASSERT_EQUAL_STRING("[\n  [],\n  []\n]", buf);
+}
+
 /* ---- json_matrix_int ---- */
 
 void test_json_matrix_int_shape(void) {
@@ -140,7 +243,7 @@ void test_json_matrix_int_shape(void) {
 void test_write_output_file_creates_file(void) {
     table_manager_state_alloc();
     table_manager_state_add_recorder("test_rec", 1.5);
-    table_manager_state_finalize(9, "table_manager_t", "table_manager_p", "table_manager_n");
+    table_manager_state_finalize(9, "table_manager_t", "table_manager_p", "table_manager_n", "table_manager_z");
 
     struct TableManagerData * data = table_manager_data_alloc(1, 3, 0.0, 1.0);
     memset(data->tp, 0, sizeof(double) * 3);
@@ -185,6 +288,210 @@ void test_write_output_file_creates_file(void) {
     table_manager_state_free();
 }
 
+void test_write_output_file_per_recorder_edges(void) {
+    table_manager_state_alloc();
+    table_manager_state_add_recorder("near", 2.0);
+    table_manager_state_add_recorder("far", 160.0);
+    table_manager_state_finalize(9, "table_manager_t", "table_manager_p", "table_manager_n", "table_manager_z");
+
+    struct TableManagerData * data = table_manager_data_alloc(2, 2, 0.0, 1.0);
+    table_manager_data_set_window(data, 1, 40.0, 50.0);
+
+    const char * fname = "test_output_windows_tmp.json";
+    TEST_ASSERT_EQUAL_INT(0, table_manager_write_output_file(fname, data));
+    FILE * f = fopen(fname, "r");
+    TEST_ASSERT_NOT_NULL(f);
+    char buf[8192];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    buf[n] = '\0';
+    fclose(f);
+    remove(fname);
+
+    const char * time = strstr(buf, "\"time\": {");
+    TEST_ASSERT_NOT_NULL(time);
+    TEST_ASSERT_NOT_NULL(strstr(time, "\"dims\": [\"recorder\", \"time\"]"));
+    TEST_ASSERT_NOT_NULL(strstr(time, "[0, 0.5, 1]"));
+    TEST_ASSERT_NOT_NULL(strstr(time, "[40, 45, 50]"));
+
+    table_manager_data_free(data);
+    table_manager_state_free();
+}
+
+void test_write_output_file_writes_binning_edges(void) {
+    table_manager_state_alloc();
+    table_manager_state_add_recorder("rec0", 1.0);
+    table_manager_state_finalize(9, "table_manager_t", "table_manager_p", "table_manager_n", "table_manager_z");
+    const char * fname = "test_output_edges_tmp.json";
+    char buf[8192];
+
+    struct TableManagerData * data = table_manager_data_alloc(1, 3, 1.0, 8.0);
+    table_manager_data_set_binning(data, TABLE_MANAGER_BINNING_LOG, NULL);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_write_output_file(fname, data));
+    FILE * f = fopen(fname, "r");
+    TEST_ASSERT_NOT_NULL(f);
+    buf[fread(buf, 1, sizeof(buf) - 1, f)] = '\0';
+    fclose(f);
+    TEST_ASSERT_NOT_NULL(strstr(buf, "[1, 2"));
+    TEST_ASSERT_NOT_NULL(strstr(buf, ", 8]"));
+    table_manager_data_free(data);
+
+    const double edges[4] = {0.5, 0.75, 2.0, 3.0};
+    data = table_manager_data_alloc(1, 3, 0.0, 1.0);
+    table_manager_data_set_binning(data, TABLE_MANAGER_BINNING_EDGES, edges);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_write_output_file(fname, data));
+    f = fopen(fname, "r");
+    TEST_ASSERT_NOT_NULL(f);
+    buf[fread(buf, 1, sizeof(buf) - 1, f)] = '\0';
+    fclose(f);
+    remove(fname);
+    const char * time = strstr(buf, "\"time\": {");
+    TEST_ASSERT_NOT_NULL(time);
+    TEST_ASSERT_NOT_NULL(strstr(time, "\"dims\": [\"time\"]"));
+    TEST_ASSERT_NOT_NULL(strstr(time, "[0.5, 0.75, 2, 3]"));
+
+    table_manager_data_free(data);
+    table_manager_state_free();
+}
+
+/* ---- npy ---- */
+
+void test_npy_write_double_layout(void) {
+    double x[6] = {0.0, 1.0, 2.0, 3.0, 4.0, 5.5};
+    const char * fname = "test_npy_tmp.npy";
+    TEST_ASSERT_EQUAL_INT(0, table_manager_npy_write_double(fname, x, 2, 3));
+
+    FILE * f = fopen(fname, "rb");
+    TEST_ASSERT_NOT_NULL(f);
+    unsigned char buf[512];
+    size_t n = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+    remove(fname);
+
+    TEST_ASSERT_EQUAL_MEMORY("\x93NUMPY\x01\x00", buf, 8);
+    size_t header = (size_t) buf[8] | ((size_t) buf[9] << 8);
+    TEST_ASSERT_EQUAL_INT(0, (int) ((10 + header) % 64));
+    TEST_ASSERT_EQUAL_size_t(10 + header + sizeof(x), n);
+    TEST_ASSERT_EQUAL_INT('\n', buf[10 + header - 1]);
+    char text[256];
+    memcpy(text, buf + 10, header);
+    text[header] = '\0';
+    TEST_ASSERT_NOT_NULL(strstr(text, "f8'"));
+    TEST_ASSERT_NOT_NULL(strstr(text, "'fortran_order': False"));
+    TEST_ASSERT_NOT_NULL(strstr(text, "'shape': (2, 3)"));
+    TEST_ASSERT_EQUAL_MEMORY(x, buf + 10 + header, sizeof(x));
+}
+
+void test_npy_write_large_shape(void) {
+    /* A dict too long for the minimal 64-byte header must still fit. */
+    enum { ROWS = 3, COLS = 100000 };
+    static double x[ROWS * COLS];
+    x[ROWS * COLS - 1] = 2.5;
+    const char * fname = "test_npy_large_tmp.npy";
+    TEST_ASSERT_EQUAL_INT(0, table_manager_npy_write_double(fname, x, ROWS, COLS));
+
+    FILE * f = fopen(fname, "rb");
+    TEST_ASSERT_NOT_NULL(f);
+    unsigned char buf[256];
+    TEST_ASSERT_EQUAL_size_t(sizeof(buf), fread(buf, 1, sizeof(buf), f));
+    size_t header = (size_t) buf[8] | ((size_t) buf[9] << 8);
+    TEST_ASSERT_EQUAL_INT(0, (int) ((10 + header) % 64));
+    TEST_ASSERT_TRUE(header > 64 && header < sizeof(buf) - 10);
+    TEST_ASSERT_EQUAL_INT('\n', buf[10 + header - 1]);
+    char text[256];
+    memcpy(text, buf + 10, header);
+    text[header] = '\0';
+    TEST_ASSERT_NOT_NULL(strstr(text, "'shape': (3, 100000)"));
+    double last;
+    TEST_ASSERT_EQUAL_INT(0, fseek(f, (long) (10 + header + sizeof(x) - sizeof(last)), SEEK_SET));
+    TEST_ASSERT_EQUAL_size_t(1, fread(&last, sizeof(last), 1, f));
+    TEST_ASSERT_EQUAL_INT(EOF, fgetc(f));
+    fclose(f);
+    remove(fname);
+    TEST_ASSERT_EQUAL_DOUBLE(2.5, last);
+}
+
+void test_write_output_npy_references_array_files(void) {
+    table_manager_state_alloc();
+    table_manager_state_add_recorder("test_rec", 1.5);
+    table_manager_state_finalize(9, "table_manager_t", "table_manager_p", "table_manager_n", "table_manager_z");
+    struct TableManagerData * data = table_manager_data_alloc(1, 3, 0.0, 1.0);
+    data->n[2] = 7;
+
+    const char * fname = "test_output_npy_tmp.json";
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_write_output(fname, data, 99));
+    TEST_ASSERT_EQUAL_INT(0, table_manager_write_output(fname, data, TABLE_MANAGER_FORMAT_NPY));
+    FILE * f = fopen(fname, "r");
+    TEST_ASSERT_NOT_NULL(f);
+    char buf[8192];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    buf[n] = '\0';
+    fclose(f);
+    remove(fname);
+
+    TEST_ASSERT_NOT_NULL(strstr(buf, "\"time\": {"));
+    TEST_ASSERT_NOT_NULL(strstr(buf, "\"file\": \"test_output_npy_tmp.json.tp.npy\""));
+    TEST_ASSERT_NOT_NULL(strstr(buf, "\"file\": \"test_output_npy_tmp.json.n.npy\""));
+    const char * items[] = {"tp", "p1", "p2", "n"};
+    for (int i = 0; i < 4; ++i) {
+        char path[64];
+        snprintf(path, sizeof(path), "%s.%s.npy", fname, items[i]);
+        f = fopen(path, "rb");
+        TEST_ASSERT_NOT_NULL(f);
+        if (i == 3) {
+            unsigned char raw[256];
+            size_t m = fread(raw, 1, sizeof(raw), f);
+            size_t header = (size_t) raw[8] | ((size_t) raw[9] << 8);
+            int values[3];
+            TEST_ASSERT_EQUAL_size_t(10 + header + sizeof(values), m);
+            memcpy(values, raw + 10 + header, sizeof(values));
+            TEST_ASSERT_EQUAL_INT(7, values[2]);
+        }
+        fclose(f);
+        remove(path);
+    }
+
+    table_manager_data_free(data);
+    table_manager_state_free();
+}
+
+void test_write_output_sparse_lists_non_empty_bins(void) {
+    table_manager_state_alloc();
+    table_manager_state_add_recorder("rec0", 1.0);
+    table_manager_state_add_recorder("rec1", 2.0);
+    table_manager_state_finalize(9, "table_manager_t", "table_manager_p", "table_manager_n", "table_manager_z");
+    struct TableManagerData * data = table_manager_data_alloc(2, 1000, 0.0, 1.0);
+    table_manager_data_set_layout(data, TABLE_MANAGER_LAYOUT_SPARSE);
+    _class_particle p = {0};
+    table_manager_particle_alloc(&p, 0.0);
+    p.p = 0.5;
+    p.t = 0.0125;
+    table_manager_particle_record(&p, 0);
+    p.t = 0.9995;
+    table_manager_particle_record(&p, 1);
+    table_manager_particle_to_table(&p, data);
+    table_manager_particle_free(&p);
+
+    const char * fname = "test_output_sparse_tmp.json";
+    TEST_ASSERT_EQUAL_INT(0, table_manager_write_output_file(fname, data));
+    FILE * f = fopen(fname, "r");
+    TEST_ASSERT_NOT_NULL(f);
+    static char buf[65536];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    buf[n] = '\0';
+    fclose(f);
+    remove(fname);
+
+    TEST_ASSERT_NOT_NULL(strstr(buf, "\"format\": \"coo\""));
+    TEST_ASSERT_NOT_NULL(strstr(buf, "\"shape\": [2, 1000]"));
+    TEST_ASSERT_NOT_NULL(strstr(buf, "\"recorder_index\": {\"unit\": null, \"dtype\": \"int32\", \"dims\": [\"entry\"], \"values\": [0, 1]"));
+    TEST_ASSERT_NOT_NULL(strstr(buf, "\"time_index\": {\"unit\": null, \"dtype\": \"int32\", \"dims\": [\"entry\"], \"values\": [12, 999]"));
+    TEST_ASSERT_NOT_NULL(strstr(buf, "\"p1\": {\"unit\": \"dimensionless\", \"dtype\": \"float64\", \"dims\": [\"entry\"], \"values\": [0.5, 0.5]"));
+    TEST_ASSERT_NOT_NULL(strstr(buf, "\"n\": {\"unit\": \"dimensionless\", \"dtype\": \"int32\", \"dims\": [\"entry\"], \"values\": [1, 1]"));
+
+    table_manager_data_free(data);
+    table_manager_state_free();
+}
+
 int main(void) {
     UNITY_BEGIN();
     RUN_TEST(test_json_indent_zero_writes_nothing);
@@ -192,10 +499,21 @@ int main(void) {
     RUN_TEST(test_json_array_double_empty);
     RUN_TEST(test_json_array_double_single);
     RUN_TEST(test_json_array_double_multiple);
+    RUN_TEST(test_json_array_double_matches_15g_when_exact);
+    RUN_TEST(test_json_array_double_spells_non_finite_values);
+    RUN_TEST(test_json_array_double_round_trips_exactly);
     RUN_TEST(test_json_array_int_values);
     RUN_TEST(test_json_array_string_values);
     RUN_TEST(test_json_matrix_double_shape);
+    RUN_TEST(test_json_matrix_double_chunks_match_rows);
+    RUN_TEST(test_json_matrix_empty_rows);
     RUN_TEST(test_json_matrix_int_shape);
     RUN_TEST(test_write_output_file_creates_file);
+    RUN_TEST(test_write_output_file_per_recorder_edges);
+    RUN_TEST(test_write_output_file_writes_binning_edges);
+    RUN_TEST(test_npy_write_double_layout);
+    RUN_TEST(test_npy_write_large_shape);
+    RUN_TEST(test_write_output_npy_references_array_files);
+    RUN_TEST(test_write_output_sparse_lists_non_empty_bins);
     return UNITY_END();
 }
@@ -0,0 +1,149 @@
+/* test_mpi.c – Unity tests for summing tables over MPI ranks.  Run under
+ * mpiexec with several ranks; every rank runs every test, and rank 0 checks
+ * the sums. */
+#include "unity.h"
+#include "tof-table-lib.h"
+#include "particle_stub.h"
+
+#define TEST_MANAGER_IDX  9
+
+static int rank, ranks;
+
+void setUp(void) {
+    table_manager_state_alloc();
+    table_manager_state_add_recorder("rec0", 1.0);
+    table_manager_state_add_recorder("rec1", 2.0);
+    table_manager_state_finalize(TEST_MANAGER_IDX, "table_manager_t", "table_manager_p",
+                                 "table_manager_n", "table_manager_z");
+}
+
+void tearDown(void) {
+    table_manager_state_free();
+}
+
+/* Helper: bins one ray hitting recorder at time t with weight p. */
+static void bin_ray(struct TableManagerData * data, int recorder, double t, double p) {
+    _class_particle ray = {0};
+    table_manager_particle_alloc(&ray, 0.0);
+    ray.t = t;
+    ray.p = p;
+    table_manager_particle_record(&ray, recorder);
+    table_manager_particle_to_table(&ray, data);
+    table_manager_particle_free(&ray);
+}
+
+/* Every rank bins one ray per rank number into bin 1 of recorder 0, and a
+ * clipped ray into recorder 1. */
+static struct TableManagerData * rank_table(int layout) {
+    struct TableManagerData * data = table_manager_data_alloc(2, 10, 0.0, 10.0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_set_layout(data, layout));
+    for (int i = 0; i <= rank; ++i)
+        bin_ray(data, 0, 1.5, 2.0);
+    bin_ray(data, 1, 12.0, 1.0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_reduce(data));
+    return data;
+}
+
+static void check_sums(const struct TableManagerData * total) {
+    /* ranks * (ranks + 1) / 2 rays of weight 2 at t = 1.5 */
+    int rays = ranks * (ranks + 1) / 2;
+    struct TableManagerBin bin;
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_get_bin(total, 0, 1, &bin));
+    TEST_ASSERT_EQUAL_INT(rays, bin.n);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-9, 2.0 * rays, bin.p1);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-9, 4.0 * rays, bin.p2);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-9, 3.0 * rays, bin.tp);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_get_bin(total, 0, 2, &bin));
+    TEST_ASSERT_EQUAL_INT(0, bin.n);
+    TEST_ASSERT_EQUAL_INT(ranks, (int) total->clip_high[1]);
+    TEST_ASSERT_EQUAL_INT(0, (int) total->clip_low[1]);
+}
+
+/* ---- sums ---- */
+
+void test_mpi_reduce_sums_onto_root(void) {
+    struct TableManagerData * data = rank_table(TABLE_MANAGER_LAYOUT_SOA);
+    struct TableManagerData * total = NULL;
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_mpi_reduce(data, &total, 0, MPI_COMM_WORLD));
+    if (rank == 0) {
+        TEST_ASSERT_NOT_NULL(total);
+        check_sums(total);
+    } else {
+        TEST_ASSERT_NULL(total);
+    }
+    table_manager_data_free(total);
+    table_manager_data_free(data);
+}
+
+void test_mpi_reduce_leaves_local_table_alone(void) {
+    struct TableManagerData * data = rank_table(TABLE_MANAGER_LAYOUT_INTERLEAVED);
+    for (int save = 0; save < 2; ++save) {
+        struct TableManagerData * total = NULL;
+        TEST_ASSERT_EQUAL_INT(0, table_manager_data_reduce(data));
+        TEST_ASSERT_EQUAL_INT(0, table_manager_data_mpi_reduce(data, &total, 0, MPI_COMM_WORLD));
+        if (rank == 0)
+            check_sums(total);
+        table_manager_data_free(total);
+    }
+    TEST_ASSERT_EQUAL_INT(rank + 1, data->n[1]);
+    table_manager_data_free(data);
+}
+
+void test_mpi_reduce_sparse_blocks(void) {
+    struct TableManagerData * data = rank_table(TABLE_MANAGER_LAYOUT_SPARSE);
+    /* Only the last rank touches recorder 1's block. */
+    if (rank == ranks - 1)
+        bin_ray(data, 1, 9.5, 1.0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_reduce(data));
+    struct TableManagerData * total = NULL;
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_mpi_reduce(data, &total, 0, MPI_COMM_WORLD));
+    if (rank == 0) {
+        TEST_ASSERT_EQUAL_INT(TABLE_MANAGER_LAYOUT_SPARSE, total->layout);
+        check_sums(total);
+        struct TableManagerBin bin;
+        table_manager_data_get_bin(total, 1, 9, &bin);
+        TEST_ASSERT_EQUAL_INT(1, bin.n);
+    }
+    table_manager_data_free(total);
+    table_manager_data_free(data);
+}
+
+/* ---- validation ---- */
+
+void test_mpi_reduce_rejects_different_windows(void) {
+    struct TableManagerData * data = rank_table(TABLE_MANAGER_LAYOUT_SOA);
+    if (rank == ranks - 1)
+        table_manager_data_set_window(data, 1, 0.0, 20.0);
+    struct TableManagerData * total = NULL;
+    TEST_ASSERT_EQUAL_INT(ranks > 1 ? -1 : 0,
+                          table_manager_data_mpi_reduce(data, &total, 0, MPI_COMM_WORLD));
+    if (ranks > 1)
+        TEST_ASSERT_NULL(total);
+    table_manager_data_free(total);
+    table_manager_data_free(data);
+}
+
+void test_mpi_reduce_rejects_different_shapes(void) {
+    struct TableManagerData * data =
+        table_manager_data_alloc(2, rank == 0 ? 10 : 20, 0.0, 10.0);
+    struct TableManagerData * total = NULL;
+    TEST_ASSERT_EQUAL_INT(ranks > 1 ? -1 : 0,
+                          table_manager_data_mpi_reduce(data, &total, 0, MPI_COMM_WORLD));
+    table_manager_data_free(total);
+    table_manager_data_free(data);
+}
+
+int main(int argc, char ** argv) {
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+    UNITY_BEGIN();
+    RUN_TEST(test_mpi_reduce_sums_onto_root);
+    RUN_TEST(test_mpi_reduce_leaves_local_table_alone);
+    RUN_TEST(test_mpi_reduce_sparse_blocks);
+    RUN_TEST(test_mpi_reduce_rejects_different_windows);
+    RUN_TEST(test_mpi_reduce_rejects_different_shapes);
+    int failures = UNITY_END();
+    MPI_Finalize();
+    return failures;
+}
@@ -11,11 +11,12 @@
 #define T_BASE  "table_manager_t"
 #define P_BASE  "table_manager_p"
 #define N_BASE  "table_manager_n"
+#define Z_BASE  "table_manager_z"
 
 void setUp(void) {
     table_manager_state_alloc();
     table_manager_state_add_recorder("rec0", 1.0);
-    table_manager_state_finalize(TEST_MANAGER_IDX, T_BASE, P_BASE, N_BASE);
+    table_manager_state_finalize(TEST_MANAGER_IDX, T_BASE, P_BASE, N_BASE, Z_BASE);
 }
 
 void tearDown(void) {
@@ -24,26 +25,32 @@ void tearDown(void) {
 
 /* ---- particle_alloc ---- */
 
-void test_particle_alloc_sets_array_size(void) {
+void test_particle_alloc_defers_storage(void) {
     _class_particle p = {0};
-    table_manager_particle_alloc(&p, 0.0);
-    TEST_ASSERT_EQUAL_INT(1, p.table_manager_n_9);
+    table_manager_particle_alloc(&p, 0.42);
+    TEST_ASSERT_NULL(p.table_manager_t_9);
+    TEST_ASSERT_NULL(p.table_manager_p_9);
+    TEST_ASSERT_EQUAL_INT(0, p.table_manager_n_9);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 0.42, p.table_manager_z_9);
     table_manager_particle_free(&p);
 }
 
-void test_particle_alloc_initialises_t_to_t_zero(void) {
+void test_particle_first_record_sets_array_size(void) {
     _class_particle p = {0};
-    table_manager_particle_alloc(&p, 0.42);
+    table_manager_particle_alloc(&p, 0.0);
+    table_manager_particle_record(&p, 0);
+    TEST_ASSERT_EQUAL_INT(1, p.table_manager_n_9);
     TEST_ASSERT_NOT_NULL(p.table_manager_t_9);
-    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 0.42, p.table_manager_t_9[0]);
+    TEST_ASSERT_NOT_NULL(p.table_manager_p_9);
     table_manager_particle_free(&p);
 }
 
-void test_particle_alloc_initialises_p_to_zero(void) {
+void test_particle_record_offsets_time_by_t_zero(void) {
     _class_particle p = {0};
-    table_manager_particle_alloc(&p, 0.0);
-    TEST_ASSERT_NOT_NULL(p.table_manager_p_9);
-    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 0.0, p.table_manager_p_9[0]);
+    table_manager_particle_alloc(&p, -0.25);
+    p.t = 1.0;
+    table_manager_particle_record(&p, 0);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 0.75, p.table_manager_t_9[0]);
     table_manager_particle_free(&p);
 }
 
@@ -51,7 +58,7 @@ void test_particle_alloc_zero_recorders_sets_null_arrays(void) {
     /* Re-initialise state with zero recorders. */
     table_manager_state_free();
     table_manager_state_alloc();
-    table_manager_state_finalize(TEST_MANAGER_IDX, T_BASE, P_BASE, N_BASE);
+    table_manager_state_finalize(TEST_MANAGER_IDX, T_BASE, P_BASE, N_BASE, Z_BASE);
 
     _class_particle p = {0};
     table_manager_particle_alloc(&p, 0.0);
@@ -61,6 +68,17 @@ void test_particle_alloc_zero_recorders_sets_null_arrays(void) {
     /* No free needed – arrays are NULL */
 }
 
+void test_particle_arrays_resolve_heap_storage(void) {
+    _class_particle p = {0};
+    table_manager_particle_alloc(&p, 0.0);
+    TEST_ASSERT_NULL(table_manager_particle_t_array(&p));
+    table_manager_particle_record(&p, 0);
+    TEST_ASSERT_EQUAL_PTR(p.table_manager_t_9, table_manager_particle_t_array(&p));
+    TEST_ASSERT_EQUAL_PTR(p.table_manager_p_9, table_manager_particle_p_array(&p));
+    table_manager_particle_free(&p);
+    TEST_ASSERT_NULL(table_manager_particle_p_array(&p));
+}
+
 /* ---- particle_record ---- */
 
 void test_particle_record_stores_t_and_p(void) {
@@ -91,6 +109,148 @@ void test_particle_record_out_of_bounds_index_returns_error(void) {
     table_manager_particle_free(&p);
 }
 
+void test_particle_recorded_tracks_hits(void) {
+    _class_particle p = {0};
+    table_manager_particle_alloc(&p, 0.0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_recorded(&p, 0));
+    table_manager_particle_record(&p, 0);
+    TEST_ASSERT_EQUAL_INT(1, table_manager_particle_recorded(&p, 0));
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_recorded(&p, 1));
+    table_manager_particle_free(&p);
+}
+
+void test_particle_record_planes_adds_flight_times(void) {
+    table_manager_state_add_recorder("rec0_1", 3.0);
+    table_manager_state_add_recorder("rec0_2", 5.0);
+    _class_particle p = {0};
+    table_manager_particle_alloc(&p, 0.0);
+    p.t = 0.5;
+    p.p = 0.25;
+    double z[3] = {0.0, 2.0, 4.0};
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_record_planes(&p, 0, z, 3, 1000.0));
+    TEST_ASSERT_DOUBLE_WITHIN(1e-15, 0.5, p.table_manager_t_9[0]);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-15, 0.502, p.table_manager_t_9[1]);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-15, 0.504, p.table_manager_t_9[2]);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-15, 0.25, p.table_manager_p_9[2]);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-15, 0.5, p.t);
+    /* Slots past the last recorder are rejected before anything is stored. */
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_particle_record_planes(&p, 1, z, 3, 1000.0));
+    table_manager_particle_free(&p);
+}
+
+void test_particle_record_planes_skips_backward_rays(void) {
+    table_manager_state_add_recorder("rec0_1", 3.0);
+    _class_particle p = {0};
+    table_manager_particle_alloc(&p, 0.0);
+    double z[2] = {0.0, 2.0};
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_record_planes(&p, 0, z, 2, -1000.0));
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_recorded(&p, 0));
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_recorded(&p, 1));
+    table_manager_particle_free(&p);
+}
+
+/* ---- particle_cull ---- */
+
+void test_particle_cull_needs_cull_table(void) {
+    _class_particle p = {0};
+    table_manager_particle_alloc(&p, 0.0);
+    p.t = 50.0;
+    table_manager_particle_record(&p, 0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_cull(&p, 0, 1.0));
+    struct TableManagerData * data = table_manager_data_alloc(2, 10, 0.0, 10.0);
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_state_set_cull_table(data));
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_cull(&p, 0, 1.0));
+    table_manager_data_free(data);
+    table_manager_particle_free(&p);
+}
+
+void test_particle_cull_predicts_downstream_arrival(void) {
+    table_manager_state_add_recorder("rec1", 3.0);
+    struct TableManagerData * data = table_manager_data_alloc(2, 10, 0.0, 10.0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_state_set_cull_table(data));
+    _class_particle p = {0};
+    table_manager_particle_alloc(&p, 0.0);
+    p.t = 10.5;
+    table_manager_particle_record(&p, 0);
+    /* rec1 is 2 m on: the ray reaches it at 12.5 at 1 m/s, 11 at 4 m/s. */
+    TEST_ASSERT_EQUAL_INT(1, table_manager_particle_cull(&p, 0, 1.0));
+    TEST_ASSERT_EQUAL_INT(1, table_manager_particle_cull(&p, 0, 4.0));
+    TEST_ASSERT_EQUAL_INT(1, table_manager_particle_cull(&p, 0, 0.0));
+    /* Early rays may still arrive in rec1's window; unrecorded slots never cull. */
+    p.t = -5.0;
+    table_manager_particle_record(&p, 0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_cull(&p, 0, 1.0));
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_cull(&p, 1, 1.0));
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_cull(&p, 2, 1.0));
+    table_manager_particle_free(&p);
+
+    /* A later recorder with its own, later window keeps the ray alive. */
+    table_manager_data_set_window(data, 1, 10.0, 20.0);
+    table_manager_particle_alloc(&p, 0.0);
+    p.t = 10.5;
+    table_manager_particle_record(&p, 0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_cull(&p, 0, 1.0));
+    TEST_ASSERT_EQUAL_INT(1, table_manager_particle_cull(&p, 0, 0.1));
+    table_manager_particle_free(&p);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_state_set_cull_table(NULL));
+    table_manager_data_free(data);
+}
+
+void test_particle_cull_keeps_rays_with_binned_hits(void) {
+    table_manager_state_add_recorder("rec1", 3.0);
+    struct TableManagerData * data = table_manager_data_alloc(2, 10, 0.0, 10.0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_state_set_cull_table(data));
+    _class_particle p = {0};
+    table_manager_particle_alloc(&p, 0.0);
+    p.t = 5.0;
+    table_manager_particle_record(&p, 0);
+    p.t = 11.0;
+    table_manager_particle_record(&p, 1);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_cull(&p, 1, 1.0));
+    p.t = 10.0;
+    table_manager_particle_record(&p, 0);
+    TEST_ASSERT_EQUAL_INT(1, table_manager_particle_cull(&p, 1, 1.0));
+    table_manager_particle_free(&p);
+    table_manager_state_set_cull_table(NULL);
+    table_manager_data_free(data);
+}
+
+void test_particle_cull_waits_for_auto_range(void) {
+    struct TableManagerData * data = table_manager_data_alloc(1, 10, 0.0, 10.0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_set_auto_range(data, 4, 0.0));
+    TEST_ASSERT_EQUAL_INT(0, table_manager_state_set_cull_table(data));
+    _class_particle p = {0};
+    table_manager_particle_alloc(&p, 0.0);
+    p.t = 50.0;
+    table_manager_particle_record(&p, 0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_cull(&p, 0, 1.0));
+    table_manager_particle_free(&p);
+    table_manager_state_set_cull_table(NULL);
+    table_manager_data_free(data);
+}
+
+void test_particle_cull_is_off_with_several_groups(void) {
+    struct TableManagerData * data = table_manager_data_alloc(1, 10, 0.0, 10.0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_state_set_cull_table(data));
+    _class_particle p = {0};
+    table_manager_particle_alloc(&p, 0.0);
+    p.t = 50.0;
+    table_manager_particle_record(&p, 0);
+    TEST_ASSERT_EQUAL_INT(1, table_manager_particle_cull(&p, 0, 1.0));
+    /* A second group would lose the absorbed ray as well. */
+    table_manager_group_select(table_manager_group("other"));
+    table_manager_state_alloc();
+    table_manager_group_select(NULL);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_cull(&p, 0, 1.0));
+    table_manager_group_select(table_manager_group("other"));
+    table_manager_state_free();
+    table_manager_group_select(NULL);
+    TEST_ASSERT_EQUAL_INT(1, table_manager_particle_cull(&p, 0, 1.0));
+    table_manager_particle_free(&p);
+    table_manager_state_set_cull_table(NULL);
+    table_manager_data_free(data);
+}
+
 /* ---- particle_to_table ---- */
 
 void test_particle_to_table_bins_time_correctly(void) {
@@ -142,11 +302,654 @@ void test_particle_to_table_skips_out_of_range_time(void) {
     table_manager_data_free(data);
 }
 
+void test_particle_to_table_skips_time_just_below_t_min(void) {
+    /* Within one bin width below t_min: must not truncate into bin 0. */
+    struct TableManagerData * data = table_manager_data_alloc(1, 10, 0.0, 1.0);
+    _class_particle p = {0};
+    table_manager_particle_alloc(&p, 0.0);
+    p.t = -0.05;
+    p.p = 1.0;
+    table_manager_particle_record(&p, 0);
+    table_manager_particle_to_table(&p, data);
+    TEST_ASSERT_EQUAL_INT(0, data->n[0]);
+    table_manager_particle_free(&p);
+    table_manager_data_free(data);
+}
+
+void test_particle_to_table_empty_window_bins_nothing(void) {
+    struct TableManagerData * data = table_manager_data_alloc(1, 1, 0.0, 0.0);
+    TEST_ASSERT_EQUAL_DOUBLE(0.0, data->t_scale);
+    _class_particle p = {0};
+    table_manager_particle_alloc(&p, 0.0);
+    p.t = 0.0;
+    p.p = 1.0;
+    table_manager_particle_record(&p, 0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_to_table(&p, data));
+    TEST_ASSERT_EQUAL_INT(0, data->n[0]);
+    table_manager_particle_free(&p);
+    table_manager_data_free(data);
+}
+
+void test_particle_to_table_uses_recorder_windows(void) {
+    table_manager_state_free();
+    table_manager_state_alloc();
+    table_manager_state_add_recorder("near", 2.0);
+    table_manager_state_add_recorder("far", 160.0);
+    table_manager_state_finalize(TEST_MANAGER_IDX, T_BASE, P_BASE, N_BASE, Z_BASE);
+    struct TableManagerData * data = table_manager_data_alloc(2, 10, 0.0, 1.0);
+    table_manager_data_set_window(data, 1, 50.0, 60.0);
+
+    _class_particle p = {0};
+    table_manager_particle_alloc(&p, 0.0);
+    p.p = 1.0;
+    p.t = 0.35;
+    table_manager_particle_record(&p, 0);
+    p.t = 57.5;
+    table_manager_particle_record(&p, 1);
+    table_manager_particle_to_table(&p, data);
+
+    TEST_ASSERT_EQUAL_INT(1, data->n[0 * 10 + 3]);
+    TEST_ASSERT_EQUAL_INT(1, data->n[1 * 10 + 7]);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 57.5, data->tp[1 * 10 + 7]);
+
+    table_manager_particle_free(&p);
+    table_manager_data_free(data);
+}
+
+void test_particle_to_table_log_bins(void) {
+    struct TableManagerData * data = table_manager_data_alloc(1, 4, 1.0, 16.0);
+    table_manager_data_set_binning(data, TABLE_MANAGER_BINNING_LOG, NULL);
+    /* Bins [1,2) [2,4) [4,8) [8,16); interior edges are subject to rounding
+     * of the logarithm, so the samples stay clear of them. */
+    const double times[] = {1.0, 1.9, 2.1, 7.9, 8.1, 15.9, 0.5, 16.5, -1.0};
+    const int bins[]     = {0,   0,   1,   2,   3,   3,    -1,  -1,   -1};
+    for (int i = 0; i < 9; ++i) {
+        _class_particle p = {0};
+        table_manager_particle_alloc(&p, 0.0);
+        p.t = times[i];
+        p.p = 1.0;
+        table_manager_particle_record(&p, 0);
+        table_manager_particle_to_table(&p, data);
+        table_manager_particle_free(&p);
+    }
+    int expected[4] = {0};
+    for (int i = 0; i < 9; ++i)
+        if (bins[i] >= 0)
+            expected[bins[i]]++;
+    for (int b = 0; b < 4; ++b)
+        TEST_ASSERT_EQUAL_INT(expected[b], data->n[b]);
+    table_manager_data_free(data);
+}
+
+void test_particle_to_table_edge_bins_match_linear_search(void) {
+    enum { BINS = 37 };
+    double edges[BINS + 1];
+    edges[0] = 0.25;
+    for (int i = 1; i <= BINS; ++i)
+        edges[i] = edges[i - 1] + 0.01 * (1 + (i * 7) % 5);
+    struct TableManagerData * data = table_manager_data_alloc(1, BINS, 0.0, 1.0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_set_binning(data, TABLE_MANAGER_BINNING_EDGES, edges));
+
+    int expected[BINS] = {0};
+    unsigned seed = 12345;
+    for (int i = 0; i < 2000; ++i) {
+        double t;
+        if (i < 2 * (BINS + 1))
+            t = edges[i / 2] - (i % 2) * 1e-12;  /* exact edges and just below */
+        else {
+            seed = seed * 1103515245u + 12345u;
+            t = 0.2 + 0.8 * (seed >> 8) / (double) (1u << 24);
+        }
+        for (int b = 0; b < BINS; ++b)
+            if (edges[b] <= t && t < edges[b + 1])
+                expected[b]++;
+        _class_particle p = {0};
+        table_manager_particle_alloc(&p, 0.0);
+        p.t = t;
+        p.p = 1.0;
+        table_manager_particle_record(&p, 0);
+        table_manager_particle_to_table(&p, data);
+        table_manager_particle_free(&p);
+    }
+    for (int b = 0; b < BINS; ++b)
+        TEST_ASSERT_EQUAL_INT(expected[b], data->n[b]);
+    table_manager_data_free(data);
+}
+
+static void bin_one(struct TableManagerData * data, int recorder, double t, double p) {
+    _class_particle part = {0};
+    table_manager_particle_alloc(&part, 0.0);
+    part.t = t;
+    part.p = p;
+    table_manager_particle_record(&part, recorder);
+    table_manager_particle_to_table(&part, data);
+    table_manager_particle_free(&part);
+}
+
+void test_particle_to_table_sparse_index_past_int_range(void) {
+    /* 2 x 1.5e9 bins: every bin of recorder 1 lies past 2^31, which only a
+     * sparse table (a ~94 MB block directory) can hold here. */
+    table_manager_state_free();
+    table_manager_state_alloc();
+    table_manager_state_add_recorder("rec0", 1.0);
+    table_manager_state_add_recorder("rec1", 2.0);
+    table_manager_state_finalize(TEST_MANAGER_IDX, T_BASE, P_BASE, N_BASE, Z_BASE);
+    int bins = 1500000000;
+    struct TableManagerData * data =
+        table_manager_data_alloc_layout(2, bins, 0.0, 1.0, TABLE_MANAGER_LAYOUT_SPARSE);
+    TEST_ASSERT_NOT_NULL(data);
+    TEST_ASSERT_NULL(data->tp);
+
+    _class_particle p = {0};
+    table_manager_particle_alloc(&p, 0.0);
+    p.t = 0.75;   /* bin 1.125e9 of recorder 1, flat index 2.625e9 */
+    p.p = 2.0;
+    table_manager_particle_record(&p, 1);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_to_table(&p, data));
+
+    struct TableManagerBin bin;
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_get_bin(data, 1, 1125000000, &bin));
+    TEST_ASSERT_EQUAL_INT(1, bin.n);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 2.0, bin.p1);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_get_bin(data, 0, 1125000000, &bin));
+    TEST_ASSERT_EQUAL_INT(0, bin.n);
+
+    table_manager_particle_free(&p);
+    table_manager_data_free(data);
+}
+
+void test_particle_to_table_counts_clipped_hits(void) {
+    struct TableManagerData * data = table_manager_data_alloc(1, 4, 1.0, 2.0);
+    bin_one(data, 0, 0.5, 1.0);
+    bin_one(data, 0, 2.0, 1.0);
+    bin_one(data, 0, 3.0, 1.0);
+    bin_one(data, 0, 1.5, 1.0);
+    TEST_ASSERT_EQUAL_INT(1, (int) data->clip_low[0]);
+    TEST_ASSERT_EQUAL_INT(2, (int) data->clip_high[0]);
+    TEST_ASSERT_EQUAL_INT(3, (int) table_manager_state_report_clipping(data));
+    table_manager_data_free(data);
+}
+
+void test_particle_to_table_private_folds_clip_counts(void) {
+    struct TableManagerData * data = table_manager_data_alloc(1, 4, 1.0, 2.0);
+    table_manager_data_set_accumulation(data, TABLE_MANAGER_ACCUMULATE_PRIVATE, 1);
+    bin_one(data, 0, 0.5, 1.0);
+    TEST_ASSERT_EQUAL_INT(1, (int) data->slabs[0]->clip_low[0]);
+    table_manager_data_reduce(data);
+    TEST_ASSERT_EQUAL_INT(1, (int) data->clip_low[0]);
+    TEST_ASSERT_EQUAL_INT(0, (int) data->slabs[0]->clip_low[0]);
+    table_manager_data_free(data);
+}
+
+void test_particle_auto_range_buffers_then_replays(void) {
+    table_manager_state_free();
+    table_manager_state_alloc();
+    table_manager_state_add_recorder("a", 1.0);
+    table_manager_state_add_recorder("b", 2.0);
+    table_manager_state_finalize(TEST_MANAGER_IDX, T_BASE, P_BASE, N_BASE, Z_BASE);
+    struct TableManagerData * data = table_manager_data_alloc(2, 4, 0.0, 0.0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_set_auto_range(data, 3, 0.5));
+    table_manager_data_set_window(data, 1, 10.0, 14.0);
+
+    bin_one(data, 0, 2.0, 1.0);
+    bin_one(data, 0, 4.0, 2.0);
+    TEST_ASSERT_EQUAL_INT(1, data->warming);
+    TEST_ASSERT_EQUAL_INT(0, data->n[0] + data->n[1] + data->n[2] + data->n[3]);
+    bin_one(data, 1, 11.5, 1.0);
+    TEST_ASSERT_EQUAL_INT(0, data->warming);
+    TEST_ASSERT_NULL(data->warmup);
+
+    /* Range [2, 4] padded by half its width on each side; b keeps its own. */
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 1.0, data->r_min[0]);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 5.0, data->r_max[0]);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 10.0, data->r_min[1]);
+    TEST_ASSERT_EQUAL_INT(1, data->n[0 * 4 + 1]);
+    TEST_ASSERT_EQUAL_INT(1, data->n[0 * 4 + 3]);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 2.0, data->p1[0 * 4 + 3]);
+    TEST_ASSERT_EQUAL_INT(1, data->n[1 * 4 + 1]);
+
+    /* After the warm-up rays are binned directly. */
+    bin_one(data, 0, 4.9, 1.0);
+    TEST_ASSERT_EQUAL_INT(2, data->n[0 * 4 + 3]);
+    bin_one(data, 0, 6.0, 1.0);
+    TEST_ASSERT_EQUAL_INT(1, (int) data->clip_high[0]);
+    table_manager_data_free(data);
+}
+
+void test_particle_auto_range_ends_at_reduce(void) {
+    struct TableManagerData * data = table_manager_data_alloc(1, 2, 0.0, 0.0);
+    table_manager_data_set_auto_range(data, 100, 0.0);
+    bin_one(data, 0, 3.0, 1.0);
+    bin_one(data, 0, 5.0, 1.0);
+    TEST_ASSERT_EQUAL_INT(1, data->warming);
+    table_manager_data_reduce(data);
+    TEST_ASSERT_EQUAL_INT(0, data->warming);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 3.0, data->r_min[0]);
+    TEST_ASSERT_TRUE(data->r_max[0] > 5.0);
+    TEST_ASSERT_EQUAL_INT(1, data->n[0]);
+    TEST_ASSERT_EQUAL_INT(1, data->n[1]);
+    table_manager_data_free(data);
+}
+
+void test_particle_auto_range_stops_at_its_memory_budget(void) {
+    /* Built with TABLE_MANAGER_WARMUP_BYTES=16384: a single-hit ray takes
+     * 20 bytes of entries and 8 of offsets, so growing past 512 rays would
+     * overrun it. */
+    struct TableManagerData * data = table_manager_data_alloc(1, 4, 0.0, 0.0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_set_auto_range(data, 100000, 0.0));
+    for (int i = 0; i < 2000; ++i)
+        bin_one(data, 0, 1.0 + 0.001 * (i % 1000), 1.0);
+    TEST_ASSERT_EQUAL_INT(0, data->warming);
+    TEST_ASSERT_NULL(data->warmup);
+    /* Ranged on the first 512 rays; every ray is in the table or clipped. */
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 1.0, data->r_min[0]);
+    TEST_ASSERT_TRUE(data->r_max[0] > 1.511 && data->r_max[0] < 1.512);
+    long long total = data->clip_low[0] + data->clip_high[0];
+    for (int b = 0; b < 4; ++b)
+        total += data->n[b];
+    TEST_ASSERT_EQUAL_INT(2000, (int) total);
+    TEST_ASSERT_EQUAL_INT(2 * 512, (int) (total - data->clip_high[0]));
+    table_manager_data_free(data);
+}
+
+void test_particle_auto_range_rejects_custom_edges(void) {
+    const double edges[3] = {0.0, 1.0, 2.0};
+    struct TableManagerData * data = table_manager_data_alloc(1, 2, 0.0, 2.0);
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_data_set_auto_range(data, 0, 0.1));
+    TEST_ASSERT_EQUAL_INT(0, table_manager_data_set_auto_range(data, 10, 0.1));
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_data_set_binning(data, TABLE_MANAGER_BINNING_EDGES, edges));
+    table_manager_data_free(data);
+}
+
+/* ---- batched particles ---- */
+
+static void use_recorders(int n) {
+    table_manager_state_free();
+    table_manager_state_alloc();
+    for (int i = 0; i < n; ++i)
+        table_manager_state_add_recorder(i ? "other" : "first", 1.0 + i);
+    table_manager_state_finalize(TEST_MANAGER_IDX, T_BASE, P_BASE, N_BASE, Z_BASE);
+}
+
+void test_particles_record_records_every_particle(void) {
+    enum { COUNT = 5 };
+    _class_particle ps[COUNT] = {{0}};
+    for (int i = 0; i < COUNT; ++i) {
+        table_manager_particle_alloc(&ps[i], 0.0);
+        ps[i].t = 0.1 * i;
+        ps[i].p = 1.0;
+    }
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_particles_record(ps, COUNT, 1));
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particles_record(ps, COUNT, 0));
+    for (int i = 0; i < COUNT; ++i) {
+        TEST_ASSERT_EQUAL_INT(1, table_manager_particle_recorded(&ps[i], 0));
+        TEST_ASSERT_DOUBLE_WITHIN(1e-12, 0.1 * i, table_manager_particle_t_array(&ps[i])[0]);
+    }
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particles_free(ps, COUNT));
+    for (int i = 0; i < COUNT; ++i)
+        TEST_ASSERT_EQUAL_INT(0, ps[i].table_manager_n_9);
+}
+
+/* Bins the same rays one by one and as one batch, for each binning. */
+void test_particles_to_table_matches_single_particles(void) {
+    enum { COUNT = 150, RECORDERS = 3, BINS = 8 };
+    use_recorders(RECORDERS);
+    const double edges[BINS + 1] = {0.1, 0.2, 0.3, 0.5, 0.8, 1.3, 2.1, 3.4, 5.5};
+    static _class_particle ps[COUNT];
+    for (int binning = 0; binning < 3; ++binning) {
+        struct TableManagerData * single = table_manager_data_alloc(RECORDERS, BINS, 0.25, 4.0);
+        struct TableManagerData * batch = table_manager_data_alloc(RECORDERS, BINS, 0.25, 4.0);
+        table_manager_data_set_binning(single, binning, edges);
+        table_manager_data_set_binning(batch, binning, edges);
+        unsigned seed = 99;
+        memset(ps, 0, sizeof(ps));
+        for (int i = 0; i < COUNT; ++i) {
+            table_manager_particle_alloc(&ps[i], 0.0);
+            for (int r = 0; r < RECORDERS; ++r) {
+                seed = seed * 1103515245u + 12345u;
+                if ((seed >> 16) % 4 == 0)
+                    continue;  /* leave some recorders unreached */
+                ps[i].t = 6.0 * ((seed >> 8) & 0xffff) / 65536.0;
+                ps[i].p = 0.5 + r;
+                table_manager_particle_record(&ps[i], r);
+            }
+        }
+        for (int i = 0; i < COUNT; ++i)
+            table_manager_particle_to_table(&ps[i], single);
+        TEST_ASSERT_EQUAL_INT(0, table_manager_particles_to_table(ps, COUNT, batch));
+        for (int i = 0; i < RECORDERS * BINS; ++i) {
+            TEST_ASSERT_EQUAL_INT(single->n[i], batch->n[i]);
+            TEST_ASSERT_DOUBLE_WITHIN(1e-12, single->p1[i], batch->p1[i]);
+            TEST_ASSERT_DOUBLE_WITHIN(1e-12, single->tp[i], batch->tp[i]);
+        }
+        for (int r = 0; r < RECORDERS; ++r) {
+            TEST_ASSERT_EQUAL_INT((int) single->clip_low[r], (int) batch->clip_low[r]);
+            TEST_ASSERT_EQUAL_INT((int) single->clip_high[r], (int) batch->clip_high[r]);
+        }
+        table_manager_particles_free(ps, COUNT);
+        table_manager_data_free(single);
+        table_manager_data_free(batch);
+    }
+}
+
+void test_particles_to_table_uses_thread_slab(void) {
+    struct TableManagerData * data = table_manager_data_alloc(1, 4, 0.0, 1.0);
+    table_manager_data_set_accumulation(data, TABLE_MANAGER_ACCUMULATE_PRIVATE, 1);
+    _class_particle ps[2] = {{0}};
+    for (int i = 0; i < 2; ++i) {
+        table_manager_particle_alloc(&ps[i], 0.0);
+        ps[i].t = 0.6;
+        ps[i].p = 1.0;
+    }
+    table_manager_particle_record(&ps[1], 0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particles_to_table(ps, 2, data));
+    TEST_ASSERT_EQUAL_INT(1, data->slabs[0]->n[2]);
+    TEST_ASSERT_EQUAL_INT(0, data->n[2]);
+    table_manager_particles_free(ps, 2);
+    table_manager_data_free(data);
+}
+
+void test_particle_to_table_private_bins_into_thread_slab(void) {
+    struct TableManagerData * data = table_manager_data_alloc(1, 10, 0.0, 1.0);
+    table_manager_data_set_accumulation(data, TABLE_MANAGER_ACCUMULATE_PRIVATE, 1);
+
+    _class_particle p = {0};
+    table_manager_particle_alloc(&p, 0.0);
+    p.t = 0.25;
+    p.p = 1.0;
+    table_manager_particle_record(&p, 0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_to_table(&p, data));
+
+    /* Nothing reaches the shared table until the slabs are reduced. */
+    TEST_ASSERT_EQUAL_INT(0, data->n[2]);
+    TEST_ASSERT_EQUAL_INT(1, data->slabs[0]->n[2]);
+    table_manager_data_reduce(data);
+    TEST_ASSERT_EQUAL_INT(1, data->n[2]);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 0.25, data->tp[2]);
+
+    table_manager_particle_free(&p);
+    table_manager_data_free(data);
+}
+
+void test_particle_to_table_modes_agree_in_parallel(void) {
+    const int rays = 10000;
+    struct TableManagerData * shared = table_manager_data_alloc(1, 10, 0.0, 1.0);
+    struct TableManagerData * per_thread = table_manager_data_alloc(1, 10, 0.0, 1.0);
+    struct TableManagerData * atomic = table_manager_data_alloc(1, 10, 0.0, 1.0);
+    table_manager_data_set_accumulation(per_thread, TABLE_MANAGER_ACCUMULATE_PRIVATE, 0);
+    table_manager_data_set_accumulation(atomic, TABLE_MANAGER_ACCUMULATE_ATOMIC, 0);
+
+    #pragma omp parallel for
+    for (int i = 0; i < rays; ++i) {
+        _class_particle p = {0};
+        table_manager_particle_alloc(&p, 0.0);
+        p.t = (i % 10) / 10.0 + 0.05;
+        p.p = 0.5;
+        table_manager_particle_record(&p, 0);
+        table_manager_particle_to_table(&p, shared);
+        table_manager_particle_to_table(&p, per_thread);
+        table_manager_particle_to_table(&p, atomic);
+        table_manager_particle_free(&p);
+    }
+    table_manager_data_reduce(per_thread);
+
+    for (int j = 0; j < 10; ++j) {
+        TEST_ASSERT_EQUAL_INT(rays / 10, per_thread->n[j]);
+        TEST_ASSERT_EQUAL_INT(shared->n[j], per_thread->n[j]);
+        TEST_ASSERT_DOUBLE_WITHIN(1e-9, shared->p1[j], per_thread->p1[j]);
+        TEST_ASSERT_DOUBLE_WITHIN(1e-9, shared->tp[j], per_thread->tp[j]);
+        TEST_ASSERT_EQUAL_INT(shared->n[j], atomic->n[j]);
+        TEST_ASSERT_DOUBLE_WITHIN(1e-9, shared->p2[j], atomic->p2[j]);
+        TEST_ASSERT_DOUBLE_WITHIN(1e-9, shared->tp[j], atomic->tp[j]);
+    }
+
+    table_manager_data_free(shared);
+    table_manager_data_free(per_thread);
+    table_manager_data_free(atomic);
+}
+
+void test_particle_to_table_interleaved_matches_soa(void) {
+    const int rays = 10000;
+    struct TableManagerData * soa = table_manager_data_alloc(1, 10, 0.0, 1.0);
+    struct TableManagerData * data[3];
+    for (int mode = 0; mode < 3; ++mode) {
+        data[mode] = table_manager_data_alloc(1, 10, 0.0, 1.0);
+        table_manager_data_set_accumulation(data[mode], mode, 0);
+        table_manager_data_set_layout(data[mode], TABLE_MANAGER_LAYOUT_INTERLEAVED);
+    }
+
+    #pragma omp parallel for
+    for (int i = 0; i < rays; ++i) {
+        _class_particle p = {0};
+        table_manager_particle_alloc(&p, 0.0);
+        p.t = (i % 10) / 10.0 + 0.05;
+        p.p = 0.5 + (i % 3);
+        table_manager_particle_record(&p, 0);
+        table_manager_particle_to_table(&p, soa);
+        for (int mode = 0; mode < 3; ++mode)
+            table_manager_particle_to_table(&p, data[mode]);
+        table_manager_particle_free(&p);
+    }
+
+    for (int mode = 0; mode < 3; ++mode) {
+        table_manager_data_reduce(data[mode]);
+        for (int j = 0; j < 10; ++j) {
+            TEST_ASSERT_EQUAL_INT(soa->n[j], data[mode]->n[j]);
+            TEST_ASSERT_DOUBLE_WITHIN(1e-9, soa->p1[j], data[mode]->p1[j]);
+            TEST_ASSERT_DOUBLE_WITHIN(1e-9, soa->p2[j], data[mode]->p2[j]);
+            TEST_ASSERT_DOUBLE_WITHIN(1e-9, soa->tp[j], data[mode]->tp[j]);
+        }
+        table_manager_data_free(data[mode]);
+    }
+    table_manager_data_free(soa);
+}
+
+void test_particle_to_table_sparse_matches_soa(void) {
+    const int rays = 10000;
+    const int bins = 100000;
+    struct TableManagerData * soa = table_manager_data_alloc(1, bins, 0.0, 1.0);
+    struct TableManagerData * data[2];
+    for (int mode = 0; mode < 2; ++mode) {
+        data[mode] = table_manager_data_alloc(1, bins, 0.0, 1.0);
+        table_manager_data_set_accumulation(data[mode], mode, 0);
+        TEST_ASSERT_EQUAL_INT(0, table_manager_data_set_layout(data[mode], TABLE_MANAGER_LAYOUT_SPARSE));
+    }
+
+    /* Only a narrow range of times is hit. */
+    #pragma omp parallel for
+    for (int i = 0; i < rays; ++i) {
+        _class_particle p = {0};
+        table_manager_particle_alloc(&p, 0.0);
+        p.t = 0.5 + (i % 10) * 1e-4;
+        p.p = 0.5 + (i % 3);
+        table_manager_particle_record(&p, 0);
+        table_manager_particle_to_table(&p, soa);
+        for (int mode = 0; mode < 2; ++mode)
+            table_manager_particle_to_table(&p, data[mode]);
+        table_manager_particle_free(&p);
+    }
+
+    for (int mode = 0; mode < 2; ++mode) {
+        table_manager_data_reduce(data[mode]);
+        size_t used = 0;
+        for (size_t b = 0; b < data[mode]->n_blocks; ++b)
+            used += data[mode]->blocks[b] != NULL;
+        TEST_ASSERT_TRUE(used <= 2);
+        for (int j = 0; j < bins; ++j) {
+            struct TableManagerBin bin;
+            table_manager_data_get_bin(data[mode], 0, j, &bin);
+            TEST_ASSERT_EQUAL_INT(soa->n[j], bin.n);
+            TEST_ASSERT_DOUBLE_WITHIN(1e-9, soa->p1[j], bin.p1);
+            TEST_ASSERT_DOUBLE_WITHIN(1e-9, soa->p2[j], bin.p2);
+            TEST_ASSERT_DOUBLE_WITHIN(1e-9, soa->tp[j], bin.tp);
+        }
+        table_manager_data_free(data[mode]);
+    }
+    table_manager_data_free(soa);
+}
+
+void test_particle_to_table_skips_unrecorded_recorders(void) {
+    /* Three recorders; the particle only reaches the middle one.  Without hit
+     * tracking the other two would be binned at t_zero (bin 0). */
+    table_manager_state_free();
+    table_manager_state_alloc();
+    table_manager_state_add_recorder("rec0", 1.0);
+    table_manager_state_add_recorder("rec1", 2.0);
+    table_manager_state_add_recorder("rec2", 3.0);
+    table_manager_state_finalize(TEST_MANAGER_IDX, T_BASE, P_BASE, N_BASE, Z_BASE);
+    struct TableManagerData * data = table_manager_data_alloc(3, 10, 0.0, 1.0);
+
+    _class_particle p = {0};
+    table_manager_particle_alloc(&p, 0.0);
+    p.t = 0.55;
+    p.p = 1.0;
+    table_manager_particle_record(&p, 1);
+    table_manager_particle_to_table(&p, data);
+
+    TEST_ASSERT_EQUAL_INT(0, data->n[0 * 10 + 0]);
+    TEST_ASSERT_EQUAL_INT(1, data->n[1 * 10 + 5]);
+    TEST_ASSERT_EQUAL_INT(0, data->n[2 * 10 + 0]);
+
+    table_manager_particle_free(&p);
+    table_manager_data_free(data);
+}
+
+void test_particle_hit_mask_spans_multiple_words(void) {
+    table_manager_state_free();
+    table_manager_state_alloc();
+    for (int i = 0; i < 130; ++i)
+        table_manager_state_add_recorder("rec", (double) i);
+    table_manager_state_finalize(TEST_MANAGER_IDX, T_BASE, P_BASE, N_BASE, Z_BASE);
+    struct TableManagerData * data = table_manager_data_alloc(130, 10, 0.0, 1.0);
+
+    _class_particle p = {0};
+    table_manager_particle_alloc(&p, 0.0);
+    p.t = 0.5;
+    p.p = 1.0;
+    table_manager_particle_record(&p, 3);
+    table_manager_particle_record(&p, 64);
+    table_manager_particle_record(&p, 129);
+    table_manager_particle_to_table(&p, data);
+
+    int total = 0;
+    for (int i = 0; i < 130 * 10; ++i)
+        total += data->n[i];
+    TEST_ASSERT_EQUAL_INT(3, total);
+    TEST_ASSERT_EQUAL_INT(1, data->n[64 * 10 + 5]);
+    TEST_ASSERT_EQUAL_INT(1, data->n[129 * 10 + 5]);
+
+    table_manager_particle_free(&p);
+    table_manager_data_free(data);
+}
+
+/* ---- per-ray pool ---- */
+
+/* Starts a particle and records it at recorder 0, which takes a block. */
+static void start_and_record(_class_particle * p) {
+    table_manager_particle_alloc(p, 0.0);
+    p->t = 0.5;
+    p->p = 1.0;
+    table_manager_particle_record(p, 0);
+}
+
+void test_particle_pool_reuses_freed_block(void) {
+    _class_particle p = {0};
+    start_and_record(&p);
+    double * first = p.table_manager_t_9;
+    table_manager_particle_free(&p);
+    start_and_record(&p);
+    TEST_ASSERT_EQUAL_PTR(first, p.table_manager_t_9);
+    table_manager_particle_free(&p);
+
+    long long hits = -1, misses = -1;
+    table_manager_state_pool_stats(&hits, &misses, NULL);
+    TEST_ASSERT_EQUAL_INT(1, hits);
+    TEST_ASSERT_EQUAL_INT(1, misses);
+}
+
+void test_particle_pool_steady_state_has_no_misses(void) {
+    for (int i = 0; i < 100; ++i) {
+        _class_particle p = {0};
+        start_and_record(&p);
+        table_manager_particle_free(&p);
+    }
+    long long hits, misses;
+    table_manager_state_pool_stats(&hits, &misses, NULL);
+    TEST_ASSERT_EQUAL_INT(99, hits);
+    TEST_ASSERT_EQUAL_INT(1, misses);
+}
+
+void test_particle_pool_reinitialises_reused_block(void) {
+    _class_particle p = {0};
+    start_and_record(&p);
+    table_manager_particle_free(&p);
+    table_manager_particle_alloc(&p, 0.125);
+    table_manager_particle_record(&p, 0);
+    table_manager_particle_free(&p);
+
+    /* The reused block starts with an empty hit mask. */
+    _class_particle q = {0};
+    table_manager_particle_alloc(&q, 0.0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_recorded(&q, 0));
+    table_manager_particle_record(&q, 0);
+    TEST_ASSERT_EQUAL_INT(1, table_manager_particle_recorded(&q, 0));
+    table_manager_particle_free(&q);
+}
+
+void test_particle_unrecorded_particle_takes_no_block(void) {
+    for (int i = 0; i < 10; ++i) {
+        _class_particle p = {0};
+        table_manager_particle_alloc(&p, 0.0);
+        table_manager_particle_free(&p);
+    }
+    long long hits, misses;
+    table_manager_state_pool_stats(&hits, &misses, NULL);
+    TEST_ASSERT_EQUAL_INT(0, hits + misses);
+}
+
+void test_particle_to_table_without_records_is_a_no_op(void) {
+    struct TableManagerData * data = table_manager_data_alloc(1, 10, 0.0, 1.0);
+    _class_particle p = {0};
+    table_manager_particle_alloc(&p, 0.0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_to_table(&p, data));
+    for (int i = 0; i < 10; ++i)
+        TEST_ASSERT_EQUAL_INT(0, data->n[i]);
+    table_manager_data_free(data);
+}
+
+void test_particle_reclaim_recovers_absorbed_block(void) {
+    /* An absorbed particle records but never reaches the manager. */
+    _class_particle absorbed = {0};
+    start_and_record(&absorbed);
+    double * orphan = absorbed.table_manager_t_9;
+
+    TEST_ASSERT_EQUAL_INT(1, table_manager_state_reclaim());
+    TEST_ASSERT_EQUAL_INT(0, table_manager_state_reclaim());
+
+    _class_particle next = {0};
+    start_and_record(&next);
+    TEST_ASSERT_EQUAL_PTR(orphan, next.table_manager_t_9);
+    table_manager_particle_free(&next);
+
+    long long hits, misses, reclaimed;
+    table_manager_state_pool_stats(&hits, &misses, &reclaimed);
+    TEST_ASSERT_EQUAL_INT(1, hits);
+    TEST_ASSERT_EQUAL_INT(1, misses);
+    TEST_ASSERT_EQUAL_INT(1, reclaimed);
+}
+
+void test_particle_state_free_releases_live_blocks(void) {
+    /* Runs under AddressSanitizer/valgrind without leaks. */
+    _class_particle p = {0};
+    start_and_record(&p);
+}
+
 /* ---- particle_free ---- */
 
 void test_particle_free_nullifies_pointers(void) {
     _class_particle p = {0};
     table_manager_particle_alloc(&p, 0.0);
+    table_manager_particle_record(&p, 0);
     TEST_ASSERT_NOT_NULL(p.table_manager_t_9);
     int ret = table_manager_particle_free(&p);
     TEST_ASSERT_EQUAL_INT(0, ret);
@@ -157,15 +960,52 @@ void test_particle_free_nullifies_pointers(void) {
 
 int main(void) {
     UNITY_BEGIN();
-    RUN_TEST(test_particle_alloc_sets_array_size);
-    RUN_TEST(test_particle_alloc_initialises_t_to_t_zero);
-    RUN_TEST(test_particle_alloc_initialises_p_to_zero);
+    RUN_TEST(test_particle_alloc_defers_storage);
+    RUN_TEST(test_particle_first_record_sets_array_size);
+    RUN_TEST(test_particle_record_offsets_time_by_t_zero);
     RUN_TEST(test_particle_alloc_zero_recorders_sets_null_arrays);
+    RUN_TEST(test_particle_arrays_resolve_heap_storage);
     RUN_TEST(test_particle_record_stores_t_and_p);
     RUN_TEST(test_particle_record_negative_index_returns_error);
     RUN_TEST(test_particle_record_out_of_bounds_index_returns_error);
+    RUN_TEST(test_particle_recorded_tracks_hits);
+    RUN_TEST(test_particle_record_planes_adds_flight_times);
+    RUN_TEST(test_particle_record_planes_skips_backward_rays);
+    RUN_TEST(test_particle_cull_needs_cull_table);
+    RUN_TEST(test_particle_cull_predicts_downstream_arrival);
+    RUN_TEST(test_particle_cull_keeps_rays_with_binned_hits);
+    RUN_TEST(test_particle_cull_waits_for_auto_range);
+    RUN_TEST(test_particle_cull_is_off_with_several_groups);
     RUN_TEST(test_particle_to_table_bins_time_correctly);
     RUN_TEST(test_particle_to_table_skips_out_of_range_time);
+    RUN_TEST(test_particle_to_table_skips_time_just_below_t_min);
+    RUN_TEST(test_particle_to_table_empty_window_bins_nothing);
+    RUN_TEST(test_particle_to_table_uses_recorder_windows);
+    RUN_TEST(test_particle_to_table_log_bins);
+    RUN_TEST(test_particle_to_table_edge_bins_match_linear_search);
+    RUN_TEST(test_particle_to_table_sparse_index_past_int_range);
+    RUN_TEST(test_particle_to_table_counts_clipped_hits);
+    RUN_TEST(test_particle_to_table_private_folds_clip_counts);
+    RUN_TEST(test_particle_auto_range_buffers_then_replays);
+    RUN_TEST(test_particle_auto_range_ends_at_reduce);
+    RUN_TEST(test_particle_auto_range_stops_at_its_memory_budget);
+    RUN_TEST(test_particle_auto_range_rejects_custom_edges);
+    RUN_TEST(test_particles_record_records_every_particle);
+    RUN_TEST(test_particles_to_table_matches_single_particles);
+    RUN_TEST(test_particles_to_table_uses_thread_slab);
+    RUN_TEST(test_particle_to_table_private_bins_into_thread_slab);
+    RUN_TEST(test_particle_to_table_modes_agree_in_parallel);
+    RUN_TEST(test_particle_to_table_interleaved_matches_soa);
+    RUN_TEST(test_particle_to_table_sparse_matches_soa);
+    RUN_TEST(test_particle_to_table_skips_unrecorded_recorders);
+    RUN_TEST(test_particle_hit_mask_spans_multiple_words);
+    RUN_TEST(test_particle_pool_reuses_freed_block);
+    RUN_TEST(test_particle_pool_steady_state_has_no_misses);
+    RUN_TEST(test_particle_pool_reinitialises_reused_block);
+    RUN_TEST(test_particle_unrecorded_particle_takes_no_block);
+    RUN_TEST(test_particle_to_table_without_records_is_a_no_op);
+    RUN_TEST(test_particle_reclaim_recovers_absorbed_block);
+    RUN_TEST(test_particle_state_free_releases_live_blocks);
     RUN_TEST(test_particle_free_nullifies_pointers);
     return UNITY_END();
 }
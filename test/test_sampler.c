@@ -0,0 +1,131 @@
+/* test_sampler.c – Unity tests for weighted ray sampling: reservoir filling,
+ * the weighting, merging across threads and the sample output file. */
+#include "unity.h"
+#include "tof-table-lib.h"
+#include "particle_stub.h"
+#include <stdint.h>
+#include <string.h>
+
+#define TEST_MANAGER_IDX  9
+
+void setUp(void) {
+    table_manager_state_alloc();
+    table_manager_state_add_recorder("rec0", 1.0);
+    table_manager_state_add_recorder("rec1", 2.0);
+    table_manager_state_finalize(TEST_MANAGER_IDX, "table_manager_t", "table_manager_p",
+                                 "table_manager_n", "table_manager_z");
+}
+
+void tearDown(void) {
+    table_manager_state_free();
+}
+
+/* Helper: a hit mask with every one of the first 64 recorders set. */
+static double all_hits(void) {
+    double hits;
+    uint64_t bits = ~(uint64_t) 0;
+    memcpy(&hits, &bits, sizeof(hits));
+    return hits;
+}
+
+void test_sampler_alloc_rejects_empty_sample(void) {
+    TEST_ASSERT_NULL(table_manager_sampler_alloc(2, 0, 1));
+    TEST_ASSERT_NULL(table_manager_sampler_alloc(0, 10, 1));
+    table_manager_sampler_free(NULL);
+}
+
+void test_sampler_keeps_every_ray_below_sample_size(void) {
+    struct TableManagerSampler * s = table_manager_sampler_alloc(2, 8, 1);
+    _class_particle p = {0};
+    table_manager_particle_alloc(&p, 0.0);
+    p.t = 0.5;
+    p.p = 0.25;
+    table_manager_particle_record(&p, 1);
+    p.p = 0.5;
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_to_sampler(&p, s));
+    table_manager_particle_free(&p);
+    double hits = all_hits(), t[2] = {1.0, 2.0}, w[2] = {0.1, 0.2};
+    TEST_ASSERT_EQUAL_INT(0, table_manager_sampler_add(s, t, w, &hits, 2.0));
+    TEST_ASSERT_EQUAL_INT(0, table_manager_sampler_add(s, t, w, &hits, 0.0));
+
+    double ts[16], ps[16], weight[8];
+    TEST_ASSERT_EQUAL_INT(2, table_manager_sampler_collect(s, ts, ps, weight));
+    int first = weight[0] == 0.5 ? 0 : 1;
+    TEST_ASSERT_TRUE(isnan(ts[2 * first]));
+    TEST_ASSERT_EQUAL_DOUBLE(0.0, ps[2 * first]);
+    TEST_ASSERT_EQUAL_DOUBLE(0.5, ts[2 * first + 1]);
+    TEST_ASSERT_EQUAL_DOUBLE(0.25, ps[2 * first + 1]);
+    TEST_ASSERT_EQUAL_DOUBLE(2.0, weight[1 - first]);
+    TEST_ASSERT_EQUAL_DOUBLE(2.0, ts[2 * (1 - first) + 1]);
+    table_manager_sampler_free(s);
+}
+
+void test_sampler_prefers_heavy_rays(void) {
+    enum { SIZE = 1000, RAYS = 200000 };
+    struct TableManagerSampler * s = table_manager_sampler_alloc(1, SIZE, 12345);
+    double hits = all_hits();
+    /* Equally many rays of weight 1 (t = 0) and 9 (t = 1): about 90% of a
+     * small sample must be heavy. */
+    for (int i = 0; i < RAYS; ++i) {
+        double t = i % 2, p = 1.0;
+        table_manager_sampler_add(s, &t, &p, &hits, i % 2 ? 9.0 : 1.0);
+    }
+    static double ts[SIZE], ps[SIZE], weight[SIZE];
+    TEST_ASSERT_EQUAL_INT(SIZE, table_manager_sampler_collect(s, ts, ps, weight));
+    int heavy = 0;
+    for (int i = 0; i < SIZE; ++i) {
+        heavy += ts[i] == 1.0;
+        TEST_ASSERT_EQUAL_DOUBLE(ts[i] == 1.0 ? 9.0 : 1.0, weight[i]);
+    }
+    TEST_ASSERT_TRUE(heavy > 870 && heavy < 930);
+    table_manager_sampler_free(s);
+}
+
+void test_sampler_merges_thread_reservoirs(void) {
+    enum { SIZE = 64, RAYS = 10000 };
+    struct TableManagerSampler * s = table_manager_sampler_alloc(1, SIZE, 7);
+    double hits = all_hits();
+    #pragma omp parallel for
+    for (int i = 0; i < RAYS; ++i) {
+        double t = i, p = 1.0;
+        table_manager_sampler_add(s, &t, &p, &hits, 1.0);
+    }
+    double ts[SIZE], ps[SIZE], weight[SIZE];
+    TEST_ASSERT_EQUAL_INT(SIZE, table_manager_sampler_collect(s, ts, ps, weight));
+    for (int i = 0; i < SIZE; ++i)
+        for (int j = 0; j < i; ++j)
+            TEST_ASSERT_TRUE(ts[i] != ts[j]);
+    table_manager_sampler_free(s);
+}
+
+void test_write_samples_lists_sampled_rays(void) {
+    struct TableManagerSampler * s = table_manager_sampler_alloc(2, 4, 1);
+    double hits = 0.0, t[2] = {0.0, 3.5}, p[2] = {0.0, 0.5};
+    uint64_t second = 2;
+    memcpy(&hits, &second, sizeof(hits));
+    table_manager_sampler_add(s, t, p, &hits, 1.0);
+
+    const char * fname = "test_samples_tmp.json";
+    TEST_ASSERT_EQUAL_INT(0, table_manager_write_samples(fname, s, TABLE_MANAGER_FORMAT_JSON));
+    FILE * f = fopen(fname, "r");
+    TEST_ASSERT_NOT_NULL(f);
+    char buf[4096];
+    buf[fread(buf, 1, sizeof(buf) - 1, f)] = '\0';
+    fclose(f);
+    remove(fname);
+    TEST_ASSERT_NOT_NULL(strstr(buf, "\"weight\": {\"unit\": \"dimensionless\", \"dtype\": \"float64\", \"dims\": [\"sample\"], \"values\": [1]"));
+    TEST_ASSERT_NOT_NULL(strstr(buf, "\"dims\": [\"sample\", \"recorder\"]"));
+    TEST_ASSERT_NOT_NULL(strstr(buf, "[NaN, 3.5]"));
+    TEST_ASSERT_NOT_NULL(strstr(buf, "[0, 0.5]"));
+    table_manager_sampler_free(s);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_sampler_alloc_rejects_empty_sample);
+    RUN_TEST(test_sampler_keeps_every_ray_below_sample_size);
+    RUN_TEST(test_sampler_prefers_heavy_rays);
+    RUN_TEST(test_sampler_merges_thread_reservoirs);
+    RUN_TEST(test_write_samples_lists_sampled_rays);
+    return UNITY_END();
+}
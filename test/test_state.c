@@ -72,12 +72,39 @@ void test_state_n_recorders_zero_without_state(void) {
     TEST_ASSERT_EQUAL_INT(0, table_manager_state_n_recorders());
 }
 
+/* ---- recorder windows ---- */
+
+void test_set_recorder_window_validates_arguments(void) {
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_state_set_recorder_window(0, 0.0, 1.0));
+    table_manager_state_alloc();
+    table_manager_state_add_recorder("rec0", 1.0);
+    TEST_ASSERT_EQUAL_INT(0,  table_manager_state_set_recorder_window(0, 0.0, 1.0));
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_state_set_recorder_window(1, 0.0, 1.0));
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_state_set_recorder_window(-1, 0.0, 1.0));
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_state_set_recorder_window(0, 1.0, 1.0));
+}
+
+void test_apply_windows_overrides_only_windowed_recorders(void) {
+    table_manager_state_alloc();
+    table_manager_state_add_recorder("rec0", 1.0);
+    table_manager_state_add_recorder("rec1", 2.0);
+    table_manager_state_set_recorder_window(1, 0.5, 0.7);
+    struct TableManagerData * data = table_manager_data_alloc(2, 4, 0.0, 1.0);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_state_apply_windows(data));
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 0.0, data->r_min[0]);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 1.0, data->r_max[0]);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 0.5, data->r_min[1]);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 0.7, data->r_max[1]);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-9, 20.0, data->r_scale[1]);
+    table_manager_data_free(data);
+}
+
 /* ---- state_finalize – indirect test via particle accessor ---- */
 
 void test_state_finalize_enables_particle_accessor(void) {
     table_manager_state_alloc();
     table_manager_state_add_recorder("rec0", 1.0);
-    table_manager_state_finalize(9, "table_manager_t", "table_manager_p", "table_manager_n");
+    table_manager_state_finalize(9, "table_manager_t", "table_manager_p", "table_manager_n", "table_manager_z");
 
     _class_particle p = {0};
     /* Accessors must return non-NULL once the state has been finalised. */
@@ -86,6 +113,59 @@ void test_state_finalize_enables_particle_accessor(void) {
     TEST_ASSERT_NOT_NULL(table_manager_particle_n_ptr(&p));
 }
 
+/* ---- table groups ---- */
+
+void test_group_lookup_returns_same_handle(void) {
+    struct TableManagerGroup * a = table_manager_group("bank_a");
+    TEST_ASSERT_NOT_NULL(a);
+    TEST_ASSERT_TRUE(a == table_manager_group("bank_a"));
+    TEST_ASSERT_TRUE(a != table_manager_group("bank_b"));
+    TEST_ASSERT_TRUE(table_manager_group(NULL) == table_manager_group(""));
+}
+
+void test_groups_have_independent_states(void) {
+    struct TableManagerGroup * a = table_manager_group("bank_a");
+    struct TableManagerGroup * b = table_manager_group("bank_b");
+    table_manager_group_select(a);
+    table_manager_state_alloc();
+    table_manager_state_add_recorder("a0", 1.0);
+    table_manager_state_add_recorder("a1", 2.0);
+    table_manager_state_finalize(9, "table_manager_t", "table_manager_p",
+                                 "table_manager_n", "table_manager_z");
+    table_manager_group_select(b);
+    TEST_ASSERT_EQUAL_INT(0, table_manager_state_exists());
+    table_manager_state_alloc();
+    TEST_ASSERT_EQUAL_INT(0, table_manager_state_add_recorder("b0", 5.0));
+    table_manager_state_finalize(12, "table_manager_t", "table_manager_p",
+                                 "table_manager_n", "table_manager_z");
+
+    /* One ray passing both groups keeps separate arrays for each. */
+    _class_particle p = {0};
+    table_manager_group_select(a);
+    table_manager_particle_alloc(&p, 0.0);
+    p.t = 1.0;
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_record(&p, 1));
+    table_manager_group_select(b);
+    table_manager_particle_alloc(&p, 0.0);
+    p.t = 2.0;
+    TEST_ASSERT_EQUAL_INT(0, table_manager_particle_record(&p, 0));
+    TEST_ASSERT_EQUAL_INT(-1, table_manager_particle_record(&p, 1));
+    TEST_ASSERT_EQUAL_INT(2, p.table_manager_n_9);
+    TEST_ASSERT_EQUAL_INT(1, p.table_manager_n_12);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 1.0, p.table_manager_t_9[1]);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 2.0, p.table_manager_t_12[0]);
+    TEST_ASSERT_EQUAL_INT(1, table_manager_state_n_recorders());
+    table_manager_particle_free(&p);
+    table_manager_state_free();
+    table_manager_group_select(a);
+    TEST_ASSERT_EQUAL_INT(2, table_manager_state_n_recorders());
+    table_manager_particle_free(&p);
+    table_manager_state_free();
+    table_manager_group_select(NULL);
+    /* The default group was never allocated. */
+    TEST_ASSERT_EQUAL_INT(0, table_manager_state_exists());
+}
+
 /* ---- main ---- */
 
 int main(void) {
@@ -101,6 +181,10 @@ int main(void) {
     RUN_TEST(test_state_n_recorders_zero_without_recorders);
     RUN_TEST(test_state_n_recorders_counts_recorders);
     RUN_TEST(test_state_n_recorders_zero_without_state);
+    RUN_TEST(test_set_recorder_window_validates_arguments);
+    RUN_TEST(test_apply_windows_overrides_only_windowed_recorders);
     RUN_TEST(test_state_finalize_enables_particle_accessor);
+    RUN_TEST(test_group_lookup_returns_same_handle);
+    RUN_TEST(test_groups_have_independent_states);
     return UNITY_END();
 }
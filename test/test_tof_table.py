@@ -14,12 +14,21 @@ Instrument layout:
 
 Each TableRecorder is placed L metres downstream of the source, so the
 expected arrival time (after PROP_Z0 in the recorder) is t = L / velocity.
+
+The readers in ``tof_table.py`` are tested without a compiler, on small
+output files written here in each of the formats the C library produces.
 """
 from __future__ import annotations
 
+import struct
+import sys
+from pathlib import Path
 from textwrap import dedent
 
-from pytest import mark
+from pytest import importorskip, mark, raises
+
+sys.path.insert(0, str(Path(__file__).resolve().parent.parent))
+import tof_table  # noqa: E402
 
 # ---------------------------------------------------------------------------
 # Inline component: a minimal, fully deterministic neutron source.
@@ -226,3 +235,289 @@ def test_tof_table_stdout_reports_expected_times():
             f"Expected '{expected_str}' in output.\nFull output:\n{text}"
         )
 
+
+
+# ---------------------------------------------------------------------------
+# Output files of the C library, for the tof_table.py readers: two recorders
+# ("near" at 2 m, "far" at 160 m) with three bins each and hits in bin 1 of
+# "near" and bin 2 of "far".
+# ---------------------------------------------------------------------------
+_DENSE = dedent("""\
+    {
+      "type": "scipp.Dataset",
+      "coords": {
+        "time": {"unit": "s", "dtype": "float64", "dims": ["time"], "values": [0, 0.5, 1, 1.5]},
+        "distance": {"unit": "m", "dtype": "float64", "dims": ["recorder"], "values": [2, 160]},
+        "recorder": {"unit": null, "dtype": "string", "dims": ["recorder"], "values": ["near", "far"]}
+      },
+      "data": {
+        "tp": {"unit": "s", "dtype": "float64", "dims": ["recorder", "time"], "values": [
+          [0, 0.25, 0],
+          [0, 0, 0.75]
+        ]},
+        "p1": {"unit": "dimensionless", "dtype": "float64", "dims": ["recorder", "time"], "values": [
+          [0, 0.5, 0],
+          [0, 0, 1]
+        ]},
+        "p2": {"unit": "dimensionless", "dtype": "float64", "dims": ["recorder", "time"], "values": [
+          [0, 0.25, 0],
+          [0, 0, 1]
+        ]},
+        "n": {"unit": "dimensionless", "dtype": "int32", "dims": ["recorder", "time"], "values": [
+          [0, 2, 0],
+          [0, 0, 1]
+        ]}
+      }
+    }
+""")
+
+# The same table written with layout="sparse".
+_SPARSE = dedent("""\
+    {
+      "type": "scipp.Dataset",
+      "coords": {
+        "time": {"unit": "s", "dtype": "float64", "dims": ["time"], "values": [0, 0.5, 1, 1.5]},
+        "distance": {"unit": "m", "dtype": "float64", "dims": ["recorder"], "values": [2, 160]},
+        "recorder": {"unit": null, "dtype": "string", "dims": ["recorder"], "values": ["near", "far"]}
+      },
+      "sparse": {
+        "format": "coo",
+        "shape": [2, 3],
+        "recorder_index": {"unit": null, "dtype": "int32", "dims": ["entry"], "values": [0, 1]},
+        "time_index": {"unit": null, "dtype": "int32", "dims": ["entry"], "values": [1, 2]}
+      },
+      "data": {
+        "tp": {"unit": "s", "dtype": "float64", "dims": ["entry"], "values": [0.25, 0.75]},
+        "p1": {"unit": "dimensionless", "dtype": "float64", "dims": ["entry"], "values": [0.5, 1]},
+        "p2": {"unit": "dimensionless", "dtype": "float64", "dims": ["entry"], "values": [0.25, 1]},
+        "n": {"unit": "dimensionless", "dtype": "int32", "dims": ["entry"], "values": [2, 1]}
+      }
+    }
+""")
+
+# The same table with "far" recording its own window (TableRecorder t_min/t_max).
+_WINDOWED = _DENSE.replace(
+    '"dims": ["time"], "values": [0, 0.5, 1, 1.5]},',
+    '"dims": ["recorder", "time"], "values": [\n'
+    '      [0, 0.5, 1, 1.5],\n'
+    '      [40, 43, 46, 49]\n'
+    '    ]},')
+
+# A weighted sample of two rays (TableManager samples=N).
+_SAMPLES = dedent("""\
+    {
+      "type": "scipp.Dataset",
+      "coords": {
+        "distance": {"unit": "m", "dtype": "float64", "dims": ["recorder"], "values": [2, 160]},
+        "recorder": {"unit": null, "dtype": "string", "dims": ["recorder"], "values": ["near", "far"]},
+        "weight": {"unit": "dimensionless", "dtype": "float64", "dims": ["sample"], "values": [1, 0.5]}
+      },
+      "data": {
+        "t": {"unit": "s", "dtype": "float64", "dims": ["sample", "recorder"], "values": [
+          [0.5, NaN],
+          [0.25, 42]
+        ]},
+        "p": {"unit": "dimensionless", "dtype": "float64", "dims": ["sample", "recorder"], "values": [
+          [0.5, 0],
+          [1, 0.75]
+        ]}
+      }
+    }
+""")
+
+_EXPECTED = {
+    "tp": [[0, 0.25, 0], [0, 0, 0.75]],
+    "p1": [[0, 0.5, 0], [0, 0, 1]],
+    "p2": [[0, 0.25, 0], [0, 0, 1]],
+    "n": [[0, 2, 0], [0, 0, 1]],
+}
+
+
+def _write(directory: Path, name: str, text: str) -> Path:
+    path = directory / name
+    path.write_text(text)
+    return path
+
+
+def _write_npy(directory: Path, name: str) -> Path:
+    """Write the table of _DENSE as TableManager(format="npy") does."""
+    import json
+    import numpy as np
+
+    obj = json.loads(_DENSE)
+    for key, item in obj["data"].items():
+        values = np.array(item.pop("values"), dtype=item["dtype"])
+        item["file"] = f"{name}.{key}.npy"
+        np.save(directory / item["file"], values)
+    return _write(directory, name, json.dumps(obj, indent=2))
+
+
+def _assert_table(arrays: dict, scale: int = 1):
+    import numpy as np
+
+    assert sorted(arrays) == sorted(_EXPECTED)
+    for key, expected in _EXPECTED.items():
+        np.testing.assert_array_equal(arrays[key], scale * np.array(expected))
+    assert arrays["n"].dtype == np.int32
+
+
+def test_load_arrays_reads_inline_json(tmp_path):
+    _assert_table(tof_table.load_arrays(_write(tmp_path, "dense.json", _DENSE)))
+
+
+def test_load_arrays_memory_maps_npy_items(tmp_path):
+    import numpy as np
+
+    arrays = tof_table.load_arrays(_write_npy(tmp_path, "table.json"))
+    _assert_table(arrays)
+    assert all(isinstance(v, np.memmap) for v in arrays.values())
+
+
+def test_load_arrays_expands_sparse_files(tmp_path):
+    _assert_table(tof_table.load_arrays(_write(tmp_path, "sparse.json", _SPARSE)))
+
+
+def test_load_arrays_rejects_unknown_sparse_format(tmp_path):
+    path = _write(tmp_path, "csr.json", _SPARSE.replace('"coo"', '"csr"'))
+    with raises(ValueError, match="csr"):
+        tof_table.load_arrays(path)
+
+
+def test_load_arrays_rejects_other_files(tmp_path):
+    path = _write(tmp_path, "other.json", '{"type": "scipp.DataArray"}')
+    with raises(ValueError, match="scipp.Dataset"):
+        tof_table.load_arrays(path)
+
+
+def test_load_arrays_reads_samples(tmp_path):
+    import numpy as np
+
+    arrays = tof_table.load_arrays(_write(tmp_path, "table.json.samples", _SAMPLES))
+    assert sorted(arrays) == ["p", "t"]
+    np.testing.assert_array_equal(arrays["t"], [[0.5, np.nan], [0.25, 42]])
+    np.testing.assert_array_equal(arrays["p"], [[0.5, 0], [1, 0.75]])
+
+
+def test_load_gives_one_row_of_edges_per_recorder(tmp_path):
+    importorskip("scipp")
+    importorskip("niess")
+    import numpy as np
+
+    dataset = tof_table.load(_write(tmp_path, "windowed.json", _WINDOWED))
+    time = dataset.coords["time"]
+    assert time.dims == ("recorder", "time")
+    np.testing.assert_array_equal(time.values, [[0, 0.5, 1, 1.5], [40, 43, 46, 49]])
+    np.testing.assert_array_equal(dataset["n"].values, _EXPECTED["n"])
+
+
+def test_load_expands_sparse_files(tmp_path):
+    importorskip("scipp")
+    importorskip("niess")
+    import numpy as np
+
+    dataset = tof_table.load(_write(tmp_path, "sparse.json", _SPARSE))
+    assert dataset["p1"].dims == ("recorder", "time")
+    np.testing.assert_array_equal(dataset["p1"].values, _EXPECTED["p1"])
+
+
+def _write_events(path: Path, t, p, order: str = "<") -> Path:
+    """Write rays as TableManager(events_file=...) does."""
+    import numpy as np
+
+    t, p = np.asarray(t, dtype=float), np.asarray(p, dtype=float)
+    recorders = t.shape[1]
+    header = b"TOFEVENT" + struct.pack(order + "4I", 1, recorders, 16 * recorders,
+                                       0x01020304)
+    records = np.concatenate([t, p], axis=1).astype(order + "f8")
+    path.write_bytes(header.ljust(64, b"\0") + records.tobytes())
+    return path
+
+
+def test_iter_events_reads_rays_in_chunks(tmp_path):
+    import numpy as np
+
+    t = [[0.5, 40.5], [0.25, np.nan], [1.0, 42.0]]
+    p = [[1.0, 0.5], [0.5, 0.0], [0.25, 0.25]]
+    for order, name in (("<", "little.bin"), (">", "big.bin")):
+        path = _write_events(tmp_path / name, t, p, order)
+        chunks = list(tof_table.iter_events(path, chunk_size=2))
+        assert [len(ct) for ct, _ in chunks] == [2, 1]
+        np.testing.assert_array_equal(np.concatenate([ct for ct, _ in chunks]), t)
+        np.testing.assert_array_equal(np.concatenate([cp for _, cp in chunks]), p)
+
+
+def test_iter_events_rejects_other_files(tmp_path):
+    path = tmp_path / "table.json"
+    path.write_bytes(b"{" + b" " * 63)
+    with raises(ValueError, match="Not a TableManager event file"):
+        next(tof_table.iter_events(path))
+
+
+def test_merge_sums_dense_tables(tmp_path):
+    a = _write(tmp_path, "a.json", _DENSE)
+    b = _write_npy(tmp_path, "b.json")
+    out = tmp_path / "out.json"
+    assert tof_table.merge([a, b], out) == 2
+    _assert_table(tof_table.load_arrays(out), scale=2)
+    assert "file" not in out.read_text()
+
+
+def test_merge_of_sparse_and_dense_is_dense(tmp_path):
+    a = _write(tmp_path, "a.json", _SPARSE)
+    b = _write(tmp_path, "b.json", _DENSE)
+    out = tmp_path / "out.json"
+    tof_table.merge([a, b], out)
+    assert '"sparse"' not in out.read_text()
+    _assert_table(tof_table.load_arrays(out), scale=2)
+
+
+def test_merge_of_sparse_tables_is_sparse(tmp_path):
+    import json
+
+    a = _write(tmp_path, "a.json", _SPARSE)
+    out = tmp_path / "out.json"
+    tof_table.merge([a, a, a], out, fmt="npy")
+    obj = json.loads(out.read_text())
+    assert obj["sparse"]["shape"] == [2, 3]
+    assert obj["data"]["n"]["file"] == "out.json.n.npy"
+    _assert_table(tof_table.load_arrays(out), scale=3)
+
+
+def test_merge_writes_matrices_one_row_per_line(tmp_path):
+    a = _write(tmp_path, "a.json", _DENSE)
+    out = tmp_path / "out.json"
+    tof_table.merge([a], out)
+    assert '"n": {"unit": "dimensionless", "dtype": "int32", "dims": ["recorder", "time"], "values": [\n' \
+           '      [0, 2, 0],\n' \
+           '      [0, 0, 1]\n' \
+           '    ]}\n' in out.read_text()
+
+
+def test_merge_rejects_different_bins(tmp_path):
+    a = _write(tmp_path, "a.json", _DENSE)
+    b = _write(tmp_path, "b.json", _WINDOWED)
+    with raises(ValueError, match="differ"):
+        tof_table.merge([a, b], tmp_path / "out.json")
+
+
+def test_merge_rejects_hit_counts_beyond_int32(tmp_path):
+    a = _write(tmp_path, "a.json", _DENSE.replace("[0, 0, 1]\n", "[0, 0, 2147483647]\n"))
+    with raises(ValueError, match="int32"):
+        tof_table.merge([a, a], tmp_path / "out.json")
+
+
+def test_main_merges_from_the_command_line(tmp_path, capsys):
+    a = _write(tmp_path, "a.json", _DENSE)
+    b = _write(tmp_path, "b.json", _SPARSE)
+    out = tmp_path / "out.json"
+    assert tof_table.main(["merge", "-o", str(out), "--format", "npy", str(a), str(b)]) == 0
+    assert f"Merged 2 tables into {out}" in capsys.readouterr().out
+    _assert_table(tof_table.load_arrays(out), scale=2)
+    assert (tmp_path / "out.json.n.npy").exists()
+
+
+def test_main_reports_errors(tmp_path, capsys):
+    a = _write(tmp_path, "a.json", _DENSE)
+    b = _write(tmp_path, "b.json", _WINDOWED)
+    assert tof_table.main(["merge", "-o", str(tmp_path / "out.json"), str(a), str(b)]) == 1
+    assert "time bins or recorders differ" in capsys.readouterr().err
@@ -6,6 +6,12 @@
 #include "tof-table-lib.h"
 #endif
 
+#include <stdint.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 /* ---------------------------------------------------------------------------
  * Internal types
  * ------------------------------------------------------------------------- */
@@ -13,6 +19,9 @@
 struct TableManagerLinkedListNode {
     char * name;
     double distance;
+    int has_window;   /* t_min/t_max set by table_manager_state_set_recorder_window */
+    double t_min;
+    double t_max;
     struct TableManagerLinkedListNode * next;
 };
 
@@ -21,6 +30,28 @@ struct TableManagerLinkedList {
     struct TableManagerLinkedListNode * tail;
 };
 
+/* Header in front of every heap block of per-particle storage.  The data
+ * that follows holds the t array, the p array and the hit mask
+ * (TABLE_MANAGER_INLINE_SIZE(n_recorders) doubles).  A block is either on a
+ * pool's free list (singly linked through next) or on the live list of the
+ * thread that handed it out (doubly linked, so it can leave in O(1)). */
+struct TableManagerBlock {
+    struct TableManagerBlock * next;
+    struct TableManagerBlock * prev;
+};
+
+/* Per-thread pool of per-particle blocks.  Padded to a cache line, and the
+ * array of pools is 64-byte aligned, so neighbouring threads do not share
+ * counters. */
+struct TableManagerPool {
+    struct TableManagerBlock * free_list;
+    struct TableManagerBlock   live;       /* sentinel of the live list      */
+    long long hits;              /* blocks served from the free list         */
+    long long misses;            /* blocks that had to come from malloc      */
+    long long reclaimed;         /* blocks recovered from absorbed particles */
+    char      pad[64 - sizeof(void *) - sizeof(struct TableManagerBlock) - 3 * sizeof(long long)];
+};
+
 /* Offsets into _struct_particle for the per-particle arrays.
  * Computed once at state_finalize time; the hot-path accessors use these
  * directly instead of calling particle_getvar_void on every particle. */
@@ -31,9 +62,69 @@ struct TableManagerState {
     ptrdiff_t t_offset;          /* byte offset of table_manager_t_N field   */
     ptrdiff_t p_offset;          /* byte offset of table_manager_p_N field   */
     ptrdiff_t n_offset;          /* byte offset of table_manager_n_N field   */
+    ptrdiff_t z_offset;          /* byte offset of table_manager_z_N field   */
+    int block_recorders;         /* recorders per pooled block (0: no pools) */
+    int n_pools;
+    struct TableManagerPool * pools;  /* indexed by thread number            */
+    void * pools_mem;            /* allocation holding the aligned pools     */
+    int max_threads;             /* pools to create; 0 for OpenMP's count    */
+    int inline_set;              /* 1 when table_manager_ray is in use       */
+    ptrdiff_t inline_offset;     /* byte offset of table_manager_ray         */
+    const struct TableManagerData * cull_table;  /* windows for culling, or NULL */
+    double * cull_distance;      /* recorder distances, while cull_table set */
+};
+
+/* A named group of TableSetup, TableRecorder and TableManager components,
+ * with its own state.  Groups live as long as the process, so components may
+ * keep their handles; only the states are allocated and freed. */
+struct TableManagerGroup {
+    char * name;
+    struct TableManagerState * state;
+    struct TableManagerGroup * next;
 };
 
-static struct TableManagerState * _tof_table_manager_state = NULL;
+/* Per-thread variables: one copy per OS thread, whether it is an OpenMP
+ * thread or one the embedding program started itself.  MSVC defines
+ * __STDC_VERSION__ only under /std:c11, so it is checked first. */
+#if defined(_MSC_VER)
+#define TABLE_MANAGER_THREAD_LOCAL __declspec(thread)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define TABLE_MANAGER_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__) || defined(__clang__)
+#define TABLE_MANAGER_THREAD_LOCAL __thread
+#else
+#error "TableManager needs thread-local storage: build as C11, or with GCC, clang or MSVC."
+#endif
+
+static struct TableManagerGroup * _tof_table_manager_groups = NULL;
+static struct TableManagerGroup * _tof_table_manager_default = NULL;
+/* The group the calling thread works on; NULL selects the default group.
+ * It is TABLE_MANAGER_THREAD_LOCAL rather than OpenMP threadprivate, so that
+ * a thread started outside OpenMP keeps its own selection too. */
+static TABLE_MANAGER_THREAD_LOCAL struct TableManagerGroup * _tof_table_manager_group = NULL;
+/* The thread number set by table_manager_thread_bind, or -1. */
+static TABLE_MANAGER_THREAD_LOCAL int _tof_table_manager_thread = -1;
+/* The state using the particles' inline array, of which there is only one. */
+static struct TableManagerState * _tof_table_manager_inline_owner = NULL;
+/* Set once culling has been refused for want of a single table group. */
+static int _tof_table_manager_cull_refused = 0;
+
+/* Rays buffered before the time windows are known, as the recorder, t and p
+ * of each hit only: ray i holds entries [start[i], start[i + 1]).  The
+ * arrays grow with the rays, up to TABLE_MANAGER_WARMUP_BYTES. */
+struct TableManagerWarmup {
+    long     capacity;           /* rays to buffer before ranging            */
+    long     count;              /* rays buffered so far                     */
+    double   padding;            /* fraction of the range added on each side */
+    size_t   ray_room;           /* rays start has room for                  */
+    size_t   entries;            /* hits buffered so far                     */
+    size_t   entry_room;         /* hits recorder, t and p have room for     */
+    size_t * start;              /* ray_room + 1 offsets into the entries    */
+    int    * recorder;
+    double * t;
+    double * p;
+    unsigned char * fixed;       /* recorders given a window explicitly      */
+};
 
 /* ---------------------------------------------------------------------------
  * Internal helpers
@@ -52,6 +143,16 @@ static struct TableManagerState * _table_manager_state_alloc(void) {
     state->t_offset = 0;
     state->p_offset = 0;
     state->n_offset = 0;
+    state->z_offset = 0;
+    state->block_recorders = 0;
+    state->n_pools = 0;
+    state->pools = NULL;
+    state->pools_mem = NULL;
+    state->max_threads = 0;
+    state->inline_set = 0;
+    state->inline_offset = 0;
+    state->cull_table = NULL;
+    state->cull_distance = NULL;
     return state;
 }
 
@@ -64,10 +165,376 @@ static void _table_manager_state_free(struct TableManagerState * state) {
             free(node);
             node = next;
         }
+        for (int i = 0; i < state->n_pools; ++i) {
+            struct TableManagerPool * pool = &state->pools[i];
+            struct TableManagerBlock * block = pool->free_list;
+            while (block) {
+                struct TableManagerBlock * next = block->next;
+                free(block);
+                block = next;
+            }
+            /* Blocks still live belong to particles that never reached the
+             * manager before the simulation ended. */
+            block = pool->live.next;
+            while (block && block != &pool->live) {
+                struct TableManagerBlock * next = block->next;
+                free(block);
+                block = next;
+            }
+        }
+        free(state->pools_mem);
+        free(state->cull_distance);
+        #pragma omp critical (table_manager_inline)
+        if (_tof_table_manager_inline_owner == state)
+            _tof_table_manager_inline_owner = NULL;
         free(state);
     }
 }
 
+/* Thread number of the caller: the one given to table_manager_thread_bind,
+ * else its OpenMP thread number, or 0 in a serial build. */
+static int _table_manager_thread_num(void) {
+    if (_tof_table_manager_thread >= 0)
+        return _tof_table_manager_thread;
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+/* Upper bound on the number of threads that may call into the library. */
+static int _table_manager_max_threads(void) {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+/* Hit-mask words share double-typed storage with the t and p arrays (the
+ * inline array is declared double), so they are accessed through memcpy,
+ * which compilers lower to a plain load or store. */
+static uint64_t _table_manager_hits_load(const double * hits, int word) {
+    uint64_t bits;
+    memcpy(&bits, hits + word, sizeof(bits));
+    return bits;
+}
+
+static void _table_manager_hits_store(double * hits, int word, uint64_t bits) {
+    memcpy(hits + word, &bits, sizeof(bits));
+}
+
+/* Index of the lowest set bit of a non-zero word. */
+static int _table_manager_ctz64(uint64_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(bits);
+#else
+    int i = 0;
+    while (!(bits & 1u)) {
+        bits >>= 1;
+        ++i;
+    }
+    return i;
+#endif
+}
+
+/* Runtime CPU dispatch for the binning kernel: with GCC or clang on x86-64
+ * Linux (ifunc support) the kernel is compiled for AVX-512, AVX2 and the
+ * baseline ISA, and the loader picks the best one for the host.  Define
+ * TOF_TABLE_NO_DISPATCH to build only the portable version. */
+#if !defined(TOF_TABLE_NO_DISPATCH) && defined(__GNUC__) && defined(__x86_64__) && defined(__linux__)
+#define TABLE_MANAGER_TARGET_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define TABLE_MANAGER_TARGET_CLONES
+#endif
+
+/* Index j with edges[j] <= t < edges[j + 1], or -1 outside
+ * [edges[0], edges[n_edges - 1]).  Branch-free binary search: the number of
+ * steps depends on n_edges only, and each step is a conditional move. */
+static inline int _table_manager_edges_index(const double * edges, int n_edges, double t) {
+    const double * lo = edges;
+    int len = n_edges;
+    while (len > 1) {
+        int half = len / 2;
+        lo += lo[half] <= t ? half : 0;
+        len -= half;
+    }
+    int j = (int) (lo - edges) + (*lo <= t) - 1;
+    return t >= edges[0] && t < edges[n_edges - 1] ? j : -1;
+}
+
+/* Computes the flat table index of recorders [base, base + m) (m <= 64) and
+ * the three weighted sums they contribute; idx is -1 outside the recorder's
+ * time window.  Linear and logarithmic bins have a closed-form index;
+ * custom edges are searched.
+ * Branch-free and free of loop-carried dependencies so that it vectorises. */
+TABLE_MANAGER_TARGET_CLONES
+static void _table_manager_data_index(const struct TableManagerData * data,
+                                      const double * tof_t, const double * tof_p,
+                                      int base, int m, ptrdiff_t * idx,
+                                      double * tp, double * p1, double * p2) {
+    const double * r_min = data->r_min + base;
+    const double * r_scale = data->r_scale + base;
+    double bins = (double) data->bins;
+    if (data->binning == TABLE_MANAGER_BINNING_EDGES) {
+        const double * edges = data->edges;
+        int n_edges = data->bins + 1;
+        #pragma omp simd
+        for (int k = 0; k < m; ++k) {
+            double t = tof_t[base + k];
+            double p = tof_p[base + k];
+            int j = _table_manager_edges_index(edges, n_edges, t);
+            idx[k] = j >= 0 ? (ptrdiff_t) (base + k) * data->bins + j : -1;
+            tp[k] = t * p;
+            p1[k] = p;
+            p2[k] = p * p;
+        }
+        return;
+    }
+    int logarithmic = data->binning == TABLE_MANAGER_BINNING_LOG;
+    #pragma omp simd
+    for (int k = 0; k < m; ++k) {
+        double t = tof_t[base + k];
+        double p = tof_p[base + k];
+        /* log of t <= 0 is -inf or NaN, which the range test rejects */
+        double x = logarithmic ? log(t / r_min[k]) * r_scale[k] : (t - r_min[k]) * r_scale[k];
+        int in = r_scale[k] > 0.0 && x >= 0.0 && x < bins;
+        idx[k] = in ? (ptrdiff_t) (base + k) * data->bins + (ptrdiff_t) x : -1;
+        tp[k] = t * p;
+        p1[k] = p;
+        p2[k] = p * p;
+    }
+}
+
+/* Returns the record of bin idx of a sparse table, creating its block on
+ * first use; NULL (after an error message) if that allocation fails. */
+static struct TableManagerBin * _table_manager_data_sparse_cell(struct TableManagerData * data,
+                                                                size_t idx) {
+    struct TableManagerBin ** block = &data->blocks[idx / TABLE_MANAGER_SPARSE_BLOCK];
+    if (!*block) {
+        *block = (struct TableManagerBin *) calloc(TABLE_MANAGER_SPARSE_BLOCK, sizeof(struct TableManagerBin));
+        if (!*block) {
+            fprintf(stderr, "TableManager ERROR: Failed to allocate memory for a sparse table block; hit dropped.\n");
+            return NULL;
+        }
+    }
+    return &(*block)[idx % TABLE_MANAGER_SPARSE_BLOCK];
+}
+
+/* Counts a hit of recorder r at time t outside its window. */
+static inline void _table_manager_data_clip(struct TableManagerData * data, int r,
+                                            double t, int atomic) {
+    long long * clip = t < data->r_min[r] ? data->clip_low : data->clip_high;
+    if (atomic) {
+        #pragma omp atomic
+        clip[r] += 1;
+    } else {
+        clip[r] += 1;
+    }
+}
+
+/* Adds one hit to flat bin i, in whichever storage data uses. */
+static inline void _table_manager_data_add(struct TableManagerData * data, ptrdiff_t i,
+                                           double tp, double p1, double p2, int atomic) {
+    if (data->blocks) {
+        struct TableManagerBin * cell = _table_manager_data_sparse_cell(data, (size_t) i);
+        if (cell) {
+            cell->p1 += p1;
+            cell->p2 += p2;
+            cell->tp += tp;
+            cell->n  += 1;
+        }
+    } else if (data->cells) {
+        struct TableManagerBin * cell = &data->cells[i];
+        if (atomic) {
+            #pragma omp atomic
+            cell->p1 += p1;
+            #pragma omp atomic
+            cell->p2 += p2;
+            #pragma omp atomic
+            cell->tp += tp;
+            #pragma omp atomic
+            cell->n  += 1;
+        } else {
+            cell->p1 += p1;
+            cell->p2 += p2;
+            cell->tp += tp;
+            cell->n  += 1;
+        }
+    } else if (atomic) {
+        #pragma omp atomic
+        data->p1[i] += p1;
+        #pragma omp atomic
+        data->p2[i] += p2;
+        #pragma omp atomic
+        data->tp[i] += tp;
+        #pragma omp atomic
+        data->n[i]  += 1;
+    } else {
+        data->p1[i] += p1;
+        data->p2[i] += p2;
+        data->tp[i] += tp;
+        data->n[i]  += 1;
+    }
+}
+
+/* Adds one particle's recorded times and probabilities to the rows of data
+ * whose recorders it actually reached, according to its hit mask.  Bin
+ * indices are computed 64 recorders (one hit-mask word) at a time by
+ * _table_manager_data_index and then scattered; hits outside a recorder's
+ * window are counted in clip_low or clip_high.  With atomic set every
+ * update is an omp atomic; otherwise callers are responsible for any
+ * locking. */
+static void _table_manager_data_bin(struct TableManagerData * data,
+                                    const double * tof_t, const double * tof_p,
+                                    const double * hits, int atomic) {
+    ptrdiff_t idx[64];
+    double tp[64], p1[64], p2[64];
+    int words = TABLE_MANAGER_HIT_WORDS(data->recorders);
+    for (int w = 0; w < words; ++w) {
+        uint64_t bits = _table_manager_hits_load(hits, w);
+        if (!bits)
+            continue;
+        int base = w * 64;
+        int m = data->recorders - base < 64 ? data->recorders - base : 64;
+        _table_manager_data_index(data, tof_t, tof_p, base, m, idx, tp, p1, p2);
+        while (bits) {
+            int k = _table_manager_ctz64(bits);
+            bits &= bits - 1;
+            if (idx[k] < 0)
+                _table_manager_data_clip(data, base + k, tof_t[base + k], atomic);
+            else
+                _table_manager_data_add(data, idx[k], tp[k], p1[k], p2[k], atomic);
+        }
+    }
+}
+
+/* Rays binned together by table_manager_particles_to_table. */
+#define TABLE_MANAGER_BATCH 64
+
+/* The batch counterpart of _table_manager_data_index: bin indices and sums
+ * of recorder r for m rays whose times and probabilities were transposed
+ * into t and p, so the loop runs across rays and vectorises even when there
+ * are only a few recorders. */
+TABLE_MANAGER_TARGET_CLONES
+static void _table_manager_data_index_rays(const struct TableManagerData * data, int r,
+                                           int m, const double * t, const double * p,
+                                           ptrdiff_t * idx, double * tp, double * p1, double * p2) {
+    double r_min = data->r_min[r];
+    double r_scale = data->r_scale[r];
+    double bins = (double) data->bins;
+    ptrdiff_t row = (ptrdiff_t) r * data->bins;
+    if (data->binning == TABLE_MANAGER_BINNING_EDGES) {
+        const double * edges = data->edges;
+        int n_edges = data->bins + 1;
+        #pragma omp simd
+        for (int k = 0; k < m; ++k) {
+            int j = _table_manager_edges_index(edges, n_edges, t[k]);
+            idx[k] = j >= 0 ? row + j : -1;
+            tp[k] = t[k] * p[k];
+            p1[k] = p[k];
+            p2[k] = p[k] * p[k];
+        }
+        return;
+    }
+    int logarithmic = data->binning == TABLE_MANAGER_BINNING_LOG;
+    #pragma omp simd
+    for (int k = 0; k < m; ++k) {
+        double x = logarithmic ? log(t[k] / r_min) * r_scale : (t[k] - r_min) * r_scale;
+        int in = r_scale > 0.0 && x >= 0.0 && x < bins;
+        idx[k] = in ? row + (ptrdiff_t) x : -1;
+        tp[k] = t[k] * p[k];
+        p1[k] = p[k];
+        p2[k] = p[k] * p[k];
+    }
+}
+
+/* Bins m <= TABLE_MANAGER_BATCH rays at once: for every recorder the rays'
+ * values are gathered into contiguous scratch rows, indexed together and
+ * scattered.  Same locking rules as _table_manager_data_bin. */
+static void _table_manager_data_bin_rays(struct TableManagerData * data, int m,
+                                         double * const * tof_t, double * const * tof_p,
+                                         double * const * hits, int atomic) {
+    ptrdiff_t idx[TABLE_MANAGER_BATCH];
+    double t[TABLE_MANAGER_BATCH], p[TABLE_MANAGER_BATCH];
+    double tp[TABLE_MANAGER_BATCH], p1[TABLE_MANAGER_BATCH], p2[TABLE_MANAGER_BATCH];
+    unsigned char hit[TABLE_MANAGER_BATCH];
+    for (int r = 0; r < data->recorders; ++r) {
+        int any = 0;
+        for (int k = 0; k < m; ++k) {
+            hit[k] = (unsigned char) ((_table_manager_hits_load(hits[k], r / 64) >> (r % 64)) & 1u);
+            t[k] = hit[k] ? tof_t[k][r] : 0.0;
+            p[k] = hit[k] ? tof_p[k][r] : 0.0;
+            any |= hit[k];
+        }
+        if (!any)
+            continue;
+        _table_manager_data_index_rays(data, r, m, t, p, idx, tp, p1, p2);
+        for (int k = 0; k < m; ++k) {
+            if (!hit[k])
+                continue;
+            if (idx[k] < 0)
+                _table_manager_data_clip(data, r, t[k], atomic);
+            else
+                _table_manager_data_add(data, idx[k], tp[k], p1[k], p2[k], atomic);
+        }
+    }
+}
+
+/* Hands out the data of one per-particle block for n recorders, from the
+ * calling thread's pool when the size matches the pooled size, and links the
+ * block into that thread's live list. */
+static double * _table_manager_block_get(struct TableManagerState * state, int n) {
+    int thread = _table_manager_thread_num();
+    struct TableManagerPool * pool =
+        n == state->block_recorders && thread < state->n_pools ? &state->pools[thread] : NULL;
+    struct TableManagerBlock * block = NULL;
+    if (pool && pool->free_list) {
+        block = pool->free_list;
+        pool->free_list = block->next;
+        pool->hits++;
+    } else {
+        block = (struct TableManagerBlock *)
+            malloc(sizeof(struct TableManagerBlock) + sizeof(double) * (size_t) TABLE_MANAGER_INLINE_SIZE(n));
+        if (!block)
+            return NULL;
+        if (pool)
+            pool->misses++;
+    }
+    if (pool) {
+        block->next = pool->live.next;
+        block->prev = &pool->live;
+        pool->live.next->prev = block;
+        pool->live.next = block;
+    } else {
+        block->next = NULL;
+        block->prev = NULL;
+    }
+    return (double *) (block + 1);
+}
+
+/* Returns block data obtained from _table_manager_block_get to the calling
+ * thread's pool, or to the heap when it cannot be pooled. */
+static void _table_manager_block_put(struct TableManagerState * state, double * data, int n) {
+    if (!data)
+        return;
+    struct TableManagerBlock * block = (struct TableManagerBlock *) data - 1;
+    if (block->prev) {
+        block->prev->next = block->next;
+        block->next->prev = block->prev;
+    }
+    int thread = _table_manager_thread_num();
+    if (n == state->block_recorders && thread < state->n_pools) {
+        struct TableManagerPool * pool = &state->pools[thread];
+        block->next = pool->free_list;
+        block->prev = NULL;
+        pool->free_list = block;
+        return;
+    }
+    free(block);
+}
+
 /* Builds "base_name_index" into a freshly allocated string (caller frees). */
 static char * _build_suffixed_name(const char * base_name, int index) {
     int len = snprintf(NULL, 0, "%s_%d", base_name, index);
@@ -84,8 +551,43 @@ static char * _build_suffixed_name(const char * base_name, int index) {
  * Data lifetime
  * ------------------------------------------------------------------------- */
 
+static void _table_manager_data_free_blocks(struct TableManagerData * data) {
+    for (size_t b = 0; b < data->n_blocks; ++b)
+        free(data->blocks[b]);
+    free(data->blocks);
+    data->blocks = NULL;
+    data->n_blocks = 0;
+}
+
+static void _table_manager_data_free_warmup(struct TableManagerData * data) {
+    if (data->warmup) {
+        free(data->warmup->start);
+        free(data->warmup->recorder);
+        free(data->warmup->t);
+        free(data->warmup->p);
+        free(data->warmup->fixed);
+        free(data->warmup);
+    }
+    data->warmup = NULL;
+    /* seq_cst: a thread that reads warming == 0 must also see the windows
+     * set and the rays binned by _table_manager_data_end_warmup. */
+    #pragma omp atomic write seq_cst
+    data->warming = 0;
+}
+
 struct TableManagerData * table_manager_data_alloc(int recorders, int bins,
                                                    double t_min, double t_max) {
+    return table_manager_data_alloc_layout(recorders, bins, t_min, t_max,
+                                           TABLE_MANAGER_LAYOUT_SOA);
+}
+
+/* Allocates a table in the given layout, with only the storage that layout
+ * accumulates into: the dense arrays (SOA), the interleaved bins or the
+ * sparse block directory, so that a large sparse table never holds a dense
+ * copy. */
+struct TableManagerData * table_manager_data_alloc_layout(int recorders, int bins,
+                                                          double t_min, double t_max,
+                                                          int layout) {
     struct TableManagerData * data =
         (struct TableManagerData *) malloc(sizeof(struct TableManagerData));
     if (!data) {
@@ -96,15 +598,52 @@ struct TableManagerData * table_manager_data_alloc(int recorders, int bins,
     data->bins = bins;
     data->t_min = t_min;
     data->t_max = t_max;
-    data->tp = (double *) calloc((size_t)(recorders * bins), sizeof(double));
-    data->p1 = (double *) calloc((size_t)(recorders * bins), sizeof(double));
-    data->p2 = (double *) calloc((size_t)(recorders * bins), sizeof(double));
-    data->n  = (int *)    calloc((size_t)(recorders * bins), sizeof(int));
-    if (!data->tp || !data->p1 || !data->p2 || !data->n) {
+    /* bins per unit time; 0 for an empty window, which bins nothing */
+    data->t_scale = t_max > t_min ? (double) bins / (t_max - t_min) : 0.0;
+    data->tp = data->p1 = data->p2 = NULL;
+    data->n = NULL;
+    if (layout == TABLE_MANAGER_LAYOUT_SOA) {
+        size_t cells = (size_t) recorders * (size_t) bins;
+        data->tp = (double *) calloc(cells, sizeof(double));
+        data->p1 = (double *) calloc(cells, sizeof(double));
+        data->p2 = (double *) calloc(cells, sizeof(double));
+        data->n  = (int *)    calloc(cells, sizeof(int));
+    }
+    data->r_min   = (double *) malloc((size_t) recorders * sizeof(double));
+    data->r_max   = (double *) malloc((size_t) recorders * sizeof(double));
+    data->r_scale = (double *) malloc((size_t) recorders * sizeof(double));
+    data->accumulation = TABLE_MANAGER_ACCUMULATE_CRITICAL;
+    data->n_slabs = 0;
+    data->slabs = NULL;
+    data->layout = TABLE_MANAGER_LAYOUT_SOA;
+    data->cells = NULL;
+    data->cells_mem = NULL;
+    data->blocks = NULL;
+    data->n_blocks = 0;
+    data->binning = TABLE_MANAGER_BINNING_LINEAR;
+    data->edges = NULL;
+    data->clip_low  = (long long *) calloc((size_t) recorders, sizeof(long long));
+    data->clip_high = (long long *) calloc((size_t) recorders, sizeof(long long));
+    data->warming = 0;
+    data->warmup = NULL;
+    if ((layout == TABLE_MANAGER_LAYOUT_SOA &&
+         (!data->tp || !data->p1 || !data->p2 || !data->n)) ||
+        (recorders > 0 && (!data->r_min || !data->r_max || !data->r_scale ||
+                           !data->clip_low || !data->clip_high))) {
         fprintf(stderr, "TableManager ERROR: Failed to allocate memory for TableManagerData arrays.\n");
         table_manager_data_free(data);
         return NULL;
     }
+    for (int i = 0; i < recorders; ++i) {
+        data->r_min[i] = t_min;
+        data->r_max[i] = t_max;
+        data->r_scale[i] = data->t_scale;
+    }
+    if (layout != TABLE_MANAGER_LAYOUT_SOA &&
+        table_manager_data_set_layout(data, layout) != 0) {
+        table_manager_data_free(data);
+        return NULL;
+    }
     return data;
 }
 
@@ -114,267 +653,2633 @@ void table_manager_data_free(struct TableManagerData * data) {
         free(data->p1);
         free(data->p2);
         free(data->n);
+        free(data->r_min);
+        free(data->r_max);
+        free(data->r_scale);
+        free(data->cells_mem);
+        free(data->edges);
+        free(data->clip_low);
+        free(data->clip_high);
+        _table_manager_data_free_warmup(data);
+        _table_manager_data_free_blocks(data);
+        for (int i = 0; i < data->n_slabs; ++i)
+            table_manager_data_free(data->slabs[i]);
+        free(data->slabs);
         free(data);
     }
 }
 
-/* ---------------------------------------------------------------------------
- * Global state lifetime
- * ------------------------------------------------------------------------- */
+/* Maps a TableManager 'accumulation' parameter value to its enum value.
+ * NULL or "" selects the default; returns -1 for an unknown name. */
+int table_manager_accumulation_from_name(const char * name) {
+    if (!name || !strcmp(name, "") || !strcmp(name, "critical"))
+        return TABLE_MANAGER_ACCUMULATE_CRITICAL;
+    if (!strcmp(name, "private"))
+        return TABLE_MANAGER_ACCUMULATE_PRIVATE;
+    if (!strcmp(name, "atomic"))
+        return TABLE_MANAGER_ACCUMULATE_ATOMIC;
+    return -1;
+}
 
-void table_manager_state_alloc(void) {
-    if (_tof_table_manager_state) {
-        fprintf(stderr, "TableManager ERROR: global state is already allocated.\n");
-        return;
+/* Selects how particles are accumulated into data.  PRIVATE mode allocates
+ * one zeroed slab per thread; n_threads <= 0 uses the OpenMP maximum.  Must
+ * be called before any particle is binned. */
+int table_manager_data_set_accumulation(struct TableManagerData * data,
+                                        int accumulation, int n_threads) {
+    if (!data) {
+        fprintf(stderr, "TableManager ERROR: Cannot set the accumulation mode of a missing table.\n");
+        return -1;
     }
-    _tof_table_manager_state = _table_manager_state_alloc();
-    if (!_tof_table_manager_state) {
-        fprintf(stderr, "TableManager ERROR: Failed to allocate global state.\n");
+    if (accumulation != TABLE_MANAGER_ACCUMULATE_CRITICAL &&
+        accumulation != TABLE_MANAGER_ACCUMULATE_PRIVATE &&
+        accumulation != TABLE_MANAGER_ACCUMULATE_ATOMIC) {
+        fprintf(stderr, "TableManager ERROR: Unknown accumulation mode %d.\n", accumulation);
+        return -1;
+    }
+    if (accumulation == TABLE_MANAGER_ACCUMULATE_ATOMIC && data->layout == TABLE_MANAGER_LAYOUT_SPARSE) {
+        fprintf(stderr, "TableManager ERROR: Atomic accumulation is not available for sparse tables.\n");
+        return -1;
+    }
+    for (int i = 0; i < data->n_slabs; ++i)
+        table_manager_data_free(data->slabs[i]);
+    free(data->slabs);
+    data->slabs = NULL;
+    data->n_slabs = 0;
+    data->accumulation = accumulation;
+    if (accumulation != TABLE_MANAGER_ACCUMULATE_PRIVATE)
+        return 0;
+
+    int n = n_threads > 0 ? n_threads : _table_manager_max_threads();
+    data->slabs = (struct TableManagerData **) calloc((size_t)n, sizeof(struct TableManagerData *));
+    if (!data->slabs) {
+        fprintf(stderr, "TableManager ERROR: Failed to allocate memory for per-thread table slabs.\n");
+        data->accumulation = TABLE_MANAGER_ACCUMULATE_CRITICAL;
+        return -1;
+    }
+    data->n_slabs = n;
+    for (int i = 0; i < n; ++i) {
+        data->slabs[i] = table_manager_data_alloc_layout(data->recorders, data->bins,
+                                                         data->t_min, data->t_max,
+                                                         data->layout);
+        if (!data->slabs[i]) {
+            table_manager_data_set_accumulation(data, TABLE_MANAGER_ACCUMULATE_CRITICAL, 0);
+            return -1;
+        }
+        if (data->binning != TABLE_MANAGER_BINNING_LINEAR &&
+            table_manager_data_set_binning(data->slabs[i], data->binning, data->edges) != 0) {
+            table_manager_data_set_accumulation(data, TABLE_MANAGER_ACCUMULATE_CRITICAL, 0);
+            return -1;
+        }
+        size_t windows = (size_t) data->recorders * sizeof(double);
+        memcpy(data->slabs[i]->r_min, data->r_min, windows);
+        memcpy(data->slabs[i]->r_max, data->r_max, windows);
+        memcpy(data->slabs[i]->r_scale, data->r_scale, windows);
     }
+    return 0;
 }
 
-void table_manager_state_free(void) {
-    _table_manager_state_free(_tof_table_manager_state);
-    _tof_table_manager_state = NULL;
+/* Releases the dense tp, p1, p2 and n arrays of data. */
+static void _table_manager_data_free_dense(struct TableManagerData * data) {
+    free(data->tp);
+    free(data->p1);
+    free(data->p2);
+    free(data->n);
+    data->tp = data->p1 = data->p2 = NULL;
+    data->n = NULL;
 }
 
-int table_manager_state_exists(void) {
-    return _tof_table_manager_state != NULL;
+/* Allocates the zeroed dense arrays of a table that has none; they hold the
+ * sums of every layout but SPARSE once the table is reduced. */
+static int _table_manager_data_dense(struct TableManagerData * data) {
+    if (data->tp || data->blocks)
+        return 0;
+    size_t cells = (size_t) data->recorders * (size_t) data->bins;
+    data->tp = (double *) calloc(cells ? cells : 1, sizeof(double));
+    data->p1 = (double *) calloc(cells ? cells : 1, sizeof(double));
+    data->p2 = (double *) calloc(cells ? cells : 1, sizeof(double));
+    data->n  = (int *)    calloc(cells ? cells : 1, sizeof(int));
+    if (!data->tp || !data->p1 || !data->p2 || !data->n) {
+        fprintf(stderr, "TableManager ERROR: Failed to allocate memory for TableManagerData arrays.\n");
+        _table_manager_data_free_dense(data);
+        return -1;
+    }
+    return 0;
 }
 
-int table_manager_state_n_recorders(void) {
-    return _tof_table_manager_state ? _tof_table_manager_state->n_recorders : 0;
+/* Maps a TableManager 'layout' parameter value to its enum value.
+ * NULL or "" selects the default; returns -1 for an unknown name. */
+int table_manager_layout_from_name(const char * name) {
+    if (!name || !strcmp(name, "") || !strcmp(name, "soa"))
+        return TABLE_MANAGER_LAYOUT_SOA;
+    if (!strcmp(name, "interleaved"))
+        return TABLE_MANAGER_LAYOUT_INTERLEAVED;
+    if (!strcmp(name, "sparse"))
+        return TABLE_MANAGER_LAYOUT_SPARSE;
+    return -1;
 }
 
-int table_manager_state_add_recorder(const char * name, double distance) {
-    if (!_tof_table_manager_state) {
-        fprintf(stderr, "TableManager ERROR: state must be allocated by TableSetup before adding recorders.\n");
+/* Selects the accumulation layout of data and of its slabs.  INTERLEAVED
+ * allocates one zeroed, 32-byte aligned TableManagerBin per bin in place of
+ * the dense arrays, which table_manager_data_reduce brings back for the
+ * output; SPARSE releases them and allocates only the block directory.
+ * Must be called before any particle is binned.  A new table is better
+ * allocated in its layout (table_manager_data_alloc_layout), which never
+ * allocates the storage this releases. */
+int table_manager_data_set_layout(struct TableManagerData * data, int layout) {
+    if (!data) {
+        fprintf(stderr, "TableManager ERROR: Cannot set the layout of a missing table.\n");
         return -1;
     }
-    struct TableManagerLinkedListNode * node =
-        (struct TableManagerLinkedListNode *) malloc(sizeof(struct TableManagerLinkedListNode));
-    if (!node) {
-        fprintf(stderr, "TableManager ERROR: Failed to allocate memory for new recorder linked list node.\n");
+    if (layout != TABLE_MANAGER_LAYOUT_SOA && layout != TABLE_MANAGER_LAYOUT_INTERLEAVED &&
+        layout != TABLE_MANAGER_LAYOUT_SPARSE) {
+        fprintf(stderr, "TableManager ERROR: Unknown table layout %d.\n", layout);
         return -1;
     }
-    node->name = (char *) malloc(strlen(name) + 1);
-    if (!node->name) {
-        fprintf(stderr, "TableManager ERROR: Failed to allocate memory for new recorder name string.\n");
-        free(node);
+    if (layout == TABLE_MANAGER_LAYOUT_SPARSE && data->accumulation == TABLE_MANAGER_ACCUMULATE_ATOMIC) {
+        fprintf(stderr, "TableManager ERROR: Atomic accumulation is not available for sparse tables.\n");
         return -1;
     }
-    strcpy(node->name, name);
-    node->distance = distance;
-    node->next = NULL;
-    struct TableManagerLinkedListNode * tail = _tof_table_manager_state->recorders.tail;
-    if (tail) {
-        tail->next = node;
-    } else {
-        _tof_table_manager_state->recorders.head = node;
-    }
-    _tof_table_manager_state->recorders.tail = node;
-    return _tof_table_manager_state->n_recorders++;
-}
-
-void table_manager_state_finalize(int manager_index,
-                                  const char * t_name,
-                                  const char * p_name,
-                                  const char * n_name) {
-    if (!_tof_table_manager_state) {
-        fprintf(stderr, "TableManager ERROR: state must be allocated by TableSetup before finalizing.\n");
-        return;
-    }
-    /* Build suffixed names (e.g. "table_manager_t_9"), resolve their byte
-     * offsets in _struct_particle via a one-shot particle_getvar_void call,
-     * then discard the strings.  Hot-path accessors use the offsets directly
-     * and never call particle_getvar_void at TRACE time. */
-    char * tname = _build_suffixed_name(t_name, manager_index);
-    char * pname = _build_suffixed_name(p_name, manager_index);
-    char * nname = _build_suffixed_name(n_name, manager_index);
-    if (!tname || !pname || !nname) {
-        free(tname); free(pname); free(nname);
-        return;
+    size_t cells = (size_t) data->recorders * (size_t) data->bins;
+    free(data->cells_mem);
+    data->cells_mem = NULL;
+    data->cells = NULL;
+    _table_manager_data_free_blocks(data);
+    data->layout = TABLE_MANAGER_LAYOUT_SOA;
+    if (layout != TABLE_MANAGER_LAYOUT_SOA)
+        _table_manager_data_free_dense(data);
+    if (layout == TABLE_MANAGER_LAYOUT_SPARSE) {
+        data->n_blocks = (cells + TABLE_MANAGER_SPARSE_BLOCK - 1) / TABLE_MANAGER_SPARSE_BLOCK;
+        data->blocks = (struct TableManagerBin **) calloc(data->n_blocks ? data->n_blocks : 1,
+                                                          sizeof(struct TableManagerBin *));
+        if (!data->blocks) {
+            fprintf(stderr, "TableManager ERROR: Failed to allocate memory for the sparse table directory.\n");
+            data->n_blocks = 0;
+            return -1;
+        }
+        data->layout = layout;
+    } else if (layout == TABLE_MANAGER_LAYOUT_SOA && _table_manager_data_dense(data) != 0) {
+        return -1;
     }
-    _class_particle dummy = {0};
-    int s_t = 1, s_p = 1, s_n = 1;
-    void * t_ptr = particle_getvar_void(&dummy, tname, &s_t);
-    void * p_ptr = particle_getvar_void(&dummy, pname, &s_p);
-    void * n_ptr = particle_getvar_void(&dummy, nname, &s_n);
-    free(tname); free(pname); free(nname);
-    if (s_t != 0 || s_p != 0 || s_n != 0 || !t_ptr || !p_ptr || !n_ptr) {
-        fprintf(stderr, "TableManager ERROR: Failed to resolve particle field offsets for manager index %d.\n",
-                manager_index);
-        return;
+    if (layout == TABLE_MANAGER_LAYOUT_INTERLEAVED) {
+        /* calloc + manual alignment: aligned_alloc is not available on MSVC */
+        data->cells_mem = calloc(cells * sizeof(struct TableManagerBin) + 31, 1);
+        if (!data->cells_mem) {
+            fprintf(stderr, "TableManager ERROR: Failed to allocate memory for interleaved table bins.\n");
+            return -1;
+        }
+        data->cells = (struct TableManagerBin *) (((uintptr_t) data->cells_mem + 31) & ~(uintptr_t) 31);
+        data->layout = layout;
     }
-    _tof_table_manager_state->t_offset = (ptrdiff_t)((char *)t_ptr - (char *)&dummy);
-    _tof_table_manager_state->p_offset = (ptrdiff_t)((char *)p_ptr - (char *)&dummy);
-    _tof_table_manager_state->n_offset = (ptrdiff_t)((char *)n_ptr - (char *)&dummy);
-    _tof_table_manager_state->offsets_set = 1;
+    for (int i = 0; i < data->n_slabs; ++i)
+        if (table_manager_data_set_layout(data->slabs[i], layout) != 0)
+            return -1;
+    return 0;
 }
 
-/* ---------------------------------------------------------------------------
- * Per-particle accessors
- * ------------------------------------------------------------------------- */
-
-double ** table_manager_particle_t_array_ptr(_class_particle * p) {
-    if (!_tof_table_manager_state || !_tof_table_manager_state->offsets_set) {
-        fprintf(stderr, "TableManager ERROR: state must be allocated and finalized before accessing the t array.\n");
-        return NULL;
-    }
-    return (double **)((char *)p + _tof_table_manager_state->t_offset);
+/* Index scale of a window [lo, hi) under the binning of data: bins per unit
+ * time (linear), bins per unit log-time (log), or 1 for custom edges, whose
+ * index is searched; 0 marks an empty window. */
+static double _table_manager_data_scale(const struct TableManagerData * data,
+                                        double lo, double hi) {
+    if (!(hi > lo))
+        return 0.0;
+    if (data->binning == TABLE_MANAGER_BINNING_LOG)
+        return lo > 0.0 ? (double) data->bins / log(hi / lo) : 0.0;
+    if (data->binning == TABLE_MANAGER_BINNING_EDGES)
+        return 1.0;
+    return (double) data->bins / (hi - lo);
 }
 
-double ** table_manager_particle_p_array_ptr(_class_particle * p) {
-    if (!_tof_table_manager_state || !_tof_table_manager_state->offsets_set) {
-        fprintf(stderr, "TableManager ERROR: state must be allocated and finalized before accessing the p array.\n");
-        return NULL;
-    }
-    return (double **)((char *)p + _tof_table_manager_state->p_offset);
+/* Maps a TableManager 'binning' parameter value to its enum value.
+ * NULL or "" selects the default; returns -1 for an unknown name. */
+int table_manager_binning_from_name(const char * name) {
+    if (!name || !strcmp(name, "") || !strcmp(name, "linear"))
+        return TABLE_MANAGER_BINNING_LINEAR;
+    if (!strcmp(name, "log"))
+        return TABLE_MANAGER_BINNING_LOG;
+    if (!strcmp(name, "edges"))
+        return TABLE_MANAGER_BINNING_EDGES;
+    return -1;
 }
 
-int * table_manager_particle_n_ptr(_class_particle * p) {
-    if (!_tof_table_manager_state || !_tof_table_manager_state->offsets_set) {
-        fprintf(stderr, "TableManager ERROR: state must be allocated and finalized before accessing the n array.\n");
-        return NULL;
+/* Selects how the time axis of data and its slabs is split into bins.  LOG
+ * needs every non-empty window to start after 0; EDGES copies the bins + 1 strictly
+ * increasing values in edges, which then define the table window for every
+ * recorder.  Must be called before any particle is binned. */
+int table_manager_data_set_binning(struct TableManagerData * data, int binning,
+                                   const double * edges) {
+    if (!data) {
+        fprintf(stderr, "TableManager ERROR: Cannot set the binning of a missing table.\n");
+        return -1;
     }
-    return (int *)((char *)p + _tof_table_manager_state->n_offset);
-}
-
-/* ---------------------------------------------------------------------------
- * Per-particle operations
- * ------------------------------------------------------------------------- */
-
-void table_manager_particle_alloc(_class_particle * p, double t_zero) {
-    double ** tof_t_ptr = table_manager_particle_t_array_ptr(p);
-    double ** tof_p_ptr = table_manager_particle_p_array_ptr(p);
-    int *     tof_n_ptr = table_manager_particle_n_ptr(p);
-    if (!tof_t_ptr || !tof_p_ptr || !tof_n_ptr) {
-        fprintf(stderr, "TableManager ERROR: Failed to access per-particle time or probability arrays for allocation.\n");
-        return;
+    if (binning == TABLE_MANAGER_BINNING_LOG) {
+        /* Empty windows bin nothing, so only the others need to be positive. */
+        int positive = data->t_min > 0.0 || !(data->t_max > data->t_min);
+        for (int i = 0; i < data->recorders; ++i)
+            positive = positive && (data->r_min[i] > 0.0 || !(data->r_max[i] > data->r_min[i]));
+        if (!positive) {
+            fprintf(stderr, "TableManager ERROR: Logarithmic bins need time windows that start after 0.\n");
+            return -1;
+        }
+    } else if (binning == TABLE_MANAGER_BINNING_EDGES) {
+        if (data->warmup) {
+            fprintf(stderr, "TableManager ERROR: Custom bin edges cannot be combined with automatic time ranges.\n");
+            return -1;
+        }
+        int increasing = edges != NULL;
+        for (int i = 0; increasing && i < data->bins; ++i)
+            increasing = edges[i] < edges[i + 1];
+        if (!increasing) {
+            fprintf(stderr, "TableManager ERROR: Custom bin edges must be %d strictly increasing values.\n",
+                    data->bins + 1);
+            return -1;
+        }
+    } else if (binning != TABLE_MANAGER_BINNING_LINEAR) {
+        fprintf(stderr, "TableManager ERROR: Unknown binning %d.\n", binning);
+        return -1;
     }
-    *tof_t_ptr = NULL;
-    *tof_p_ptr = NULL;
-    *tof_n_ptr = 0;
-    if (_tof_table_manager_state->n_recorders > 0) {
-        int n = _tof_table_manager_state->n_recorders;
-        *tof_t_ptr = (double *) malloc(sizeof(double) * n);
-        *tof_p_ptr = (double *) malloc(sizeof(double) * n);
-        if (!*tof_t_ptr || !*tof_p_ptr) {
-            fprintf(stderr, "TableManager ERROR: Failed to allocate memory for per-particle time or probability arrays.\n");
-            free(*tof_t_ptr);
-            free(*tof_p_ptr);
-            *tof_t_ptr = NULL;
-            *tof_p_ptr = NULL;
-            return;
+
+    double * copy = NULL;
+    if (binning == TABLE_MANAGER_BINNING_EDGES) {
+        copy = (double *) malloc((size_t) (data->bins + 1) * sizeof(double));
+        if (!copy) {
+            fprintf(stderr, "TableManager ERROR: Failed to allocate memory for custom bin edges.\n");
+            return -1;
         }
-        *tof_n_ptr = n;
-        for (int i = 0; i < n; i++) {
-            (*tof_t_ptr)[i] = t_zero;
-            (*tof_p_ptr)[i] = 0.0;
+        memcpy(copy, edges, (size_t) (data->bins + 1) * sizeof(double));
+        data->t_min = edges[0];
+        data->t_max = edges[data->bins];
+        for (int i = 0; i < data->recorders; ++i) {
+            data->r_min[i] = data->t_min;
+            data->r_max[i] = data->t_max;
         }
     }
+    free(data->edges);
+    data->edges = copy;
+    data->binning = binning;
+    data->t_scale = _table_manager_data_scale(data, data->t_min, data->t_max);
+    for (int i = 0; i < data->recorders; ++i)
+        data->r_scale[i] = _table_manager_data_scale(data, data->r_min[i], data->r_max[i]);
+    for (int i = 0; i < data->n_slabs; ++i)
+        if (table_manager_data_set_binning(data->slabs[i], binning, edges) != 0)
+            return -1;
+    return 0;
 }
 
-int table_manager_particle_record(_class_particle * p, int recorder_index) {
-    double * tof_t_ptr = *table_manager_particle_t_array_ptr(p);
-    double * tof_p_ptr = *table_manager_particle_p_array_ptr(p);
-    int *    tof_n_ptr =  table_manager_particle_n_ptr(p);
-    if (!tof_t_ptr || !tof_p_ptr || !tof_n_ptr) {
-        fprintf(stderr, "TableManager ERROR: Failed to access per-particle time or probability arrays for recording.\n");
-        return -1;
-    }
-    if (recorder_index < 0 || recorder_index >= *tof_n_ptr) {
-        fprintf(stderr, "TableManager ERROR: Recorder index out of bounds when recording particle data.\n");
+/* Writes the bins + 1 time-bin edges of recorder into out; recorder -1
+ * selects the table-wide window [t_min, t_max). */
+int table_manager_data_edges(const struct TableManagerData * data, int recorder,
+                             double * out) {
+    if (!data || recorder < -1 || recorder >= data->recorders)
         return -1;
+    double lo = recorder < 0 ? data->t_min : data->r_min[recorder];
+    double hi = recorder < 0 ? data->t_max : data->r_max[recorder];
+    for (int i = 0; i <= data->bins; ++i) {
+        if (data->binning == TABLE_MANAGER_BINNING_EDGES)
+            out[i] = data->edges[i];
+        else if (data->binning == TABLE_MANAGER_BINNING_LOG)
+            out[i] = i == data->bins ? hi : lo * pow(hi / lo, (double) i / data->bins);
+        else
+            out[i] = lo + (hi - lo) * i / data->bins;
     }
-    tof_t_ptr[recorder_index] = p->t;
-    tof_p_ptr[recorder_index] = p->p;
     return 0;
 }
 
-int table_manager_particle_to_table(_class_particle * p, struct TableManagerData * data) {
-    double * tof_t_ptr = *table_manager_particle_t_array_ptr(p);
-    double * tof_p_ptr = *table_manager_particle_p_array_ptr(p);
-    int *    tof_n_ptr =  table_manager_particle_n_ptr(p);
-    if (!tof_t_ptr || !tof_p_ptr || !tof_n_ptr) {
-        fprintf(stderr, "TableManager ERROR: Failed to access per-particle time or probability arrays for transfer to table.\n");
+/* Gives recorder its own time window [t_min, t_max), split into the same
+ * number of bins as every other recorder, in data and its slabs.  Must be
+ * called before any particle is binned; during an automatic time-range
+ * warm-up the window is kept instead of derived. */
+int table_manager_data_set_window(struct TableManagerData * data, int recorder,
+                                  double t_min, double t_max) {
+    if (!data || recorder < 0 || recorder >= data->recorders) {
+        fprintf(stderr, "TableManager ERROR: Cannot set the time window of recorder %d.\n", recorder);
         return -1;
     }
-    if (*tof_n_ptr != data->recorders) {
-        fprintf(stderr, "TableManager ERROR: Number of recorders in particle data does not match number of recorders in table data during transfer.\n");
+    if (!(t_max > t_min)) {
+        fprintf(stderr, "TableManager ERROR: Time window [%g, %g) of recorder %d is empty.\n",
+                t_min, t_max, recorder);
         return -1;
     }
-    #pragma omp critical
-    {
-        for (int i = 0; i < data->recorders; ++i) {
-            double t = tof_t_ptr[i];
-            double p = tof_p_ptr[i];
-            int j = (int) ((t - data->t_min) / (data->t_max - data->t_min) * data->bins);
-            if (j < 0 || j >= data->bins)
-                continue;
-            int idx = i * data->bins + j;
-            data->p1[idx] += p;
-            data->p2[idx] += p * p;
-            data->tp[idx] += t * p;
-            data->n[idx]  += 1;
-        }
+    if (data->binning == TABLE_MANAGER_BINNING_EDGES) {
+        fprintf(stderr, "TableManager ERROR: Recorder %d cannot have its own time window with custom bin edges.\n",
+                recorder);
+        return -1;
+    }
+    if (data->binning == TABLE_MANAGER_BINNING_LOG && !(t_min > 0.0)) {
+        fprintf(stderr, "TableManager ERROR: Time window [%g, %g) of recorder %d must start after 0 for logarithmic bins.\n",
+                t_min, t_max, recorder);
+        return -1;
     }
+    data->r_min[recorder] = t_min;
+    data->r_max[recorder] = t_max;
+    data->r_scale[recorder] = _table_manager_data_scale(data, t_min, t_max);
+    if (data->warmup)
+        data->warmup->fixed[recorder] = 1;
+    for (int i = 0; i < data->n_slabs; ++i)
+        table_manager_data_set_window(data->slabs[i], recorder, t_min, t_max);
     return 0;
 }
 
-int table_manager_particle_free(_class_particle * p) {
-    double ** tof_t_ptr = table_manager_particle_t_array_ptr(p);
-    double ** tof_p_ptr = table_manager_particle_p_array_ptr(p);
-    int *     tof_n_ptr = table_manager_particle_n_ptr(p);
-    if (!tof_t_ptr || !tof_p_ptr || !tof_n_ptr) {
-        fprintf(stderr, "TableManager ERROR: Failed to access per-particle time or probability arrays for freeing.\n");
+/* Starts an automatic time-range warm-up: the first rays handed to
+ * table_manager_particle_to_table are buffered, and once there are rays of
+ * them (or at the next table_manager_data_reduce) every recorder that saw a
+ * hit gets the window spanned by its buffered times, widened by padding
+ * times its width on each side (in log(t) for LOG binning).  The buffered
+ * rays are then binned as usual.  Windows set with
+ * table_manager_data_set_window after this call are kept.  Only the hits
+ * of the buffered rays are kept, in at most TABLE_MANAGER_WARMUP_BYTES; a
+ * warm-up that fills them ends early, with a note.  Must be called before
+ * any particle is binned. */
+int table_manager_data_set_auto_range(struct TableManagerData * data,
+                                      long rays, double padding) {
+    if (!data || rays <= 0 || !(padding >= 0.0)) {
+        fprintf(stderr, "TableManager ERROR: Automatic time ranges need a table, a positive number of rays and a non-negative padding.\n");
         return -1;
     }
-    free(*tof_t_ptr);
-    free(*tof_p_ptr);
-    *tof_t_ptr = NULL;
-    *tof_p_ptr = NULL;
-    *tof_n_ptr = 0;
+    if (data->binning == TABLE_MANAGER_BINNING_EDGES) {
+        fprintf(stderr, "TableManager ERROR: Custom bin edges cannot be combined with automatic time ranges.\n");
+        return -1;
+    }
+    _table_manager_data_free_warmup(data);
+    struct TableManagerWarmup * warmup =
+        (struct TableManagerWarmup *) calloc(1, sizeof(struct TableManagerWarmup));
+    if (!warmup) {
+        fprintf(stderr, "TableManager ERROR: Failed to allocate memory for the time-range warm-up.\n");
+        return -1;
+    }
+    warmup->capacity = rays;
+    warmup->padding = padding;
+    warmup->start = (size_t *) calloc(1, sizeof(size_t));
+    warmup->fixed = (unsigned char *) calloc((size_t) data->recorders + 1, 1);
+    data->warmup = warmup;
+    if (!warmup->start || !warmup->fixed) {
+        fprintf(stderr, "TableManager ERROR: Failed to allocate memory for the time-range warm-up.\n");
+        _table_manager_data_free_warmup(data);
+        return -1;
+    }
+    data->warming = 1;
     return 0;
 }
 
-/* ---------------------------------------------------------------------------
- * JSON helpers
- * ------------------------------------------------------------------------- */
-
-int table_manager_json_indent(FILE * f, int level) {
-    for (int i = 0; i < level; ++i) {
-        if (fprintf(f, "  ") < 0)
+/* Derives the window of every recorder that is not fixed from the buffered
+ * rays, then bins and releases them.  Runs with other threads held off:
+ * inside the critical section of table_manager_particle_to_table, or from
+ * table_manager_data_reduce. */
+static void _table_manager_data_end_warmup(struct TableManagerData * data) {
+    struct TableManagerWarmup * warmup = data->warmup;
+    int nr = data->recorders;
+    int logarithmic = data->binning == TABLE_MANAGER_BINNING_LOG;
+    double * lows = (double *) malloc((size_t) (nr > 0 ? nr : 1) * 2 * sizeof(double));
+    double * ray = (double *) calloc((size_t) TABLE_MANAGER_INLINE_SIZE(nr > 0 ? nr : 1), sizeof(double));
+    if (!lows || !ray) {
+        fprintf(stderr, "TableManager ERROR: Failed to allocate memory to end the time-range warm-up; its rays are lost.\n");
+        free(lows);
+        free(ray);
+        _table_manager_data_free_warmup(data);
+        return;
+    }
+    double * highs = lows + nr;
+    for (int r = 0; r < nr; ++r) {
+        lows[r] = INFINITY;
+        highs[r] = -INFINITY;
+    }
+    for (size_t e = 0; e < warmup->entries; ++e) {
+        int r = warmup->recorder[e];
+        double t = warmup->t[e];
+        if (!isfinite(t) || (logarithmic && !(t > 0.0)))
+            continue;
+        lows[r] = t < lows[r] ? t : lows[r];
+        highs[r] = t > highs[r] ? t : highs[r];
+    }
+    for (int r = 0; r < nr; ++r) {
+        if (warmup->fixed[r])
+            continue;
+        double lo = lows[r], hi = highs[r];
+        if (!(hi >= lo))
+            continue;  /* no buffered hit: keep the configured window */
+        double latest = hi;
+        if (logarithmic) {
+            double span = hi > lo ? log(hi / lo) : 1.0;
+            lo *= exp(-warmup->padding * span);
+            hi *= exp(warmup->padding * span);
+        } else {
+            double span = hi > lo ? hi - lo : (hi != 0.0 ? fabs(hi) : 1.0);
+            lo -= warmup->padding * span;
+            hi += warmup->padding * span;
+        }
+        /* The window is half-open: keep the latest buffered time inside it. */
+        if (!(hi > latest))
+            hi = nextafter(latest, INFINITY);
+        table_manager_data_set_window(data, r, lo, hi);
+    }
+    /* Each ray is unpacked into a per-particle block to be binned. */
+    int atomic = data->accumulation == TABLE_MANAGER_ACCUMULATE_ATOMIC;
+    double * hits = ray + 2 * nr;
+    for (long i = 0; i < warmup->count; ++i) {
+        for (int w = 0; w < TABLE_MANAGER_HIT_WORDS(nr); ++w)
+            _table_manager_hits_store(hits, w, 0);
+        for (size_t e = warmup->start[i]; e < warmup->start[i + 1]; ++e) {
+            int r = warmup->recorder[e];
+            ray[r] = warmup->t[e];
+            ray[nr + r] = warmup->p[e];
+            _table_manager_hits_store(hits, r / 64,
+                                      _table_manager_hits_load(hits, r / 64) | ((uint64_t) 1 << (r % 64)));
+        }
+        _table_manager_data_bin(data, ray, ray + nr, hits, atomic);
+    }
+    free(lows);
+    free(ray);
+    _table_manager_data_free_warmup(data);
+}
+
+/* Makes room in the warm-up buffer for one more ray with the given hits,
+ * growing it geometrically.  Returns -1, with a note, when that would take
+ * it past TABLE_MANAGER_WARMUP_BYTES or the memory is not available. */
+static int _table_manager_warmup_reserve(struct TableManagerData * data, const double * hits) {
+    struct TableManagerWarmup * warmup = data->warmup;
+    size_t n = 0;
+    for (int w = 0; w < TABLE_MANAGER_HIT_WORDS(data->recorders); ++w)
+        for (uint64_t bits = _table_manager_hits_load(hits, w); bits; bits &= bits - 1)
+            ++n;
+    size_t rays = warmup->ray_room, entries = warmup->entry_room;
+    while (rays < (size_t) warmup->count + 1)
+        rays = rays ? 2 * rays : 64;
+    if (rays > (size_t) warmup->capacity)
+        rays = (size_t) warmup->capacity;
+    while (entries < warmup->entries + n)
+        entries = entries ? 2 * entries : 64;
+    if (rays == warmup->ray_room && entries == warmup->entry_room)
+        return 0;
+    size_t entry_bytes = sizeof(int) + 2 * sizeof(double);
+    if ((rays + 1) * sizeof(size_t) + entries * entry_bytes > TABLE_MANAGER_WARMUP_BYTES) {
+        fprintf(stderr, "TableManager WARNING: The time-range warm-up filled its %g MiB after %ld rays; "
+                        "ranging on those.\n", (double) TABLE_MANAGER_WARMUP_BYTES / (1 << 20), warmup->count);
+        return -1;
+    }
+    int ok = 1;
+    if (rays != warmup->ray_room) {
+        size_t * start = (size_t *) realloc(warmup->start, (rays + 1) * sizeof(size_t));
+        ok = start != NULL;
+        if (ok) {
+            warmup->start = start;
+            warmup->ray_room = rays;
+        }
+    }
+    if (ok && entries != warmup->entry_room) {
+        /* Each array that grew keeps its memory; entry_room follows the last. */
+        int * recorder = (int *) realloc(warmup->recorder, entries * sizeof(int));
+        if (recorder)
+            warmup->recorder = recorder;
+        double * t = recorder ? (double *) realloc(warmup->t, entries * sizeof(double)) : NULL;
+        if (t)
+            warmup->t = t;
+        double * p = t ? (double *) realloc(warmup->p, entries * sizeof(double)) : NULL;
+        if (p)
+            warmup->p = p;
+        ok = p != NULL;
+        if (ok)
+            warmup->entry_room = entries;
+    }
+    if (!ok) {
+        fprintf(stderr, "TableManager WARNING: No memory to buffer more time-range warm-up rays after %ld; "
+                        "ranging on those.\n", warmup->count);
+        return -1;
+    }
+    return 0;
+}
+
+/* Buffers one ray during the warm-up; returns 0 once the warm-up is over
+ * and the ray must be binned normally instead. */
+static int _table_manager_data_warmup_push(struct TableManagerData * data,
+                                           const double * tof_t, const double * tof_p,
+                                           const double * hits) {
+    int buffered = 0;
+    #pragma omp critical
+    {
+        int warming;
+        #pragma omp atomic read seq_cst
+        warming = data->warming;
+        if (warming && _table_manager_warmup_reserve(data, hits) != 0) {
+            /* Full: range on the rays buffered so far, and bin this one. */
+            _table_manager_data_end_warmup(data);
+        } else if (warming) {
+            struct TableManagerWarmup * warmup = data->warmup;
+            for (int w = 0; w < TABLE_MANAGER_HIT_WORDS(data->recorders); ++w) {
+                uint64_t bits = _table_manager_hits_load(hits, w);
+                while (bits) {
+                    int r = w * 64 + _table_manager_ctz64(bits);
+                    bits &= bits - 1;
+                    warmup->recorder[warmup->entries] = r;
+                    warmup->t[warmup->entries] = tof_t[r];
+                    warmup->p[warmup->entries] = tof_p[r];
+                    ++warmup->entries;
+                }
+            }
+            warmup->start[++warmup->count] = warmup->entries;
+            if (warmup->count == warmup->capacity)
+                _table_manager_data_end_warmup(data);
+            buffered = 1;
+        }
+    }
+    return buffered;
+}
+
+/* Adds whatever src has accumulated (its interleaved bins, or its arrays
+ * when src is a separate slab) into the arrays of dst, then zeroes it.
+ * Sparse slabs are added into the blocks of the sparse dst instead. */
+static void _table_manager_data_fold(struct TableManagerData * dst,
+                                     struct TableManagerData * src) {
+    size_t cells = (size_t) dst->recorders * (size_t) dst->bins;
+    if (src != dst)
+        for (int r = 0; r < dst->recorders; ++r) {
+            dst->clip_low[r]  += src->clip_low[r];
+            dst->clip_high[r] += src->clip_high[r];
+            src->clip_low[r]  = 0;
+            src->clip_high[r] = 0;
+        }
+    if (src->blocks) {
+        /* Sparse slab into the sparse table: blocks the table lacks are
+         * handed over as they are, the others are added and released. */
+        for (size_t b = 0; src != dst && b < src->n_blocks; ++b) {
+            struct TableManagerBin * block = src->blocks[b];
+            if (!block)
+                continue;
+            src->blocks[b] = NULL;
+            if (!dst->blocks[b]) {
+                dst->blocks[b] = block;
+                continue;
+            }
+            for (int k = 0; k < TABLE_MANAGER_SPARSE_BLOCK; ++k) {
+                dst->blocks[b][k].tp += block[k].tp;
+                dst->blocks[b][k].p1 += block[k].p1;
+                dst->blocks[b][k].p2 += block[k].p2;
+                dst->blocks[b][k].n  += block[k].n;
+            }
+            free(block);
+        }
+        return;
+    }
+    if (src->cells) {
+        for (size_t i = 0; i < cells; ++i) {
+            dst->tp[i] += src->cells[i].tp;
+            dst->p1[i] += src->cells[i].p1;
+            dst->p2[i] += src->cells[i].p2;
+            dst->n[i]  += src->cells[i].n;
+        }
+        memset(src->cells, 0, cells * sizeof(struct TableManagerBin));
+    }
+    if (src == dst || !src->tp)
+        return;
+    for (size_t i = 0; i < cells; ++i) {
+        dst->tp[i] += src->tp[i];
+        dst->p1[i] += src->p1[i];
+        dst->p2[i] += src->p2[i];
+        dst->n[i]  += src->n[i];
+    }
+    memset(src->tp, 0, cells * sizeof(double));
+    memset(src->p1, 0, cells * sizeof(double));
+    memset(src->p2, 0, cells * sizeof(double));
+    memset(src->n,  0, cells * sizeof(int));
+}
+
+/* Folds every per-thread slab and any interleaved bins into the shared arrays
+ * (allocating those of an interleaved table) and zeroes them, so that repeated (intermediate) SAVEs never count a
+ * particle twice.  Must not run concurrently with
+ * table_manager_particle_to_table. */
+int table_manager_data_reduce(struct TableManagerData * data) {
+    if (!data)
+        return -1;
+    /* Fewer rays than the warm-up asked for: range on what there is. */
+    if (data->warming)
+        _table_manager_data_end_warmup(data);
+    if (_table_manager_data_dense(data) != 0)
+        return -1;
+    for (int s = 0; s < data->n_slabs; ++s)
+        _table_manager_data_fold(data, data->slabs[s]);
+    _table_manager_data_fold(data, data);
+    return 0;
+}
+
+/* Copies the accumulated sums of one bin into out, whatever the layout.
+ * Reads the table itself but not its slabs, so call table_manager_data_reduce
+ * first. */
+int table_manager_data_get_bin(const struct TableManagerData * data,
+                               int recorder, int bin,
+                               struct TableManagerBin * out) {
+    memset(out, 0, sizeof(*out));
+    if (!data || recorder < 0 || recorder >= data->recorders || bin < 0 || bin >= data->bins)
+        return -1;
+    size_t idx = (size_t) recorder * (size_t) data->bins + (size_t) bin;
+    if (data->blocks) {
+        const struct TableManagerBin * block = data->blocks[idx / TABLE_MANAGER_SPARSE_BLOCK];
+        if (block)
+            *out = block[idx % TABLE_MANAGER_SPARSE_BLOCK];
+        return 0;
+    }
+    if (data->tp) {
+        out->tp = data->tp[idx];
+        out->p1 = data->p1[idx];
+        out->p2 = data->p2[idx];
+        out->n  = data->n[idx];
+    }
+    if (data->cells) {
+        out->tp += data->cells[idx].tp;
+        out->p1 += data->cells[idx].p1;
+        out->p2 += data->cells[idx].p2;
+        out->n  += data->cells[idx].n;
+    }
+    return 0;
+}
+
+/* Adds the sums of bin idx of data, wherever they are held before
+ * table_manager_data_reduce, to out. */
+static void _table_manager_data_bin_add(const struct TableManagerData * data, size_t idx,
+                                        struct TableManagerBin * out) {
+    if (data->blocks) {
+        const struct TableManagerBin * block = data->blocks[idx / TABLE_MANAGER_SPARSE_BLOCK];
+        if (block) {
+            out->p1 += block[idx % TABLE_MANAGER_SPARSE_BLOCK].p1;
+            out->p2 += block[idx % TABLE_MANAGER_SPARSE_BLOCK].p2;
+            out->n  += block[idx % TABLE_MANAGER_SPARSE_BLOCK].n;
+        }
+        return;
+    }
+    if (data->tp) {
+        out->p1 += data->p1[idx];
+        out->p2 += data->p2[idx];
+        out->n  += data->n[idx];
+    }
+    if (data->cells) {
+        out->p1 += data->cells[idx].p1;
+        out->p2 += data->cells[idx].p2;
+        out->n  += data->cells[idx].n;
+    }
+}
+
+/* A bin's relative error and its share of the table's probability. */
+struct TableManagerBinError {
+    double error;
+    double p1;
+};
+
+static int _table_manager_bin_error_cmp(const void * a, const void * b) {
+    double x = ((const struct TableManagerBinError *) a)->error;
+    double y = ((const struct TableManagerBinError *) b)->error;
+    return (x > y) - (x < y);
+}
+
+/* Sets *error to the relative error sqrt(p2) / p1 of the table at the given
+ * quantile (0 < quantile <= 1) over its bins with hits, weighted by their
+ * p1: the error not exceeded by bins holding that fraction of the table's
+ * probability, so 1 gives the largest error of any bin with hits.  Without
+ * any such bin *error is INFINITY.  Reads the bins of data and of its
+ * per-thread slabs as they are, without reducing them, so it must not run
+ * while other threads bin into data. */
+int table_manager_data_rel_error(const struct TableManagerData * data, double quantile,
+                                 double * error) {
+    if (!data || !error || !(quantile > 0.0 && quantile <= 1.0)) {
+        fprintf(stderr, "TableManager ERROR: The relative error needs a table and a quantile in (0, 1].\n");
+        return -1;
+    }
+    size_t cells = (size_t) data->recorders * (size_t) data->bins;
+    struct TableManagerBinError * bins = NULL;
+    if (quantile < 1.0) {
+        bins = (struct TableManagerBinError *) malloc((cells > 0 ? cells : 1) * sizeof(*bins));
+        if (!bins) {
+            fprintf(stderr, "TableManager ERROR: Failed to allocate memory for the bin errors.\n");
+            return -1;
+        }
+    }
+    size_t used = 0;
+    double total = 0.0, largest = -1.0;
+    for (size_t idx = 0; idx < cells; ++idx) {
+        struct TableManagerBin bin = {0};
+        _table_manager_data_bin_add(data, idx, &bin);
+        for (int i = 0; i < data->n_slabs; ++i)
+            _table_manager_data_bin_add(data->slabs[i], idx, &bin);
+        if (!bin.n || !(bin.p1 > 0.0))
+            continue;
+        double e = sqrt(bin.p2) / bin.p1;
+        if (e > largest)
+            largest = e;
+        if (bins) {
+            bins[used].error = e;
+            bins[used].p1 = bin.p1;
+            total += bin.p1;
+        }
+        ++used;
+    }
+    *error = used ? largest : INFINITY;
+    if (bins && used) {
+        qsort(bins, used, sizeof(*bins), _table_manager_bin_error_cmp);
+        double target = quantile * total, sum = 0.0;
+        for (size_t i = 0; i < used; ++i) {
+            sum += bins[i].p1;
+            if (sum >= target) {
+                *error = bins[i].error;
+                break;
+            }
+        }
+    }
+    free(bins);
+    return 0;
+}
+
+/* Bins table_manager_data_rel_error_step reads per hold of the binning lock. */
+#define TABLE_MANAGER_ERROR_LOCKED 4096
+
+/* The bucket of a relative error e > 0 in a TableManagerErrorScan. */
+static int _table_manager_error_bucket(double e) {
+    double b = floor(log2(e) * 8.0) + 192.0;
+    return b < 0.0 ? 0 : b > TABLE_MANAGER_ERROR_BUCKETS - 1 ? TABLE_MANAGER_ERROR_BUCKETS - 1 : (int) b;
+}
+
+/* table_manager_data_rel_error spread over many calls, each visiting the
+ * next TABLE_MANAGER_ERROR_CHUNK bins of data (an unallocated sparse block
+ * counts as one), with neither allocation nor sorting.  Returns 1 when the
+ * call completes a pass over the table, setting *error and zeroing scan for
+ * the next pass; 0 while the pass goes on; -1 on bad arguments.  *error is
+ * the upper edge of the bucket that holds the quantile, at most the largest
+ * error, so it overstates the exact quantile by at most 2^(1/8).  Bins
+ * visited early in a pass count with the hits they had then.  Reads only
+ * the shared storage of data, TABLE_MANAGER_ERROR_LOCKED bins at a time
+ * under the unnamed omp critical section that CRITICAL accumulation bins
+ * under, so it may run while other threads bin into such a table, but not
+ * into one accumulating in any other mode. */
+int table_manager_data_rel_error_step(const struct TableManagerData * data,
+                                      struct TableManagerErrorScan * scan,
+                                      double quantile, double * error) {
+    if (!data || !scan || !error || !(quantile > 0.0 && quantile <= 1.0)) {
+        fprintf(stderr, "TableManager ERROR: The relative error needs a table and a quantile in (0, 1].\n");
+        return -1;
+    }
+    size_t cells = (size_t) data->recorders * (size_t) data->bins;
+    size_t idx = scan->next;
+    int visited = 0;
+    while (idx < cells && visited < TABLE_MANAGER_ERROR_CHUNK) {
+        /* Binning threads get the lock back every TABLE_MANAGER_ERROR_LOCKED bins. */
+        int end = visited + TABLE_MANAGER_ERROR_LOCKED;
+        #pragma omp critical
+        for (; idx < cells && visited < end; ++visited) {
+            if (data->blocks && !data->blocks[idx / TABLE_MANAGER_SPARSE_BLOCK]) {
+                idx = (idx / TABLE_MANAGER_SPARSE_BLOCK + 1) * TABLE_MANAGER_SPARSE_BLOCK;
+                continue;
+            }
+            struct TableManagerBin bin = {0};
+            _table_manager_data_bin_add(data, idx++, &bin);
+            if (!bin.n || !(bin.p1 > 0.0))
+                continue;
+            double e = sqrt(bin.p2) / bin.p1;
+            if (e > scan->largest)
+                scan->largest = e;
+            scan->p1[_table_manager_error_bucket(e)] += bin.p1;
+        }
+    }
+    scan->next = idx;
+    if (idx < cells)
+        return 0;
+
+    double total = 0.0;
+    for (int b = 0; b < TABLE_MANAGER_ERROR_BUCKETS; ++b)
+        total += scan->p1[b];
+    *error = total > 0.0 ? scan->largest : INFINITY;
+    if (total > 0.0 && quantile < 1.0) {
+        double target = quantile * total, sum = 0.0;
+        for (int b = 0; b < TABLE_MANAGER_ERROR_BUCKETS; ++b) {
+            sum += scan->p1[b];
+            if (sum >= target) {
+                double upper = exp2((double) (b - 191) / 8.0);
+                if (upper < *error)
+                    *error = upper;
+                break;
+            }
+        }
+    }
+    memset(scan, 0, sizeof(*scan));
+    return 1;
+}
+
+/* Allocates an empty table binned like data: the same recorders, bins,
+ * binning and windows, in the same layout, with CRITICAL accumulation. */
+struct TableManagerData * table_manager_data_alloc_like(const struct TableManagerData * data) {
+    if (!data)
+        return NULL;
+    struct TableManagerData * copy =
+        table_manager_data_alloc_layout(data->recorders, data->bins, data->t_min, data->t_max,
+                                        data->layout);
+    if (!copy)
+        return NULL;
+    memcpy(copy->r_min, data->r_min, (size_t) data->recorders * sizeof(double));
+    memcpy(copy->r_max, data->r_max, (size_t) data->recorders * sizeof(double));
+    /* set_binning recomputes the scales of the copied windows. */
+    if (table_manager_data_set_binning(copy, data->binning, data->edges) != 0) {
+        table_manager_data_free(copy);
+        return NULL;
+    }
+    return copy;
+}
+
+/* Adds the accumulated sums of src (a table of an independent run) into dst,
+ * leaving src as it is.  Both tables must have the same recorders, bins,
+ * binning and windows, and be reduced (table_manager_data_reduce), since
+ * only the shared storage is read and written; the layouts may differ. */
+int table_manager_data_merge(struct TableManagerData * dst,
+                             const struct TableManagerData * src) {
+    if (!dst || !src) {
+        fprintf(stderr, "TableManager ERROR: Cannot merge a missing table.\n");
+        return -1;
+    }
+    if (dst->recorders != src->recorders || dst->bins != src->bins) {
+        fprintf(stderr, "TableManager ERROR: Cannot merge a table of %d recorders x %d bins "
+                        "into one of %d x %d.\n",
+                src->recorders, src->bins, dst->recorders, dst->bins);
+        return -1;
+    }
+    int same = dst->binning == src->binning;
+    for (int i = 0; same && i < dst->recorders; ++i)
+        same = dst->r_min[i] == src->r_min[i] && dst->r_max[i] == src->r_max[i];
+    for (int i = 0; same && dst->edges && i <= dst->bins; ++i)
+        same = dst->edges[i] == src->edges[i];
+    if (!same) {
+        fprintf(stderr, "TableManager ERROR: Cannot merge tables with different time bins.\n");
+        return -1;
+    }
+    if (_table_manager_data_dense(dst) != 0)
+        return -1;
+    for (int r = 0; r < dst->recorders; ++r) {
+        dst->clip_low[r]  += src->clip_low[r];
+        dst->clip_high[r] += src->clip_high[r];
+    }
+    size_t cells = (size_t) dst->recorders * (size_t) dst->bins;
+    for (size_t idx = 0; idx < cells; ++idx) {
+        struct TableManagerBin bin;
+        if (src->blocks) {
+            /* Skip whole blocks src never hit. */
+            const struct TableManagerBin * block = src->blocks[idx / TABLE_MANAGER_SPARSE_BLOCK];
+            if (!block) {
+                idx += TABLE_MANAGER_SPARSE_BLOCK - 1 - idx % TABLE_MANAGER_SPARSE_BLOCK;
+                continue;
+            }
+            bin = block[idx % TABLE_MANAGER_SPARSE_BLOCK];
+        } else {
+            table_manager_data_get_bin(src, (int) (idx / (size_t) src->bins),
+                                       (int) (idx % (size_t) src->bins), &bin);
+        }
+        if (!bin.n && bin.p1 == 0.0)
+            continue;
+        if (dst->blocks) {
+            struct TableManagerBin * cell = _table_manager_data_sparse_cell(dst, idx);
+            if (!cell)
+                return -1;
+            cell->tp += bin.tp;
+            cell->p1 += bin.p1;
+            cell->p2 += bin.p2;
+            cell->n  += bin.n;
+        } else {
+            dst->tp[idx] += bin.tp;
+            dst->p1[idx] += bin.p1;
+            dst->p2[idx] += bin.p2;
+            dst->n[idx]  += bin.n;
+        }
+    }
+    return 0;
+}
+
+#ifdef USE_MPI
+/* ---------------------------------------------------------------------------
+ * MPI reduction
+ * ------------------------------------------------------------------------- */
+
+/* MPI_Reduce with MPI_SUM, in pieces small enough for an int count. */
+static int _table_manager_mpi_sum(const void * send, void * recv, size_t count,
+                                  MPI_Datatype type, int root, MPI_Comm comm) {
+    int size;
+    MPI_Type_size(type, &size);
+    const size_t piece = (size_t) 1 << 30;
+    for (size_t done = 0; done < count; done += piece) {
+        int n = (int) (count - done < piece ? count - done : piece);
+        if (MPI_Reduce((const char *) send + done * (size_t) size,
+                       recv ? (char *) recv + done * (size_t) size : NULL,
+                       n, type, MPI_SUM, root, comm) != MPI_SUCCESS)
+            return -1;
+    }
+    return 0;
+}
+
+/* 1 on every rank if all ranks passed a non-zero ok, else 0. */
+static int _table_manager_mpi_all(int ok, MPI_Comm comm) {
+    int all = 0;
+    MPI_Allreduce(&ok, &all, 1, MPI_INT, MPI_MIN, comm);
+    return all;
+}
+
+/* 1 if every rank of comm holds the same n values; a rank passing NULL
+ * (after a failed allocation) makes all of them return 0. */
+static int _table_manager_mpi_agree(const double * values, int n, MPI_Comm comm) {
+    double * bounds = values ? (double *) malloc(2 * (size_t) (n > 0 ? n : 1) * sizeof(double)) : NULL;
+    if (!_table_manager_mpi_all(bounds != NULL, comm)) {
+        free(bounds);
+        return 0;
+    }
+    /* The maxima of x and -x match x everywhere only if all ranks agree. */
+    for (int i = 0; i < n; ++i) {
+        bounds[i] = values[i];
+        bounds[n + i] = -values[i];
+    }
+    MPI_Allreduce(MPI_IN_PLACE, bounds, 2 * n, MPI_DOUBLE, MPI_MAX, comm);
+    int agree = 1;
+    for (int i = 0; i < n; ++i)
+        agree = agree && bounds[i] == values[i] && bounds[n + i] == -values[i];
+    free(bounds);
+    return _table_manager_mpi_all(agree, comm);
+}
+
+/* Sums the sparse blocks of every rank into sum (on root).  Only blocks that
+ * some rank has allocated travel, packed back to back. */
+static int _table_manager_mpi_sum_blocks(const struct TableManagerData * data,
+                                         struct TableManagerData * sum,
+                                         int root, MPI_Comm comm) {
+    size_t n_blocks = data->n_blocks;
+    unsigned char * present = (unsigned char *) calloc(n_blocks ? n_blocks : 1, 1);
+    if (!_table_manager_mpi_all(present != NULL, comm)) {
+        free(present);
+        return -1;
+    }
+    for (size_t b = 0; b < n_blocks; ++b)
+        present[b] = data->blocks[b] != NULL;
+    const size_t piece = (size_t) 1 << 30;
+    for (size_t done = 0; done < n_blocks; done += piece)
+        MPI_Allreduce(MPI_IN_PLACE, present + done,
+                      (int) (n_blocks - done < piece ? n_blocks - done : piece),
+                      MPI_UNSIGNED_CHAR, MPI_MAX, comm);
+    size_t used = 0;
+    for (size_t b = 0; b < n_blocks; ++b)
+        used += present[b];
+
+    const size_t k = TABLE_MANAGER_SPARSE_BLOCK;
+    size_t values = used * k;
+    double * sums = (double *) calloc(3 * values + 1, sizeof(double));
+    int * counts = (int *) calloc(values + 1, sizeof(int));
+    double * total_sums = sum ? (double *) malloc((3 * values + 1) * sizeof(double)) : NULL;
+    int * total_counts = sum ? (int *) malloc((values + 1) * sizeof(int)) : NULL;
+    int ok = sums && counts && (!sum || (total_sums && total_counts));
+    if (_table_manager_mpi_all(ok, comm)) {
+        /* tp, p1 and p2 of the packed blocks, one after the other. */
+        size_t j = 0;
+        for (size_t b = 0; b < n_blocks; ++b) {
+            if (!present[b])
+                continue;
+            const struct TableManagerBin * block = data->blocks[b];
+            for (size_t i = 0; block && i < k; ++i) {
+                sums[j * k + i] = block[i].tp;
+                sums[values + j * k + i] = block[i].p1;
+                sums[2 * values + j * k + i] = block[i].p2;
+                counts[j * k + i] = block[i].n;
+            }
+            ++j;
+        }
+        ok = _table_manager_mpi_sum(sums, total_sums, 3 * values, MPI_DOUBLE, root, comm) == 0 &&
+             _table_manager_mpi_sum(counts, total_counts, values, MPI_INT, root, comm) == 0;
+        j = 0;
+        for (size_t b = 0; ok && sum && b < n_blocks; ++b) {
+            if (!present[b])
+                continue;
+            struct TableManagerBin * block = _table_manager_data_sparse_cell(sum, b * k);
+            ok = block != NULL;
+            for (size_t i = 0; ok && i < k; ++i) {
+                block[i].tp = total_sums[j * k + i];
+                block[i].p1 = total_sums[values + j * k + i];
+                block[i].p2 = total_sums[2 * values + j * k + i];
+                block[i].n  = total_counts[j * k + i];
+            }
+            ++j;
+        }
+    } else {
+        ok = 0;
+    }
+    free(present);
+    free(sums);
+    free(counts);
+    free(total_sums);
+    free(total_counts);
+    return ok ? 0 : -1;
+}
+
+/* Sums the tables of all ranks of comm into a new table on root, returned in
+ * *total (NULL on the other ranks).  The tables themselves are left as they
+ * are, so repeated SAVEs never count a particle twice.  Collective: every
+ * rank calls this after table_manager_data_reduce, with a table binned the
+ * same way as on the other ranks; otherwise every rank gets -1. */
+int table_manager_data_mpi_reduce(const struct TableManagerData * data,
+                                  struct TableManagerData ** total,
+                                  int root, MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    *total = NULL;
+    double shape[4] = {-1.0, -1.0, -1.0, -1.0};
+    if (data) {
+        shape[0] = data->recorders;
+        shape[1] = data->bins;
+        shape[2] = data->binning;
+        shape[3] = data->blocks != NULL;
+    }
+    if (!_table_manager_mpi_agree(shape, 4, comm) || !data) {
+        if (rank == root)
+            fprintf(stderr, "TableManager ERROR: The MPI ranks hold tables of different shapes, which cannot be summed.\n");
+        return -1;
+    }
+
+    /* Same shape everywhere, so the same number of window values too. */
+    int nr = data->recorders;
+    int n_edges = data->edges ? data->bins + 1 : 0;
+    double * windows = (double *) malloc((2 * (size_t) nr + (size_t) n_edges + 1) * sizeof(double));
+    if (windows) {
+        memcpy(windows, data->r_min, (size_t) nr * sizeof(double));
+        memcpy(windows + nr, data->r_max, (size_t) nr * sizeof(double));
+        if (n_edges)
+            memcpy(windows + 2 * nr, data->edges, (size_t) n_edges * sizeof(double));
+    }
+    int agree = _table_manager_mpi_agree(windows, 2 * nr + n_edges, comm);
+    free(windows);
+    if (!agree) {
+        if (rank == root)
+            fprintf(stderr, "TableManager ERROR: The MPI ranks binned over different time windows "
+                            "(automatic time ranges?), which cannot be summed.\n");
+        return -1;
+    }
+
+    if (!_table_manager_mpi_all(data->blocks || data->tp, comm)) {
+        if (rank == root)
+            fprintf(stderr, "TableManager ERROR: Tables must be reduced before they are summed over MPI ranks.\n");
+        return -1;
+    }
+    struct TableManagerData * sum = rank == root ? table_manager_data_alloc_like(data) : NULL;
+    if (sum && _table_manager_data_dense(sum) != 0) {
+        table_manager_data_free(sum);
+        sum = NULL;
+    }
+    if (!_table_manager_mpi_all(rank != root || sum, comm)) {
+        if (rank == root)
+            fprintf(stderr, "TableManager ERROR: Failed to allocate memory for the table summed over MPI ranks.\n");
+        table_manager_data_free(sum);
+        return -1;
+    }
+    size_t cells = (size_t) nr * (size_t) data->bins;
+    int ok = _table_manager_mpi_sum(data->clip_low, sum ? sum->clip_low : NULL, (size_t) nr,
+                                    MPI_LONG_LONG, root, comm) == 0 &&
+             _table_manager_mpi_sum(data->clip_high, sum ? sum->clip_high : NULL, (size_t) nr,
+                                    MPI_LONG_LONG, root, comm) == 0;
+    if (ok && data->blocks)
+        ok = _table_manager_mpi_sum_blocks(data, sum, root, comm) == 0;
+    else if (ok)
+        ok = _table_manager_mpi_sum(data->tp, sum ? sum->tp : NULL, cells, MPI_DOUBLE, root, comm) == 0 &&
+             _table_manager_mpi_sum(data->p1, sum ? sum->p1 : NULL, cells, MPI_DOUBLE, root, comm) == 0 &&
+             _table_manager_mpi_sum(data->p2, sum ? sum->p2 : NULL, cells, MPI_DOUBLE, root, comm) == 0 &&
+             _table_manager_mpi_sum(data->n, sum ? sum->n : NULL, cells, MPI_INT, root, comm) == 0;
+    if (!_table_manager_mpi_all(ok, comm)) {
+        if (rank == root)
+            fprintf(stderr, "TableManager ERROR: Failed to sum the tables of the MPI ranks.\n");
+        table_manager_data_free(sum);
+        return -1;
+    }
+    *total = sum;
+    return 0;
+}
+
+/* Returns "<filename>.rank<rank>" in a new allocation, for the files that
+ * every rank writes on its own; NULL if the allocation fails. */
+char * table_manager_mpi_rank_filename(const char * filename, int rank) {
+    size_t size = strlen(filename) + 32;
+    char * name = (char *) malloc(size);
+    if (!name) {
+        fprintf(stderr, "TableManager ERROR: Failed to allocate memory for a file name.\n");
+        return NULL;
+    }
+    snprintf(name, size, "%s.rank%d", filename, rank);
+    return name;
+}
+#endif /* USE_MPI */
+
+/* ---------------------------------------------------------------------------
+ * Contexts
+ * ------------------------------------------------------------------------- */
+
+/* Allocates a context: a state of its own, outside every table group, for
+ * the table_manager_ctx_* functions.  Separate contexts (and their tables)
+ * can be used concurrently; what they share is listed in tof-table-lib.h.
+ * n_threads is the
+ * number of threads that will record into it, numbered with
+ * table_manager_thread_bind; 0 sizes it for OpenMP's thread count. */
+struct TableManagerState * table_manager_ctx_alloc(int n_threads) {
+    struct TableManagerState * state = _table_manager_state_alloc();
+    if (state)
+        state->max_threads = n_threads > 0 ? n_threads : 0;
+    return state;
+}
+
+void table_manager_ctx_free(struct TableManagerState * state) {
+    _table_manager_state_free(state);
+}
+
+/* Gives the calling thread the number index in 0 .. n_threads - 1, which
+ * picks its particle pool, table slab, event ring and sample reservoir, in
+ * place of its OpenMP thread number; index -1 goes back to the latter.
+ * Threads not started by OpenMP all count as thread 0 unless bound, so
+ * every such thread that calls into the library must be given its own
+ * number. */
+void table_manager_thread_bind(int index) {
+    _tof_table_manager_thread = index < 0 ? -1 : index;
+}
+
+/* ---------------------------------------------------------------------------
+ * Table groups
+ * ------------------------------------------------------------------------- */
+
+/* Returns the group called name (NULL or "" for the default group), creating
+ * it on first use; NULL only if that allocation fails.  Not thread-safe: look
+ * groups up at INITIALIZE time and keep the handle. */
+struct TableManagerGroup * table_manager_group(const char * name) {
+    if (!name)
+        name = "";
+    struct TableManagerGroup * group = _tof_table_manager_groups;
+    for (; group; group = group->next)
+        if (!strcmp(group->name, name))
+            return group;
+    group = (struct TableManagerGroup *) malloc(sizeof(struct TableManagerGroup));
+    char * copy = (char *) malloc(strlen(name) + 1);
+    if (!group || !copy) {
+        fprintf(stderr, "TableManager ERROR: Failed to allocate memory for table group '%s'.\n", name);
+        free(group);
+        free(copy);
+        return NULL;
+    }
+    strcpy(copy, name);
+    group->name = copy;
+    group->state = NULL;
+    group->next = _tof_table_manager_groups;
+    _tof_table_manager_groups = group;
+    if (!name[0])
+        _tof_table_manager_default = group;
+    return group;
+}
+
+/* Makes every table_manager_state_* and table_manager_particle_* call of the
+ * calling thread work on group; NULL selects the default group.  A thread
+ * starts on the default group. */
+void table_manager_group_select(struct TableManagerGroup * group) {
+    _tof_table_manager_group = group;
+}
+
+/* The group of the calling thread; NULL if the default group is needed and
+ * cannot be created. */
+static struct TableManagerGroup * _table_manager_group(void) {
+    return _tof_table_manager_group ? _tof_table_manager_group : table_manager_group(NULL);
+}
+
+/* The number of groups that have a state. */
+static int _table_manager_group_states(void) {
+    int count = 0;
+    for (struct TableManagerGroup * group = _tof_table_manager_groups; group; group = group->next)
+        count += group->state != NULL;
+    return count;
+}
+
+/* The state of the calling thread's group, or NULL if it has none. */
+static inline struct TableManagerState * _table_manager_state(void) {
+    struct TableManagerGroup * group =
+        _tof_table_manager_group ? _tof_table_manager_group : _tof_table_manager_default;
+    return group ? group->state : NULL;
+}
+
+/* ---------------------------------------------------------------------------
+ * Global state lifetime
+ * ------------------------------------------------------------------------- */
+
+void table_manager_state_alloc(void) {
+    struct TableManagerGroup * group = _table_manager_group();
+    if (!group)
+        return;
+    if (group->state) {
+        fprintf(stderr, "TableManager ERROR: global state is already allocated.\n");
+        return;
+    }
+    group->state = _table_manager_state_alloc();
+    if (!group->state) {
+        fprintf(stderr, "TableManager ERROR: Failed to allocate global state.\n");
+    }
+}
+
+void table_manager_state_free(void) {
+    struct TableManagerGroup * group =
+        _tof_table_manager_group ? _tof_table_manager_group : _tof_table_manager_default;
+    if (!group)
+        return;
+    _table_manager_state_free(group->state);
+    group->state = NULL;
+}
+
+int table_manager_state_exists(void) {
+    return _table_manager_state() != NULL;
+}
+
+int table_manager_ctx_n_recorders(struct TableManagerState * state) {
+    return state ? state->n_recorders : 0;
+}
+
+int table_manager_ctx_add_recorder(struct TableManagerState * state, const char * name,
+                                   double distance) {
+    if (!state) {
+        fprintf(stderr, "TableManager ERROR: state must be allocated by TableSetup before adding recorders.\n");
+        return -1;
+    }
+    struct TableManagerLinkedListNode * node =
+        (struct TableManagerLinkedListNode *) malloc(sizeof(struct TableManagerLinkedListNode));
+    if (!node) {
+        fprintf(stderr, "TableManager ERROR: Failed to allocate memory for new recorder linked list node.\n");
+        return -1;
+    }
+    node->name = (char *) malloc(strlen(name) + 1);
+    if (!node->name) {
+        fprintf(stderr, "TableManager ERROR: Failed to allocate memory for new recorder name string.\n");
+        free(node);
+        return -1;
+    }
+    strcpy(node->name, name);
+    node->distance = distance;
+    node->has_window = 0;
+    node->t_min = 0.0;
+    node->t_max = 0.0;
+    node->next = NULL;
+    struct TableManagerLinkedListNode * tail = state->recorders.tail;
+    if (tail) {
+        tail->next = node;
+    } else {
+        state->recorders.head = node;
+    }
+    state->recorders.tail = node;
+    return state->n_recorders++;
+}
+
+int table_manager_ctx_set_recorder_window(struct TableManagerState * state,
+                                          int recorder_index, double t_min, double t_max) {
+    if (!state) {
+        fprintf(stderr, "TableManager ERROR: state must be allocated by TableSetup before setting recorder windows.\n");
+        return -1;
+    }
+    if (!(t_max > t_min)) {
+        fprintf(stderr, "TableManager ERROR: Time window [%g, %g) of recorder %d is empty.\n",
+                t_min, t_max, recorder_index);
+        return -1;
+    }
+    struct TableManagerLinkedListNode * node = state->recorders.head;
+    for (int i = 0; node && i < recorder_index; ++i)
+        node = node->next;
+    if (recorder_index < 0 || !node) {
+        fprintf(stderr, "TableManager ERROR: No recorder with index %d.\n", recorder_index);
+        return -1;
+    }
+    node->has_window = 1;
+    node->t_min = t_min;
+    node->t_max = t_max;
+    return 0;
+}
+
+/* Copies the windows set on the recorders of the state into data; recorders
+ * without one keep the table-wide window. */
+int table_manager_ctx_apply_windows(struct TableManagerState * state,
+                                    struct TableManagerData * data) {
+    if (!state || !data) {
+        fprintf(stderr, "TableManager ERROR: state and table must exist to apply recorder windows.\n");
+        return -1;
+    }
+    struct TableManagerLinkedListNode * node = state->recorders.head;
+    for (int i = 0; node && i < data->recorders; ++i, node = node->next)
+        if (node->has_window && table_manager_data_set_window(data, i, node->t_min, node->t_max) != 0)
+            return -1;
+    return 0;
+}
+
+/* Makes table_manager_particle_cull test rays against the windows of data,
+ * which must have one recorder per recorder of the state and outlive its
+ * use; NULL turns culling off.  Set it only when data is the sole output
+ * fed from the rays: a culled ray is absorbed, so it reaches no event file,
+ * sampler or other monitor downstream, nor the tables of other states.  The
+ * group API (table_manager_particle_cull) hence never culls while more than
+ * one table group has a state. */
+int table_manager_ctx_set_cull_table(struct TableManagerState * state,
+                                     const struct TableManagerData * data) {
+    if (!state) {
+        fprintf(stderr, "TableManager ERROR: state must exist to set up culling.\n");
+        return -1;
+    }
+    free(state->cull_distance);
+    state->cull_distance = NULL;
+    state->cull_table = NULL;
+    if (!data)
+        return 0;
+    if (data->recorders != state->n_recorders) {
+        fprintf(stderr, "TableManager ERROR: Culling table has %d recorders, the state %d.\n",
+                data->recorders, state->n_recorders);
+        return -1;
+    }
+    state->cull_distance = (double *) malloc((size_t) (data->recorders > 0 ? data->recorders : 1) * sizeof(double));
+    if (!state->cull_distance) {
+        fprintf(stderr, "TableManager ERROR: Failed to allocate memory for the culling distances.\n");
+        return -1;
+    }
+    struct TableManagerLinkedListNode * node = state->recorders.head;
+    for (int i = 0; node && i < data->recorders; ++i, node = node->next)
+        state->cull_distance[i] = node->distance;
+    state->cull_table = data;
+    return 0;
+}
+
+/* Prints, for every recorder that had hits outside its time window, how
+ * many fell before and after it.  Returns the total number of such hits. */
+long long table_manager_ctx_report_clipping(struct TableManagerState * state,
+                                            const struct TableManagerData * data) {
+    if (!state || !data)
+        return 0;
+    long long total = 0;
+    struct TableManagerLinkedListNode * node = state->recorders.head;
+    for (int i = 0; node && i < data->recorders; ++i, node = node->next) {
+        if (!data->clip_low[i] && !data->clip_high[i])
+            continue;
+        printf("TableManager: recorder %s dropped %lld hits before and %lld after its time window [%g, %g).\n",
+               node->name, data->clip_low[i], data->clip_high[i], data->r_min[i], data->r_max[i]);
+        total += data->clip_low[i] + data->clip_high[i];
+    }
+    return total;
+}
+
+void table_manager_ctx_finalize(struct TableManagerState * state, int manager_index,
+                                const char * t_name, const char * p_name,
+                                const char * n_name, const char * z_name) {
+    if (!state) {
+        fprintf(stderr, "TableManager ERROR: state must be allocated by TableSetup before finalizing.\n");
+        return;
+    }
+    /* Build suffixed names (e.g. "table_manager_t_9"), resolve their byte
+     * offsets in _struct_particle via a one-shot particle_getvar_void call,
+     * then discard the strings.  Hot-path accessors use the offsets directly
+     * and never call particle_getvar_void at TRACE time. */
+    char * tname = _build_suffixed_name(t_name, manager_index);
+    char * pname = _build_suffixed_name(p_name, manager_index);
+    char * nname = _build_suffixed_name(n_name, manager_index);
+    char * zname = _build_suffixed_name(z_name, manager_index);
+    if (!tname || !pname || !nname || !zname) {
+        free(tname); free(pname); free(nname); free(zname);
+        return;
+    }
+    _class_particle dummy = {0};
+    int s_t = 1, s_p = 1, s_n = 1, s_z = 1;
+    void * t_ptr = particle_getvar_void(&dummy, tname, &s_t);
+    void * p_ptr = particle_getvar_void(&dummy, pname, &s_p);
+    void * n_ptr = particle_getvar_void(&dummy, nname, &s_n);
+    void * z_ptr = particle_getvar_void(&dummy, zname, &s_z);
+    free(tname); free(pname); free(nname); free(zname);
+    if (s_t != 0 || s_p != 0 || s_n != 0 || s_z != 0 || !t_ptr || !p_ptr || !n_ptr || !z_ptr) {
+        fprintf(stderr, "TableManager ERROR: Failed to resolve particle field offsets for manager index %d.\n",
+                manager_index);
+        return;
+    }
+#ifdef TOF_TABLE_MAX_RECORDERS
+    char old_name[] = TABLE_MANAGER_INLINE_OLD_NAME;
+    int s_old = 1;
+    if (particle_getvar_void(&dummy, old_name, &s_old) && s_old == 0) {
+        fprintf(stderr, "TableManager ERROR: USERVARS declares %s, sized for t and p only; "
+                        "declare double %s[2 * N + (N + 63) / 64] instead.\n",
+                TABLE_MANAGER_INLINE_OLD_NAME, TABLE_MANAGER_INLINE_NAME);
+        return;
+    }
+#endif
+    state->t_offset = (ptrdiff_t)((char *)t_ptr - (char *)&dummy);
+    state->p_offset = (ptrdiff_t)((char *)p_ptr - (char *)&dummy);
+    state->n_offset = (ptrdiff_t)((char *)n_ptr - (char *)&dummy);
+    state->z_offset = (ptrdiff_t)((char *)z_ptr - (char *)&dummy);
+    state->offsets_set = 1;
+
+#ifdef TOF_TABLE_MAX_RECORDERS
+    /* Prefer the instrument-level inline array when it is declared and large
+     * enough; the heap pools are then never used. */
+    char inline_name[] = TABLE_MANAGER_INLINE_NAME;
+    int s_i = 1;
+    void * i_ptr = particle_getvar_void(&dummy, inline_name, &s_i);
+    /* There is one inline array per particle, so only one state can use it;
+     * contexts may be finalised on different threads. */
+    int use_inline = 0, too_many = 0;
+    if (s_i == 0 && i_ptr) {
+        #pragma omp critical (table_manager_inline)
+        if (!_tof_table_manager_inline_owner || _tof_table_manager_inline_owner == state) {
+            if (state->n_recorders <= TOF_TABLE_MAX_RECORDERS)
+                _tof_table_manager_inline_owner = state;
+            use_inline = state->n_recorders <= TOF_TABLE_MAX_RECORDERS;
+            too_many = !use_inline;
+        }
+    }
+    if (use_inline) {
+        state->inline_offset = (ptrdiff_t)((char *)i_ptr - (char *)&dummy);
+        state->inline_set = 1;
+        return;
+    }
+    if (too_many) {
+        fprintf(stderr, "TableManager WARNING: %d recorders exceed TOF_TABLE_MAX_RECORDERS=%d; using heap storage.\n",
+                state->n_recorders, TOF_TABLE_MAX_RECORDERS);
+    }
+#endif
+
+    /* The recorder count is final once the manager is initialised, so the
+     * per-thread pools can be sized for it now. */
+    if (!state->pools && state->n_recorders > 0) {
+        int n_pools = state->max_threads > 0 ? state->max_threads : _table_manager_max_threads();
+        /* calloc + manual alignment: aligned_alloc is not available on MSVC */
+        state->pools_mem = calloc((size_t) n_pools * sizeof(struct TableManagerPool) + 63, 1);
+        if (!state->pools_mem) {
+            fprintf(stderr, "TableManager ERROR: Failed to allocate per-thread particle pools; falling back to malloc.\n");
+            return;
+        }
+        state->pools = (struct TableManagerPool *) (((uintptr_t) state->pools_mem + 63) & ~(uintptr_t) 63);
+        for (int i = 0; i < n_pools; ++i) {
+            struct TableManagerPool * pool = &state->pools[i];
+            pool->live.next = &pool->live;
+            pool->live.prev = &pool->live;
+        }
+        state->n_pools = n_pools;
+        state->block_recorders = state->n_recorders;
+    }
+}
+
+/* Sums the per-thread pool counters.  In steady state every particle block is
+ * a hit; misses count the blocks that had to be taken from the heap and
+ * reclaimed those recovered from absorbed particles. */
+void table_manager_ctx_pool_stats(struct TableManagerState * state, long long * hits,
+                                  long long * misses, long long * reclaimed) {
+    long long h = 0, m = 0, r = 0;
+    if (state) {
+        for (int i = 0; i < state->n_pools; ++i) {
+            h += state->pools[i].hits;
+            m += state->pools[i].misses;
+            r += state->pools[i].reclaimed;
+        }
+    }
+    if (hits)
+        *hits = h;
+    if (misses)
+        *misses = m;
+    if (reclaimed)
+        *reclaimed = r;
+}
+
+/* Returns every block still live on the calling thread to its free list and
+ * reports how many there were.
+ *
+ * Policy for absorbed particles: a particle absorbed between its first
+ * TableRecorder and the TableManager never has its storage freed.  McStas
+ * traces one particle per thread at a time, so when TableSetup starts the
+ * next particle on a thread, every block that thread handed out earlier
+ * belongs to a particle that has already ended; TableSetup therefore calls
+ * this before table_manager_particle_alloc.  Code that keeps several particles
+ * in flight on one thread must only call it between batches. */
+int table_manager_ctx_reclaim(struct TableManagerState * state) {
+    int thread = _table_manager_thread_num();
+    if (!state || thread >= state->n_pools)
+        return 0;
+    struct TableManagerPool * pool = &state->pools[thread];
+    int count = 0;
+    while (pool->live.next != &pool->live) {
+        struct TableManagerBlock * block = pool->live.next;
+        pool->live.next = block->next;
+        block->next = pool->free_list;
+        block->prev = NULL;
+        pool->free_list = block;
+        ++count;
+    }
+    pool->live.prev = &pool->live;
+    pool->reclaimed += count;
+    return count;
+}
+
+/* ---------------------------------------------------------------------------
+ * Per-particle accessors
+ * ------------------------------------------------------------------------- */
+
+double ** table_manager_ctx_particle_t_array_ptr(struct TableManagerState * state,
+                                                 _class_particle * p) {
+    if (!state || !state->offsets_set) {
+        fprintf(stderr, "TableManager ERROR: state must be allocated and finalized before accessing the t array.\n");
+        return NULL;
+    }
+    return (double **)((char *)p + state->t_offset);
+}
+
+double ** table_manager_ctx_particle_p_array_ptr(struct TableManagerState * state,
+                                                 _class_particle * p) {
+    if (!state || !state->offsets_set) {
+        fprintf(stderr, "TableManager ERROR: state must be allocated and finalized before accessing the p array.\n");
+        return NULL;
+    }
+    return (double **)((char *)p + state->p_offset);
+}
+
+int * table_manager_ctx_particle_n_ptr(struct TableManagerState * state,
+                                       _class_particle * p) {
+    if (!state || !state->offsets_set) {
+        fprintf(stderr, "TableManager ERROR: state must be allocated and finalized before accessing the n array.\n");
+        return NULL;
+    }
+    return (int *)((char *)p + state->n_offset);
+}
+
+/* Resolves the storage behind a particle's t array, p array and hit mask,
+ * which is either the inline array or the heap block, together with its size
+ * field.  The arrays are NULL for a particle without heap storage.
+ * Returns -1 when the state has not been finalised. */
+static int _table_manager_particle_arrays(struct TableManagerState * state,
+                                          _class_particle * p, double ** tof_t,
+                                          double ** tof_p, double ** tof_h,
+                                          int ** tof_n) {
+    if (!state || !state->offsets_set)
+        return -1;
+    *tof_n = (int *)((char *)p + state->n_offset);
+#ifdef TOF_TABLE_MAX_RECORDERS
+    if (state->inline_set) {
+        *tof_t = (double *)((char *)p + state->inline_offset);
+        *tof_p = *tof_t + TOF_TABLE_MAX_RECORDERS;
+        *tof_h = *tof_t + 2 * TOF_TABLE_MAX_RECORDERS;
+        return 0;
+    }
+#endif
+    *tof_t = *(double **)((char *)p + state->t_offset);
+    *tof_p = *(double **)((char *)p + state->p_offset);
+    *tof_h = *tof_t ? *tof_t + 2 * **tof_n : NULL;
+    return 0;
+}
+
+/* The particle's recorded times, wherever they are stored; NULL until the
+ * first table_manager_particle_record has given the particle its arrays. */
+double * table_manager_ctx_particle_t_array(struct TableManagerState * state,
+                                            _class_particle * p) {
+    double * tof_t, * tof_p, * tof_h;
+    int * tof_n;
+    if (_table_manager_particle_arrays(state, p, &tof_t, &tof_p, &tof_h, &tof_n) != 0 || *tof_n == 0)
+        return NULL;
+    return tof_t;
+}
+
+/* The particle's recorded probabilities; see table_manager_particle_t_array. */
+double * table_manager_ctx_particle_p_array(struct TableManagerState * state,
+                                            _class_particle * p) {
+    double * tof_t, * tof_p, * tof_h;
+    int * tof_n;
+    if (_table_manager_particle_arrays(state, p, &tof_t, &tof_p, &tof_h, &tof_n) != 0 || *tof_n == 0)
+        return NULL;
+    return tof_p;
+}
+
+/* ---------------------------------------------------------------------------
+ * Per-particle operations
+ * ------------------------------------------------------------------------- */
+
+/* Prepares p for a new trace: remembers t_zero and leaves the particle
+ * without storage.  Storage is materialised by the first
+ * table_manager_particle_record, so a particle absorbed before reaching any
+ * TableRecorder never touches it. */
+void table_manager_ctx_particle_alloc(struct TableManagerState * state,
+                                      _class_particle * p, double t_zero) {
+    double ** tof_t_ptr = table_manager_ctx_particle_t_array_ptr(state, p);
+    double ** tof_p_ptr = table_manager_ctx_particle_p_array_ptr(state, p);
+    int *     tof_n_ptr = table_manager_ctx_particle_n_ptr(state, p);
+    if (!tof_t_ptr || !tof_p_ptr || !tof_n_ptr) {
+        fprintf(stderr, "TableManager ERROR: Failed to access per-particle time or probability arrays for allocation.\n");
+        return;
+    }
+    *tof_t_ptr = NULL;
+    *tof_p_ptr = NULL;
+    *tof_n_ptr = 0;
+    *(double *)((char *)p + state->z_offset) = t_zero;
+}
+
+/* Gives p storage for every recorder, with an empty hit mask.  The values of
+ * unrecorded slots are left undefined; the hit mask tells them apart. */
+static int _table_manager_particle_materialize(struct TableManagerState * state,
+                                               _class_particle * p) {
+    int n = state->n_recorders;
+    double * tof_h;
+#ifdef TOF_TABLE_MAX_RECORDERS
+    if (state->inline_set) {
+        /* Inline storage: the pointers stay NULL so the particle remains
+         * trivially copyable. */
+        tof_h = (double *)((char *)p + state->inline_offset) + 2 * TOF_TABLE_MAX_RECORDERS;
+    } else
+#endif
+    {
+        double * tof_t = _table_manager_block_get(state, n);
+        if (!tof_t) {
+            fprintf(stderr, "TableManager ERROR: Failed to allocate memory for per-particle time or probability arrays.\n");
+            return -1;
+        }
+        *(double **)((char *)p + state->t_offset) = tof_t;
+        *(double **)((char *)p + state->p_offset) = tof_t + n;
+        tof_h = tof_t + 2 * n;
+    }
+    for (int w = 0; w < TABLE_MANAGER_HIT_WORDS(n); ++w)
+        _table_manager_hits_store(tof_h, w, 0);
+    *(int *)((char *)p + state->n_offset) = n;
+    return 0;
+}
+
+/* Stores the particle's time since its t_zero, plus dt, and its probability
+ * in the recorder_index slot, materialising the particle's storage on first
+ * use.  The state and recorder_index must already be validated. */
+static int _table_manager_particle_store(struct TableManagerState * state,
+                                         _class_particle * p, int recorder_index,
+                                         double dt) {
+    double * tof_t_ptr, * tof_p_ptr, * tof_h_ptr;
+    int *    tof_n_ptr;
+    if (_table_manager_particle_arrays(state, p, &tof_t_ptr, &tof_p_ptr, &tof_h_ptr, &tof_n_ptr) != 0)
+        return -1;
+    if (*tof_n_ptr == 0 &&
+        (_table_manager_particle_materialize(state, p) != 0 ||
+         _table_manager_particle_arrays(state, p, &tof_t_ptr, &tof_p_ptr, &tof_h_ptr, &tof_n_ptr) != 0))
+        return -1;
+    double t_zero = *(double *)((char *)p + state->z_offset);
+    tof_t_ptr[recorder_index] = t_zero + p->t + dt;
+    tof_p_ptr[recorder_index] = p->p;
+    int word = recorder_index / 64;
+    uint64_t bits = _table_manager_hits_load(tof_h_ptr, word);
+    _table_manager_hits_store(tof_h_ptr, word, bits | ((uint64_t) 1 << (recorder_index % 64)));
+    return 0;
+}
+
+static int _table_manager_particle_check_recorder(struct TableManagerState * state,
+                                                  int recorder_index) {
+    if (!state || !state->offsets_set) {
+        fprintf(stderr, "TableManager ERROR: Failed to access per-particle time or probability arrays for recording.\n");
+        return -1;
+    }
+    if (recorder_index < 0 || recorder_index >= state->n_recorders) {
+        fprintf(stderr, "TableManager ERROR: Recorder index out of bounds when recording particle data.\n");
+        return -1;
+    }
+    return 0;
+}
+
+int table_manager_ctx_particle_record(struct TableManagerState * state,
+                                      _class_particle * p, int recorder_index) {
+    if (_table_manager_particle_check_recorder(state, recorder_index) != 0)
+        return -1;
+    return _table_manager_particle_store(state, p, recorder_index, 0.0);
+}
+
+/* Records p at n virtual planes at distances z[i] >= 0 ahead of it along its
+ * flight direction, as if it flew on without scattering or gravity: slot
+ * first_recorder + i gets the time t + z[i] / vz.  The particle itself is
+ * not moved.  A particle with vz <= 0 reaches none of the planes. */
+int table_manager_ctx_particle_record_planes(struct TableManagerState * state,
+                                             _class_particle * p, int first_recorder,
+                                             const double * z, int n, double vz) {
+    if (n <= 0)
+        return 0;
+    if (_table_manager_particle_check_recorder(state, first_recorder) != 0 ||
+        _table_manager_particle_check_recorder(state, first_recorder + n - 1) != 0)
+        return -1;
+    if (!(vz > 0.0))
+        return 0;
+    for (int i = 0; i < n; ++i)
+        if (z[i] >= 0.0 && _table_manager_particle_store(state, p, first_recorder + i, z[i] / vz) != 0)
             return -1;
+    return 0;
+}
+
+/* table_manager_particle_record for count consecutive particles, validating
+ * once. */
+int table_manager_ctx_particles_record(struct TableManagerState * state,
+                                       _class_particle * ps, int count, int recorder_index) {
+    if (_table_manager_particle_check_recorder(state, recorder_index) != 0)
+        return -1;
+    int ret = 0;
+    for (int i = 0; i < count; ++i)
+        if (_table_manager_particle_store(state, &ps[i], recorder_index, 0.0) != 0)
+            ret = -1;
+    return ret;
+}
+
+/* 1 if table_manager_particle_record stored a value for recorder_index since
+ * the particle's arrays were allocated, 0 otherwise. */
+int table_manager_ctx_particle_recorded(struct TableManagerState * state,
+                                        _class_particle * p, int recorder_index) {
+    double * tof_t_ptr, * tof_p_ptr, * tof_h_ptr;
+    int *    tof_n_ptr;
+    if (_table_manager_particle_arrays(state, p, &tof_t_ptr, &tof_p_ptr, &tof_h_ptr, &tof_n_ptr) != 0 ||
+        !tof_h_ptr || recorder_index < 0 || recorder_index >= *tof_n_ptr)
+        return 0;
+    uint64_t bits = _table_manager_hits_load(tof_h_ptr, recorder_index / 64);
+    return (int) ((bits >> (recorder_index % 64)) & 1u);
+}
+
+/* 1 if a particle that just recorded recorder_index can no longer add to
+ * any bin of the culling table: none of its recorded times so far lies in a
+ * recorder's window, and no later recorder (by index) can be reached before
+ * its window ends, given that the particle covers the difference in
+ * distance at no more than v_max (or, for v_max <= 0, only that time does
+ * not run backwards).  0 otherwise, and whenever culling is not set up or
+ * the table is still finding its time range. */
+int table_manager_ctx_particle_cull(struct TableManagerState * state, _class_particle * p,
+                                    int recorder_index, double v_max) {
+    const struct TableManagerData * data = state ? state->cull_table : NULL;
+    if (!data)
+        return 0;
+    int warming;
+    #pragma omp atomic read seq_cst
+    warming = data->warming;
+    if (warming)
+        return 0;
+    double * tof_t_ptr, * tof_p_ptr, * tof_h_ptr;
+    int *    tof_n_ptr;
+    if (_table_manager_particle_arrays(state, p, &tof_t_ptr, &tof_p_ptr, &tof_h_ptr, &tof_n_ptr) != 0 ||
+        !tof_h_ptr || *tof_n_ptr != data->recorders || recorder_index < 0 ||
+        recorder_index >= data->recorders ||
+        !((_table_manager_hits_load(tof_h_ptr, recorder_index / 64) >> (recorder_index % 64)) & 1u))
+        return 0;
+
+    /* Any hit already in a window will be binned. */
+    ptrdiff_t idx[64];
+    double tp[64], p1[64], p2[64];
+    for (int w = 0; w < TABLE_MANAGER_HIT_WORDS(data->recorders); ++w) {
+        uint64_t bits = _table_manager_hits_load(tof_h_ptr, w);
+        if (!bits)
+            continue;
+        int base = w * 64;
+        int m = data->recorders - base < 64 ? data->recorders - base : 64;
+        _table_manager_data_index(data, tof_t_ptr, tof_p_ptr, base, m, idx, tp, p1, p2);
+        for (; bits; bits &= bits - 1)
+            if (idx[_table_manager_ctz64(bits)] >= 0)
+                return 0;
+    }
+
+    /* Earliest arrival at each later recorder against the end of its window. */
+    double t = tof_t_ptr[recorder_index];
+    double d = state->cull_distance[recorder_index];
+    int edges = data->binning == TABLE_MANAGER_BINNING_EDGES;
+    for (int r = recorder_index + 1; r < data->recorders; ++r) {
+        double t_end = edges ? data->edges[data->bins] : data->r_scale[r] > 0.0 ? data->r_max[r] : -INFINITY;
+        double ahead = state->cull_distance[r] - d;
+        double t_arrive = v_max > 0.0 && ahead > 0.0 ? t + ahead / v_max : t;
+        if (t_arrive < t_end)
+            return 0;
+    }
+    return 1;
+}
+
+int table_manager_ctx_particle_to_table(struct TableManagerState * state,
+                                        _class_particle * p,
+                                        struct TableManagerData * data) {
+    double * tof_t_ptr, * tof_p_ptr, * tof_h_ptr;
+    int *    tof_n_ptr;
+    if (_table_manager_particle_arrays(state, p, &tof_t_ptr, &tof_p_ptr, &tof_h_ptr, &tof_n_ptr) != 0) {
+        fprintf(stderr, "TableManager ERROR: Failed to access per-particle time or probability arrays for transfer to table.\n");
+        return -1;
+    }
+    /* A particle that reached no recorder has nothing to add. */
+    if (*tof_n_ptr == 0)
+        return 0;
+    if (*tof_n_ptr != data->recorders) {
+        fprintf(stderr, "TableManager ERROR: Number of recorders in particle data does not match number of recorders in table data during transfer.\n");
+        return -1;
+    }
+    int warming;
+    #pragma omp atomic read seq_cst
+    warming = data->warming;
+    if (warming && _table_manager_data_warmup_push(data, tof_t_ptr, tof_p_ptr, tof_h_ptr))
+        return 0;
+    if (data->accumulation == TABLE_MANAGER_ACCUMULATE_PRIVATE) {
+        /* Threads beyond the slab count (e.g. a nested team) fall back to the
+         * shared arrays below. */
+        int thread = _table_manager_thread_num();
+        if (thread < data->n_slabs) {
+            _table_manager_data_bin(data->slabs[thread], tof_t_ptr, tof_p_ptr, tof_h_ptr, 0);
+            return 0;
+        }
+    }
+    if (data->accumulation == TABLE_MANAGER_ACCUMULATE_ATOMIC) {
+        _table_manager_data_bin(data, tof_t_ptr, tof_p_ptr, tof_h_ptr, 1);
+        return 0;
+    }
+    #pragma omp critical
+    {
+        _table_manager_data_bin(data, tof_t_ptr, tof_p_ptr, tof_h_ptr, 0);
+    }
+    return 0;
+}
+
+/* table_manager_particle_to_table for count consecutive particles.  The
+ * accumulation target is resolved once, and the rays are binned
+ * TABLE_MANAGER_BATCH at a time (under one lock, if any), recorder by
+ * recorder, so the index computation vectorises across rays.  Particles with a mismatching number
+ * of recorders are skipped and make the call return -1. */
+int table_manager_ctx_particles_to_table(struct TableManagerState * state,
+                                         _class_particle * ps, int count,
+                                         struct TableManagerData * data) {
+    if (!state || !state->offsets_set || !data) {
+        fprintf(stderr, "TableManager ERROR: Failed to access per-particle time or probability arrays for transfer to table.\n");
+        return -1;
+    }
+    int warming;
+    #pragma omp atomic read seq_cst
+    warming = data->warming;
+    if (warming) {
+        int ret = 0;
+        for (int i = 0; i < count; ++i)
+            if (table_manager_ctx_particle_to_table(state, &ps[i], data) != 0)
+                ret = -1;
+        return ret;
+    }
+    struct TableManagerData * target = data;
+    int atomic = data->accumulation == TABLE_MANAGER_ACCUMULATE_ATOMIC;
+    int locked = data->accumulation == TABLE_MANAGER_ACCUMULATE_CRITICAL;
+    if (data->accumulation == TABLE_MANAGER_ACCUMULATE_PRIVATE) {
+        int thread = _table_manager_thread_num();
+        if (thread < data->n_slabs)
+            target = data->slabs[thread];
+        else
+            locked = 1;
+    }
+
+    int ret = 0;
+    double * tof_t[TABLE_MANAGER_BATCH], * tof_p[TABLE_MANAGER_BATCH], * hits[TABLE_MANAGER_BATCH];
+    for (int first = 0; first < count; first += TABLE_MANAGER_BATCH) {
+        int end = count - first < TABLE_MANAGER_BATCH ? count : first + TABLE_MANAGER_BATCH;
+        int m = 0;
+        for (int i = first; i < end; ++i) {
+            int * tof_n;
+            if (_table_manager_particle_arrays(state, &ps[i], &tof_t[m], &tof_p[m], &hits[m], &tof_n) != 0)
+                return -1;
+            if (*tof_n == 0)
+                continue;
+            if (*tof_n != data->recorders) {
+                ret = -1;
+                continue;
+            }
+            ++m;
+        }
+        if (!m)
+            continue;
+        if (locked) {
+            #pragma omp critical
+            {
+                _table_manager_data_bin_rays(target, m, tof_t, tof_p, hits, 0);
+            }
+        } else {
+            _table_manager_data_bin_rays(target, m, tof_t, tof_p, hits, atomic);
+        }
+    }
+    if (ret != 0)
+        fprintf(stderr, "TableManager ERROR: Number of recorders in particle data does not match number of recorders in table data during transfer.\n");
+    return ret;
+}
+
+/* table_manager_particle_free for count consecutive particles. */
+int table_manager_ctx_particles_free(struct TableManagerState * state,
+                                    _class_particle * ps, int count) {
+    int ret = 0;
+    for (int i = 0; i < count; ++i)
+        if (table_manager_ctx_particle_free(state, &ps[i]) != 0)
+            ret = -1;
+    return ret;
+}
+
+int table_manager_ctx_particle_free(struct TableManagerState * state, _class_particle * p) {
+    double ** tof_t_ptr = table_manager_ctx_particle_t_array_ptr(state, p);
+    double ** tof_p_ptr = table_manager_ctx_particle_p_array_ptr(state, p);
+    int *     tof_n_ptr = table_manager_ctx_particle_n_ptr(state, p);
+    if (!tof_t_ptr || !tof_p_ptr || !tof_n_ptr) {
+        fprintf(stderr, "TableManager ERROR: Failed to access per-particle time or probability arrays for freeing.\n");
+        return -1;
+    }
+    /* The p array shares the t array's block; with inline storage both
+     * pointers are NULL and only the size is reset. */
+    _table_manager_block_put(state, *tof_t_ptr, *tof_n_ptr);
+    *tof_t_ptr = NULL;
+    *tof_p_ptr = NULL;
+    *tof_n_ptr = 0;
+    return 0;
+}
+
+/* ---------------------------------------------------------------------------
+ * Event streaming
+ * ------------------------------------------------------------------------- */
+
+/* Rays are copied into one single-producer ring per OpenMP thread (plus one
+ * shared, under a critical section, by threads beyond the pool size) and a
+ * writer thread appends them to the file.  Without POSIX threads or GNU
+ * atomics the producers write out their own full rings instead. */
+#if !defined(TOF_TABLE_NO_THREADS) && !defined(_WIN32) && (defined(__GNUC__) || defined(__clang__))
+#define TABLE_MANAGER_EVENT_THREAD
+#include <pthread.h>
+#include <time.h>
+#define TABLE_MANAGER_LOAD_ACQUIRE(x)     __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define TABLE_MANAGER_STORE_RELEASE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#else
+#define TABLE_MANAGER_LOAD_ACQUIRE(x)     (x)
+#define TABLE_MANAGER_STORE_RELEASE(x, v) ((x) = (v))
+#endif
+
+#define TABLE_MANAGER_EVENT_MAGIC       "TOFEVENT"
+#define TABLE_MANAGER_EVENT_HEADER_SIZE 64
+
+/* head and tail sit on their own cache lines: the producer only writes head,
+ * the writer only writes tail. */
+struct TableManagerEventRing {
+    size_t   head;               /* records pushed                           */
+    char     pad0[64 - sizeof(size_t)];
+    size_t   tail;               /* records written to the file              */
+    char     pad1[64 - sizeof(size_t)];
+    double * records;            /* slots records of 2 * recorders doubles   */
+};
+
+struct TableManagerEvents {
+    FILE *   f;
+    int      recorders;
+    size_t   record;             /* doubles per record: t, then p            */
+    size_t   slots;              /* records per ring, a power of two         */
+    int      n_rings;
+    struct TableManagerEventRing * rings;
+    int      error;              /* set when a write to the file failed      */
+    long long written;
+#ifdef TABLE_MANAGER_EVENT_THREAD
+    pthread_t writer;
+    int      stop;
+#endif
+};
+
+/* Appends every record of ring that is ready to the file, in at most two
+ * contiguous writes.  Only one caller at a time may drain a given ring. */
+static size_t _table_manager_events_drain(struct TableManagerEvents * ev,
+                                          struct TableManagerEventRing * ring) {
+    size_t tail = ring->tail;
+    size_t head = TABLE_MANAGER_LOAD_ACQUIRE(ring->head);
+    size_t n = head - tail;
+    while (tail != head) {
+        size_t start = tail & (ev->slots - 1);
+        size_t count = head - tail < ev->slots - start ? head - tail : ev->slots - start;
+        if (fwrite(ring->records + start * ev->record, ev->record * sizeof(double), count, ev->f) != count)
+            TABLE_MANAGER_STORE_RELEASE(ev->error, 1);
+        tail += count;
+    }
+    TABLE_MANAGER_STORE_RELEASE(ring->tail, tail);
+    TABLE_MANAGER_STORE_RELEASE(ev->written, ev->written + (long long) n);
+    return n;
+}
+
+#ifdef TABLE_MANAGER_EVENT_THREAD
+static void _table_manager_events_pause(void) {
+    struct timespec pause = {0, 100000};
+    nanosleep(&pause, NULL);
+}
+
+/* Drains the rings until stop is set and a full pass finds them empty. */
+static void * _table_manager_events_writer(void * arg) {
+    struct TableManagerEvents * ev = (struct TableManagerEvents *) arg;
+    for (;;) {
+        int stop = TABLE_MANAGER_LOAD_ACQUIRE(ev->stop);
+        size_t n = 0;
+        for (int r = 0; r < ev->n_rings; ++r)
+            n += _table_manager_events_drain(ev, &ev->rings[r]);
+        if (!n) {
+            if (stop)
+                break;
+            _table_manager_events_pause();
+        }
+    }
+    return NULL;
+}
+#endif
+
+static void _table_manager_events_release(struct TableManagerEvents * ev) {
+    for (int r = 0; ev->rings && r < ev->n_rings; ++r)
+        free(ev->rings[r].records);
+    free(ev->rings);
+    if (ev->f)
+        fclose(ev->f);
+    free(ev);
+}
+
+/* Creates filename and starts streaming rays of recorders recorders into it.
+ * Every OpenMP thread gets a ring of up to ring_bytes; a thread whose ring is
+ * full waits for the writer, so memory stays bounded.
+ *
+ * File layout: a 64-byte header ("TOFEVENT", then uint32 version 1,
+ * recorders, record size in bytes and 0x01020304 in host byte order), then
+ * one record per ray that reached a recorder: recorders float64 times, then
+ * recorders float64 probabilities, with NaN and 0 for recorders the ray did
+ * not reach.  Records of one thread keep their order. */
+struct TableManagerEvents * table_manager_events_open(const char * filename, int recorders,
+                                                      size_t ring_bytes) {
+    if (!filename || recorders <= 0) {
+        fprintf(stderr, "TableManager ERROR: Event streaming needs a file name and at least one recorder.\n");
+        return NULL;
+    }
+    struct TableManagerEvents * ev =
+        (struct TableManagerEvents *) calloc(1, sizeof(struct TableManagerEvents));
+    if (!ev) {
+        fprintf(stderr, "TableManager ERROR: Failed to allocate memory for event streaming.\n");
+        return NULL;
+    }
+    ev->recorders = recorders;
+    ev->record = 2 * (size_t) recorders;
+    ev->slots = 2;
+    while (ev->slots * 2 * ev->record * sizeof(double) <= ring_bytes)
+        ev->slots *= 2;
+    ev->n_rings = _table_manager_max_threads() + 1;
+    ev->rings = (struct TableManagerEventRing *)
+        calloc((size_t) ev->n_rings, sizeof(struct TableManagerEventRing));
+    int allocated = ev->rings != NULL;
+    for (int r = 0; allocated && r < ev->n_rings; ++r) {
+        ev->rings[r].records = (double *) malloc(ev->slots * ev->record * sizeof(double));
+        allocated = ev->rings[r].records != NULL;
+    }
+    if (!allocated) {
+        fprintf(stderr, "TableManager ERROR: Failed to allocate memory for event ring buffers.\n");
+        _table_manager_events_release(ev);
+        return NULL;
+    }
+    ev->f = fopen(filename, "wb");
+    if (!ev->f) {
+        fprintf(stderr, "TableManager ERROR: Could not open event file '%s' for writing.\n", filename);
+        _table_manager_events_release(ev);
+        return NULL;
+    }
+    setvbuf(ev->f, NULL, _IOFBF, (size_t) 1 << 20);
+
+    unsigned char header[TABLE_MANAGER_EVENT_HEADER_SIZE] = {0};
+    uint32_t fields[4] = {1u, (uint32_t) recorders,
+                          (uint32_t) (ev->record * sizeof(double)), 0x01020304u};
+    memcpy(header, TABLE_MANAGER_EVENT_MAGIC, 8);
+    memcpy(header + 8, fields, sizeof(fields));
+    if (fwrite(header, 1, sizeof(header), ev->f) != sizeof(header)) {
+        fprintf(stderr, "TableManager ERROR: Failed to write the header of event file '%s'.\n", filename);
+        _table_manager_events_release(ev);
+        return NULL;
+    }
+#ifdef TABLE_MANAGER_EVENT_THREAD
+    if (pthread_create(&ev->writer, NULL, _table_manager_events_writer, ev) != 0) {
+        fprintf(stderr, "TableManager ERROR: Failed to start the event writer thread.\n");
+        _table_manager_events_release(ev);
+        return NULL;
+    }
+#endif
+    return ev;
+}
+
+static int _table_manager_events_put(struct TableManagerEvents * ev,
+                                     struct TableManagerEventRing * ring,
+                                     const double * tof_t, const double * tof_p,
+                                     const double * hits) {
+    size_t head = ring->head;
+    while (head - TABLE_MANAGER_LOAD_ACQUIRE(ring->tail) == ev->slots) {
+#ifdef TABLE_MANAGER_EVENT_THREAD
+        _table_manager_events_pause();
+#else
+        #pragma omp critical (table_manager_events_file)
+        _table_manager_events_drain(ev, ring);
+#endif
+    }
+    double * record = ring->records + (head & (ev->slots - 1)) * ev->record;
+    int nr = ev->recorders;
+    for (int r = 0; r < nr; ++r) {
+        int hit = (int) ((_table_manager_hits_load(hits, r / 64) >> (r % 64)) & 1u);
+        record[r]      = hit ? tof_t[r] : NAN;
+        record[nr + r] = hit ? tof_p[r] : 0.0;
+    }
+    TABLE_MANAGER_STORE_RELEASE(ring->head, head + 1);
+    return TABLE_MANAGER_LOAD_ACQUIRE(ev->error) ? -1 : 0;
+}
+
+/* Queues one ray's times and probabilities, with hits its hit mask. */
+int table_manager_events_push(struct TableManagerEvents * ev,
+                              const double * tof_t, const double * tof_p,
+                              const double * hits) {
+    if (!ev)
+        return -1;
+    int thread = _table_manager_thread_num();
+    if (thread < ev->n_rings - 1)
+        return _table_manager_events_put(ev, &ev->rings[thread], tof_t, tof_p, hits);
+    int ret;
+    #pragma omp critical (table_manager_events)
+    ret = _table_manager_events_put(ev, &ev->rings[ev->n_rings - 1], tof_t, tof_p, hits);
+    return ret;
+}
+
+/* Number of rays written to the file so far. */
+long long table_manager_events_written(const struct TableManagerEvents * ev) {
+    return ev ? TABLE_MANAGER_LOAD_ACQUIRE(ev->written) : 0;
+}
+
+/* Writes out every queued ray, stops the writer and closes the file.
+ * Must not run concurrently with table_manager_events_push. */
+int table_manager_events_close(struct TableManagerEvents * ev) {
+    if (!ev)
+        return 0;
+#ifdef TABLE_MANAGER_EVENT_THREAD
+    TABLE_MANAGER_STORE_RELEASE(ev->stop, 1);
+    pthread_join(ev->writer, NULL);
+#endif
+    for (int r = 0; r < ev->n_rings; ++r)
+        _table_manager_events_drain(ev, &ev->rings[r]);
+    int error = ev->error || fflush(ev->f) != 0;
+    if (error)
+        fprintf(stderr, "TableManager ERROR: Failed to write the event file.\n");
+    _table_manager_events_release(ev);
+    return error ? -1 : 0;
+}
+
+/* Queues the rays a particle recorded; particles that reached no recorder
+ * are skipped. */
+int table_manager_ctx_particle_to_events(struct TableManagerState * state,
+                                         _class_particle * p,
+                                         struct TableManagerEvents * ev) {
+    double * tof_t_ptr, * tof_p_ptr, * tof_h_ptr;
+    int *    tof_n_ptr;
+    if (_table_manager_particle_arrays(state, p, &tof_t_ptr, &tof_p_ptr, &tof_h_ptr, &tof_n_ptr) != 0) {
+        fprintf(stderr, "TableManager ERROR: Failed to access per-particle time or probability arrays for event output.\n");
+        return -1;
+    }
+    if (*tof_n_ptr == 0)
+        return 0;
+    if (!ev || *tof_n_ptr != ev->recorders) {
+        fprintf(stderr, "TableManager ERROR: Number of recorders in particle data does not match the event stream.\n");
+        return -1;
+    }
+    return table_manager_events_push(ev, tof_t_ptr, tof_p_ptr, tof_h_ptr);
+}
+
+/* ---------------------------------------------------------------------------
+ * Weighted ray sampling
+ * ------------------------------------------------------------------------- */
+
+/* Every OpenMP thread keeps its own reservoir of up to size rays, chosen with
+ * probability proportional to their weight by the A-ExpJ variant of the
+ * Efraimidis-Spirakis algorithm: each ray in the sample has the key
+ * log(u) / w (u uniform in (0, 1)), the reservoir holds the largest keys, and
+ * instead of drawing a key per ray the amount of weight to skip before the
+ * next insertion is drawn, so most rays cost one subtraction.  The union of
+ * the reservoirs, cut down to the largest size keys, is again such a sample. */
+struct TableManagerReservoir {
+    int      count;              /* rays held, at most size                  */
+    double * key;                /* min-heap of the keys held                */
+    int    * slot;               /* record of each heap entry                */
+    double * records;            /* size records: t, p, then weight          */
+    double   skip;               /* weight to pass before the next insertion */
+    uint64_t rng;
+    char     pad[64];
+};
+
+struct TableManagerSampler {
+    int      recorders;
+    int      size;
+    size_t   record;             /* doubles per record                       */
+    int      n_reservoirs;       /* one per thread, plus one shared          */
+    struct TableManagerReservoir * reservoirs;
+};
+
+/* Uniform double in (0, 1) from a splitmix64 stream. */
+static double _table_manager_uniform(uint64_t * state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    z ^= z >> 31;
+    return ((double) (z >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+static void _table_manager_heap_sift_down(double * key, int * slot, int count, int i) {
+    for (;;) {
+        int least = i, l = 2 * i + 1, r = l + 1;
+        if (l < count && key[l] < key[least])
+            least = l;
+        if (r < count && key[r] < key[least])
+            least = r;
+        if (least == i)
+            return;
+        double k = key[i]; key[i] = key[least]; key[least] = k;
+        int s = slot[i]; slot[i] = slot[least]; slot[least] = s;
+        i = least;
+    }
+}
+
+static void _table_manager_heap_push(double * key, int * slot, int count, double k, int s) {
+    int i = count;
+    while (i > 0 && key[(i - 1) / 2] > k) {
+        key[i] = key[(i - 1) / 2];
+        slot[i] = slot[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    key[i] = k;
+    slot[i] = s;
+}
+
+void table_manager_sampler_free(struct TableManagerSampler * s) {
+    if (!s)
+        return;
+    for (int i = 0; s->reservoirs && i < s->n_reservoirs; ++i) {
+        free(s->reservoirs[i].key);
+        free(s->reservoirs[i].slot);
+        free(s->reservoirs[i].records);
+    }
+    free(s->reservoirs);
+    free(s);
+}
+
+/* Creates a sampler keeping size rays of recorders recorders.  Memory is
+ * fixed at allocation: size records per OpenMP thread. */
+struct TableManagerSampler * table_manager_sampler_alloc(int recorders, int size,
+                                                         unsigned long long seed) {
+    if (recorders <= 0 || size <= 0) {
+        fprintf(stderr, "TableManager ERROR: Ray sampling needs at least one recorder and a positive sample size.\n");
+        return NULL;
+    }
+    struct TableManagerSampler * s =
+        (struct TableManagerSampler *) calloc(1, sizeof(struct TableManagerSampler));
+    if (!s) {
+        fprintf(stderr, "TableManager ERROR: Failed to allocate memory for ray sampling.\n");
+        return NULL;
+    }
+    s->recorders = recorders;
+    s->size = size;
+    s->record = 2 * (size_t) recorders + 1;
+    s->n_reservoirs = _table_manager_max_threads() + 1;
+    s->reservoirs = (struct TableManagerReservoir *)
+        calloc((size_t) s->n_reservoirs, sizeof(struct TableManagerReservoir));
+    int allocated = s->reservoirs != NULL;
+    for (int i = 0; allocated && i < s->n_reservoirs; ++i) {
+        struct TableManagerReservoir * res = &s->reservoirs[i];
+        res->key = (double *) malloc((size_t) size * sizeof(double));
+        res->slot = (int *) malloc((size_t) size * sizeof(int));
+        res->records = (double *) malloc((size_t) size * s->record * sizeof(double));
+        res->rng = seed + 0x632be59bd9b4e019ull * (uint64_t) (i + 1);
+        allocated = res->key && res->slot && res->records;
+    }
+    if (!allocated) {
+        fprintf(stderr, "TableManager ERROR: Failed to allocate memory for ray sampling.\n");
+        table_manager_sampler_free(s);
+        return NULL;
+    }
+    return s;
+}
+
+static void _table_manager_reservoir_store(const struct TableManagerSampler * s,
+                                           double * record, const double * tof_t,
+                                           const double * tof_p, const double * hits,
+                                           double weight) {
+    int nr = s->recorders;
+    for (int r = 0; r < nr; ++r) {
+        int hit = (int) ((_table_manager_hits_load(hits, r / 64) >> (r % 64)) & 1u);
+        record[r]      = hit ? tof_t[r] : NAN;
+        record[nr + r] = hit ? tof_p[r] : 0.0;
+    }
+    record[2 * nr] = weight;
+}
+
+static void _table_manager_reservoir_add(const struct TableManagerSampler * s,
+                                         struct TableManagerReservoir * res,
+                                         const double * tof_t, const double * tof_p,
+                                         const double * hits, double weight) {
+    if (res->count == s->size) {
+        res->skip -= weight;
+        if (res->skip > 0.0)
+            return;
+        /* The ray replaces the smallest key; its own key is drawn from the
+         * part of the distribution above that key. */
+        double floor = exp(res->key[0] * weight);
+        double u = floor + (1.0 - floor) * _table_manager_uniform(&res->rng);
+        res->key[0] = log(u) / weight;
+        _table_manager_reservoir_store(s, res->records + (size_t) res->slot[0] * s->record,
+                                       tof_t, tof_p, hits, weight);
+        _table_manager_heap_sift_down(res->key, res->slot, res->count, 0);
+    } else {
+        _table_manager_reservoir_store(s, res->records + (size_t) res->count * s->record,
+                                       tof_t, tof_p, hits, weight);
+        _table_manager_heap_push(res->key, res->slot, res->count,
+                                 log(_table_manager_uniform(&res->rng)) / weight, res->count);
+        if (++res->count < s->size)
+            return;
+    }
+    res->skip = log(_table_manager_uniform(&res->rng)) / res->key[0];
+}
+
+/* Offers one ray to the caller's reservoir; rays without positive weight are
+ * never sampled. */
+int table_manager_sampler_add(struct TableManagerSampler * s,
+                              const double * tof_t, const double * tof_p,
+                              const double * hits, double weight) {
+    if (!s)
+        return -1;
+    if (!(weight > 0.0) || !isfinite(weight))
+        return 0;
+    int thread = _table_manager_thread_num();
+    if (thread < s->n_reservoirs - 1) {
+        _table_manager_reservoir_add(s, &s->reservoirs[thread], tof_t, tof_p, hits, weight);
+        return 0;
+    }
+    #pragma omp critical (table_manager_sampler)
+    _table_manager_reservoir_add(s, &s->reservoirs[s->n_reservoirs - 1], tof_t, tof_p, hits, weight);
+    return 0;
+}
+
+/* Offers a particle's recorded rays, weighted by its current weight p. */
+int table_manager_ctx_particle_to_sampler(struct TableManagerState * state,
+                                          _class_particle * p,
+                                          struct TableManagerSampler * s) {
+    double * tof_t_ptr, * tof_p_ptr, * tof_h_ptr;
+    int *    tof_n_ptr;
+    if (_table_manager_particle_arrays(state, p, &tof_t_ptr, &tof_p_ptr, &tof_h_ptr, &tof_n_ptr) != 0) {
+        fprintf(stderr, "TableManager ERROR: Failed to access per-particle time or probability arrays for sampling.\n");
+        return -1;
+    }
+    if (*tof_n_ptr == 0)
+        return 0;
+    if (!s || *tof_n_ptr != s->recorders) {
+        fprintf(stderr, "TableManager ERROR: Number of recorders in particle data does not match the ray sampler.\n");
+        return -1;
+    }
+    return table_manager_sampler_add(s, tof_t_ptr, tof_p_ptr, tof_h_ptr, p->p);
+}
+
+struct TableManagerSampleRef {
+    double key;
+    const double * record;
+};
+
+static int _table_manager_sample_ref_cmp(const void * a, const void * b) {
+    double ka = ((const struct TableManagerSampleRef *) a)->key;
+    double kb = ((const struct TableManagerSampleRef *) b)->key;
+    return ka < kb ? 1 : ka > kb ? -1 : 0;
+}
+
+/* Merges the reservoirs into the final sample, leaving them untouched:
+ * t and p receive n x recorders values, weight n values, where n (at most
+ * the sample size, returned) is the number of rays sampled.  Must not run
+ * concurrently with table_manager_sampler_add. */
+int table_manager_sampler_collect(const struct TableManagerSampler * s,
+                                  double * t, double * p, double * weight) {
+    if (!s)
+        return -1;
+    size_t total = 0;
+    for (int i = 0; i < s->n_reservoirs; ++i)
+        total += (size_t) s->reservoirs[i].count;
+    struct TableManagerSampleRef * refs = (struct TableManagerSampleRef *)
+        malloc((total ? total : 1) * sizeof(struct TableManagerSampleRef));
+    if (!refs) {
+        fprintf(stderr, "TableManager ERROR: Failed to allocate memory for merging ray samples.\n");
+        return -1;
+    }
+    size_t k = 0;
+    for (int i = 0; i < s->n_reservoirs; ++i) {
+        const struct TableManagerReservoir * res = &s->reservoirs[i];
+        for (int j = 0; j < res->count; ++j, ++k) {
+            refs[k].key = res->key[j];
+            refs[k].record = res->records + (size_t) res->slot[j] * s->record;
+        }
+    }
+    qsort(refs, total, sizeof(*refs), _table_manager_sample_ref_cmp);
+    int n = total < (size_t) s->size ? (int) total : s->size;
+    int nr = s->recorders;
+    for (int i = 0; i < n; ++i) {
+        memcpy(t + (size_t) i * nr, refs[i].record, (size_t) nr * sizeof(double));
+        memcpy(p + (size_t) i * nr, refs[i].record + nr, (size_t) nr * sizeof(double));
+        weight[i] = refs[i].record[2 * nr];
+    }
+    free(refs);
+    return n;
+}
+
+/* ---------------------------------------------------------------------------
+ * JSON helpers
+ * ------------------------------------------------------------------------- */
+
+/* Numbers are formatted into a memory buffer that is handed to fwrite in
+ * blocks of up to TABLE_MANAGER_JSON_BUFFER_SIZE bytes, instead of issuing
+ * one fprintf per token. */
+#define TABLE_MANAGER_JSON_BUFFER_SIZE ((size_t) 1 << 20)
+
+struct TableManagerJsonBuffer {
+    FILE * f;
+    char * data;
+    size_t len;
+    size_t cap;
+    int error;
+};
+
+/* Sizes the buffer for the expected output, capped at the block size.  With
+ * f NULL the buffer only collects output in memory (it is not capped, and
+ * must be given a file before it is flushed). */
+static int _json_buffer_open(struct TableManagerJsonBuffer * b, FILE * f, size_t expected) {
+    b->f = f;
+    b->len = 0;
+    b->error = 0;
+    b->cap = !f || expected < TABLE_MANAGER_JSON_BUFFER_SIZE ? expected : TABLE_MANAGER_JSON_BUFFER_SIZE;
+    if (b->cap < 64)
+        b->cap = 64;
+    b->data = (char *) malloc(b->cap);
+    if (!b->data) {
+        fprintf(stderr, "TableManager ERROR: Failed to allocate memory for the JSON output buffer.\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void _json_buffer_flush(struct TableManagerJsonBuffer * b) {
+    if (b->len && (!b->f || fwrite(b->data, 1, b->len, b->f) != b->len))
+        b->error = 1;
+    b->len = 0;
+}
+
+/* Returns room for at least n (<= 64) more bytes. */
+static char * _json_buffer_reserve(struct TableManagerJsonBuffer * b, size_t n) {
+    if (b->len + n > b->cap)
+        _json_buffer_flush(b);
+    return b->data + b->len;
+}
+
+static void _json_buffer_puts(struct TableManagerJsonBuffer * b, const char * s) {
+    size_t n = strlen(s);
+    memcpy(_json_buffer_reserve(b, n), s, n);
+    b->len += n;
+}
+
+static void _json_buffer_indent(struct TableManagerJsonBuffer * b, int level) {
+    for (int i = 0; i < level; ++i)
+        _json_buffer_puts(b, "  ");
+}
+
+/* Writes the decimal digits of an integer; out needs 21 bytes. */
+static int _table_manager_format_integer(char * out, long long x) {
+    char digits[20];
+    int n = 0, len = 0;
+    unsigned long long u = x < 0 ? 0ULL - (unsigned long long) x : (unsigned long long) x;
+    do {
+        digits[n++] = (char) ('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (x < 0)
+        out[len++] = '-';
+    while (n)
+        out[len++] = digits[--n];
+    return len;
+}
+
+/* Reads the decimal m * 10^e back as a double into *out.  Uses Clinger's
+ * fast path (m and 10^|e| exact doubles, one correctly rounded operation)
+ * when it applies, strtod otherwise. */
+static double _table_manager_decimal_value(uint64_t m, int e) {
+    static const double powers[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    if (m < ((uint64_t) 1 << 53) && e >= -22 && e <= 22)
+        return e < 0 ? (double) m / powers[-e] : (double) m * powers[e];
+    char text[32];
+    snprintf(text, sizeof(text), "%llue%d", (unsigned long long) m, e);
+    return strtod(text, NULL);
+}
+
+/* Writes a short decimal string, in "%g" style, that reads back as exactly
+ * x; out needs 32 bytes.  Zero and integers below 1e15 take an integer fast
+ * path.  Other values are printed once with 17 significant digits, which
+ * always round-trips, and the digit string is then rounded to 15 and 16
+ * digits; the first that reads back as x is written.  That is the shortest
+ * round-trip form except when rounding the 17-digit string differs from
+ * rounding x itself (about 0.2% of random doubles), which costs one digit.
+ * The result is byte-identical to the former "%.15g" output whenever that
+ * was exact, and the decimal separator is '.' whatever the locale. */
+static int _table_manager_format_double(char * out, double x) {
+    if (x == 0.0) {
+        int len = 0;
+        if (signbit(x))
+            out[len++] = '-';
+        out[len++] = '0';
+        return len;
     }
-    return 0;
+    if (fabs(x) < 1e15 && x == (double) (long long) x)
+        return _table_manager_format_integer(out, (long long) x);
+    /* Not JSON proper, but the spelling Python's json module reads. */
+    if (isnan(x))
+        return snprintf(out, 32, "NaN");
+    if (isinf(x))
+        return snprintf(out, 32, "%sInfinity", x < 0 ? "-" : "");
+
+    char text[40], digits[18];
+    snprintf(text, sizeof(text), "%.16e", x);
+    int n = 0, exponent = 0;
+    const char * s = text;
+    for (; *s && *s != 'e' && *s != 'E'; ++s)
+        if (*s >= '0' && *s <= '9' && n < 17)
+            digits[n++] = *s;
+    if (*s)
+        exponent = atoi(s + 1);
+
+    int precision = 17;
+    char rounded[18];
+    int rounded_exponent = exponent;
+    for (int p = 15; p < 17; ++p) {
+        memcpy(rounded, digits, 17);
+        rounded_exponent = exponent;
+        if (rounded[p] >= '5') {
+            int i = p - 1;
+            while (i >= 0 && rounded[i] == '9')
+                rounded[i--] = '0';
+            if (i >= 0) {
+                rounded[i]++;
+            } else {
+                rounded[0] = '1';
+                rounded_exponent++;
+            }
+        }
+        uint64_t m = 0;
+        for (int i = 0; i < p; ++i)
+            m = m * 10 + (uint64_t) (rounded[i] - '0');
+        if (_table_manager_decimal_value(m, rounded_exponent - (p - 1)) == fabs(x)) {
+            precision = p;
+            break;
+        }
+    }
+    if (precision == 17) {
+        memcpy(rounded, digits, 17);
+        rounded_exponent = exponent;
+    }
+    int k = precision;
+    while (k > 1 && rounded[k - 1] == '0')
+        --k;
+
+    int len = 0;
+    if (x < 0)
+        out[len++] = '-';
+    if (rounded_exponent < -4 || rounded_exponent >= precision) {
+        out[len++] = rounded[0];
+        if (k > 1) {
+            out[len++] = '.';
+            memcpy(out + len, rounded + 1, (size_t) (k - 1));
+            len += k - 1;
+        }
+        len += snprintf(out + len, 8, "e%c%02d", rounded_exponent < 0 ? '-' : '+',
+                        rounded_exponent < 0 ? -rounded_exponent : rounded_exponent);
+    } else if (rounded_exponent >= 0) {
+        for (int i = 0; i <= rounded_exponent; ++i)
+            out[len++] = i < k ? rounded[i] : '0';
+        if (k > rounded_exponent + 1) {
+            out[len++] = '.';
+            memcpy(out + len, rounded + rounded_exponent + 1, (size_t) (k - rounded_exponent - 1));
+            len += k - rounded_exponent - 1;
+        }
+    } else {
+        out[len++] = '0';
+        out[len++] = '.';
+        for (int i = 0; i < -rounded_exponent - 1; ++i)
+            out[len++] = '0';
+        memcpy(out + len, rounded, (size_t) k);
+        len += k;
+    }
+    return len;
 }
 
-int table_manager_json_array_double(FILE * f, double * x, int n) {
-    if (fprintf(f, "[") < 0)
-        return -1;
+static void _json_buffer_array_double(struct TableManagerJsonBuffer * b, const double * x, int n) {
+    _json_buffer_puts(b, "[");
     for (int i = 0; i < n; ++i) {
-        if (fprintf(f, "%.15g", x[i]) < 0)
-            return -1;
-        if (i < n - 1 && fprintf(f, ", ") < 0)
-            return -1;
+        char * out = _json_buffer_reserve(b, 34);
+        int len = _table_manager_format_double(out, x[i]);
+        if (i < n - 1) {
+            out[len++] = ',';
+            out[len++] = ' ';
+        }
+        b->len += (size_t) len;
     }
-    if (fprintf(f, "]") < 0)
-        return -1;
-    return 0;
+    _json_buffer_puts(b, "]");
 }
 
-int table_manager_json_array_int(FILE * f, int * x, int n) {
-    if (fprintf(f, "[") < 0)
-        return -1;
+static void _json_buffer_array_int(struct TableManagerJsonBuffer * b, const int * x, int n) {
+    _json_buffer_puts(b, "[");
     for (int i = 0; i < n; ++i) {
-        if (fprintf(f, "%d", x[i]) < 0)
-            return -1;
-        if (i < n - 1 && fprintf(f, ", ") < 0)
+        char * out = _json_buffer_reserve(b, 23);
+        int len = _table_manager_format_integer(out, x[i]);
+        if (i < n - 1) {
+            out[len++] = ',';
+            out[len++] = ' ';
+        }
+        b->len += (size_t) len;
+    }
+    _json_buffer_puts(b, "]");
+}
+
+static int _json_buffer_close(struct TableManagerJsonBuffer * b) {
+    _json_buffer_flush(b);
+    free(b->data);
+    b->data = NULL;
+    return b->error ? -1 : 0;
+}
+
+int table_manager_json_indent(FILE * f, int level) {
+    for (int i = 0; i < level; ++i) {
+        if (fprintf(f, "  ") < 0)
             return -1;
     }
-    if (fprintf(f, "]") < 0)
-        return -1;
     return 0;
 }
 
@@ -392,35 +3297,100 @@ int table_manager_json_array_string(FILE * f, char ** x, int n) {
     return 0;
 }
 
-int table_manager_json_matrix_double(FILE * f, double * x, int m, int n,
-                                     int indent_level) {
-    if (fprintf(f, "[\n") < 0)
-        return -1;
-    for (int i = 0; i < m; ++i) {
-        if (table_manager_json_indent(f, indent_level + 1) < 0)
-            return -1;
-        if (table_manager_json_array_double(f, &x[i * n], n) < 0)
-            return -1;
-        if (fprintf(f, i < m - 1 ? ",\n" : "\n") < 0)
-            return -1;
-    }
-    if (table_manager_json_indent(f, indent_level) < 0)
+int table_manager_json_array_double(FILE * f, double * x, int n) {
+    struct TableManagerJsonBuffer b;
+    if (_json_buffer_open(&b, f, (size_t) n * 26 + 2) != 0)
         return -1;
-    if (fprintf(f, "]") < 0)
+    _json_buffer_array_double(&b, x, n);
+    return _json_buffer_close(&b);
+}
+
+int table_manager_json_array_int(FILE * f, int * x, int n) {
+    struct TableManagerJsonBuffer b;
+    if (_json_buffer_open(&b, f, (size_t) n * 13 + 2) != 0)
         return -1;
-    return 0;
+    _json_buffer_array_int(&b, x, n);
+    return _json_buffer_close(&b);
 }
 
-int table_manager_json_matrix_int(FILE * f, int * x, int m, int n,
-                                  int indent_level) {
+/* Matrices are formatted in chunks of TABLE_MANAGER_JSON_CHUNK values,
+ * spread over the OpenMP threads, and the chunks are written in order; at
+ * most two chunks per thread are held in memory at a time. */
+#define TABLE_MANAGER_JSON_CHUNK ((size_t) 1 << 16)
+
+/* Formats values [begin, end) of the row-major m x n matrix xd (or xi) into
+ * b, including the row brackets and separators around them.  b must be
+ * large enough never to flush. */
+static void _json_buffer_matrix_chunk(struct TableManagerJsonBuffer * b,
+                                      const double * xd, const int * xi,
+                                      int m, int n, int indent_level,
+                                      size_t begin, size_t end) {
+    for (size_t v = begin; v < end; ++v) {
+        size_t row = v / (size_t) n;
+        size_t col = v % (size_t) n;
+        if (col == 0) {
+            _json_buffer_indent(b, indent_level + 1);
+            _json_buffer_puts(b, "[");
+        }
+        char * out = _json_buffer_reserve(b, 32);
+        int len = xd ? _table_manager_format_double(out, xd[v])
+                     : _table_manager_format_integer(out, xi[v]);
+        b->len += (size_t) len;
+        if (col + 1 < (size_t) n)
+            _json_buffer_puts(b, ", ");
+        else
+            _json_buffer_puts(b, row + 1 < (size_t) m ? "],\n" : "]\n");
+    }
+}
+
+static int _json_write_matrix(FILE * f, const double * xd, const int * xi,
+                              int m, int n, int indent_level) {
     if (fprintf(f, "[\n") < 0)
         return -1;
-    for (int i = 0; i < m; ++i) {
-        if (table_manager_json_indent(f, indent_level + 1) < 0)
-            return -1;
-        if (table_manager_json_array_int(f, &x[i * n], n) < 0)
-            return -1;
-        if (fprintf(f, i < m - 1 ? ",\n" : "\n") < 0)
+    if (n == 0) {
+        /* Rows without values: nothing to chunk. */
+        for (int i = 0; i < m; ++i) {
+            if (table_manager_json_indent(f, indent_level + 1) < 0 ||
+                fprintf(f, i < m - 1 ? "[],\n" : "[]\n") < 0)
+                return -1;
+        }
+    } else {
+        size_t total = (size_t) m * (size_t) n;
+        int n_chunks = (int) ((total + TABLE_MANAGER_JSON_CHUNK - 1) / TABLE_MANAGER_JSON_CHUNK);
+        int threads = _table_manager_max_threads();
+        int batch = n_chunks < 2 * threads ? n_chunks : 2 * threads;
+        /* Worst case per chunk: 26 bytes per value, plus the indent and
+         * brackets of every row that starts or ends inside it, plus the
+         * slack _json_buffer_reserve asks for. */
+        size_t values = total < TABLE_MANAGER_JSON_CHUNK ? total : TABLE_MANAGER_JSON_CHUNK;
+        size_t rows = values / (size_t) n + 2;
+        size_t cap = values * 26 + rows * (2 * (size_t) indent_level + 8) + 64;
+        struct TableManagerJsonBuffer * chunks =
+            (struct TableManagerJsonBuffer *) calloc((size_t) batch, sizeof(struct TableManagerJsonBuffer));
+        int ok = chunks != NULL;
+        for (int i = 0; ok && i < batch; ++i)
+            ok = _json_buffer_open(&chunks[i], NULL, cap) == 0;
+        for (int first = 0; ok && first < n_chunks; first += batch) {
+            int count = n_chunks - first < batch ? n_chunks - first : batch;
+            #pragma omp parallel for schedule(dynamic) if (count > 1)
+            for (int i = 0; i < count; ++i) {
+                size_t begin = (size_t) (first + i) * TABLE_MANAGER_JSON_CHUNK;
+                size_t end = begin + TABLE_MANAGER_JSON_CHUNK < total ? begin + TABLE_MANAGER_JSON_CHUNK : total;
+                _json_buffer_matrix_chunk(&chunks[i], xd, xi, m, n, indent_level, begin, end);
+            }
+            for (int i = 0; i < count; ++i) {
+                chunks[i].f = f;
+                _json_buffer_flush(&chunks[i]);
+                ok = ok && !chunks[i].error;
+            }
+        }
+        if (chunks) {
+            for (int i = 0; i < batch; ++i)
+                if (chunks[i].data && _json_buffer_close(&chunks[i]) != 0)
+                    ok = 0;
+            free(chunks);
+        }
+        if (!ok)
             return -1;
     }
     if (table_manager_json_indent(f, indent_level) < 0)
@@ -430,6 +3400,16 @@ int table_manager_json_matrix_int(FILE * f, int * x, int m, int n,
     return 0;
 }
 
+int table_manager_json_matrix_double(FILE * f, double * x, int m, int n,
+                                     int indent_level) {
+    return _json_write_matrix(f, x, NULL, m, n, indent_level);
+}
+
+int table_manager_json_matrix_int(FILE * f, int * x, int m, int n,
+                                  int indent_level) {
+    return _json_write_matrix(f, NULL, x, m, n, indent_level);
+}
+
 /* Writes: indent "key": {"unit": <unit>, "dtype": "dtype", "dims": dims, "values":
  * where <unit> is a JSON null when unit==NULL, or a quoted string otherwise.
  * The caller writes the values array and closing "}". */
@@ -449,36 +3429,241 @@ static int _json_scipp_var_header(FILE * f, int indent,
     return ok ? 0 : -1;
 }
 
+/* ---------------------------------------------------------------------------
+ * NumPy .npy helpers
+ * ------------------------------------------------------------------------- */
+
+static int _table_manager_little_endian(void) {
+    const uint16_t one = 1;
+    unsigned char first;
+    memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+/* Writes the m x n C-ordered array x (or, with m < 0, the 1-D array of n
+ * values) as a version 1.0 .npy file, in host byte order; kind is 'f' or 'i'
+ * and size the item size in bytes.  The
+ * header is padded so the array starts on a 64-byte boundary, which lets
+ * readers memory-map it aligned. */
+static int _table_manager_npy_write(const char * filename, const void * x,
+                                    char kind, int size, int m, int n) {
+    char shape[32];
+    if (m < 0)
+        snprintf(shape, sizeof(shape), "(%d,)", n);
+    else
+        snprintf(shape, sizeof(shape), "(%d, %d)", m, n);
+    const char * format = "{'descr': '%c%c%d', 'fortran_order': False, 'shape': %s, }";
+    char order = _table_manager_little_endian() ? '<' : '>';
+    int len = snprintf(NULL, 0, format, order, kind, size, shape);
+    /* The dict, spaces and a newline, up to the next 64-byte boundary; the
+     * 16-bit header length of version 1.0 allows up to 65535 bytes. */
+    int padded = len < 0 ? -1 : ((10 + len + 1 + 63) / 64) * 64 - 10;
+    char * header = padded > 0 && padded <= 65535 ? (char *) malloc((size_t) padded + 1) : NULL;
+    if (!header) {
+        fprintf(stderr, "TableManager ERROR: Failed to build the npy header of '%s'.\n", filename);
+        return -1;
+    }
+    snprintf(header, (size_t) len + 1, format, order, kind, size, shape);
+    memset(header + len, ' ', (size_t) (padded - len - 1));
+    header[padded - 1] = '\n';
+
+    FILE * f = fopen(filename, "wb");
+    if (!f) {
+        fprintf(stderr, "TableManager ERROR: Failed to open file '%s' for writing.\n", filename);
+        free(header);
+        return -1;
+    }
+    unsigned char preamble[10] = {0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0,
+                                  (unsigned char) (padded & 0xff),
+                                  (unsigned char) (padded >> 8)};
+    size_t count = (size_t) (m < 0 ? 1 : m) * (size_t) n;
+    int ok = fwrite(preamble, 1, sizeof(preamble), f) == sizeof(preamble) &&
+             fwrite(header, 1, (size_t) padded, f) == (size_t) padded &&
+             fwrite(x, (size_t) size, count, f) == count;
+    free(header);
+    if (fclose(f) != 0 || !ok) {
+        fprintf(stderr, "TableManager ERROR: Failed to write to file '%s'.\n", filename);
+        remove(filename);
+        return -1;
+    }
+    return 0;
+}
+
+int table_manager_npy_write_double(const char * filename, const double * x,
+                                   int m, int n) {
+    return _table_manager_npy_write(filename, x, 'f', (int) sizeof(double), m, n);
+}
+
+int table_manager_npy_write_int(const char * filename, const int * x,
+                                int m, int n) {
+    return _table_manager_npy_write(filename, x, 'i', (int) sizeof(int), m, n);
+}
+
 /* ---------------------------------------------------------------------------
  * Output
  * ------------------------------------------------------------------------- */
 
+/* Maps a TableManager 'format' parameter value to its enum value.
+ * NULL or "" selects the default; returns -1 for an unknown name. */
+int table_manager_format_from_name(const char * name) {
+    if (!name || !strcmp(name, "") || !strcmp(name, "json"))
+        return TABLE_MANAGER_FORMAT_JSON;
+    if (!strcmp(name, "npy"))
+        return TABLE_MANAGER_FORMAT_NPY;
+    return -1;
+}
+
+/* Writes one variable: inline JSON values, or with npy set a reference to
+ * the sibling file <filename>.<key>.npy.  The values form an m x n matrix,
+ * or with m < 0 a 1-D array of n values. */
+static int _table_manager_write_data_item(FILE * f, const char * filename, int npy,
+                                          const char * key, const char * unit,
+                                          const char * dims,
+                                          const double * xd, const int * xi,
+                                          int m, int n) {
+    const char * dtype = xd ? "float64" : "int32";
+    if (!npy) {
+        if (_json_scipp_var_header(f, 2, key, unit, dtype, dims) != 0)
+            return -1;
+        if (m < 0)
+            return xd ? table_manager_json_array_double(f, (double *) xd, n)
+                      : table_manager_json_array_int(f, (int *) xi, n);
+        return xd ? table_manager_json_matrix_double(f, (double *) xd, m, n, 2)
+                  : table_manager_json_matrix_int(f, (int *) xi, m, n, 2);
+    }
+    size_t len = strlen(filename) + strlen(key) + 6;
+    char * path = (char *) malloc(len);
+    if (!path) {
+        fprintf(stderr, "TableManager ERROR: Failed to allocate memory for output file name.\n");
+        return -1;
+    }
+    snprintf(path, len, "%s.%s.npy", filename, key);
+    int ret = xd ? table_manager_npy_write_double(path, xd, m, n)
+                 : table_manager_npy_write_int(path, xi, m, n);
+    /* The header names the file relative to itself, so both can be moved. */
+    const char * base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    if (ret == 0 &&
+        (table_manager_json_indent(f, 2) != 0 ||
+         fprintf(f, "\"%s\": {\"unit\": %s%s%s, \"dtype\": \"%s\", \"dims\": %s, \"file\": \"%s\"",
+                 key, unit ? "\"" : "", unit ? unit : "null", unit ? "\"" : "",
+                 dtype, dims, base) < 0))
+        ret = -1;
+    free(path);
+    return ret;
+}
+
+/* Non-empty bins of a sparse table in coordinate (COO) form. */
+struct TableManagerCoo {
+    int nnz;
+    int * recorder;
+    int * time;
+    double * tp;
+    double * p1;
+    double * p2;
+    int * n;
+};
+
+static void _table_manager_coo_free(struct TableManagerCoo * coo) {
+    free(coo->recorder);
+    free(coo->time);
+    free(coo->tp);
+    free(coo->p1);
+    free(coo->p2);
+    free(coo->n);
+}
+
+/* Collects every bin with at least one hit, in row-major order. */
+static int _table_manager_coo_collect(const struct TableManagerData * data,
+                                      struct TableManagerCoo * coo) {
+    memset(coo, 0, sizeof(*coo));
+    size_t nnz = 0;
+    for (size_t b = 0; b < data->n_blocks; ++b)
+        if (data->blocks[b])
+            for (int k = 0; k < TABLE_MANAGER_SPARSE_BLOCK; ++k)
+                nnz += data->blocks[b][k].n != 0;
+    if (nnz > (size_t) INT32_MAX) {
+        fprintf(stderr, "TableManager ERROR: Too many non-empty bins for sparse output.\n");
+        return -1;
+    }
+    size_t count = nnz ? nnz : 1;
+    coo->recorder = (int *) malloc(count * sizeof(int));
+    coo->time = (int *) malloc(count * sizeof(int));
+    coo->tp = (double *) malloc(count * sizeof(double));
+    coo->p1 = (double *) malloc(count * sizeof(double));
+    coo->p2 = (double *) malloc(count * sizeof(double));
+    coo->n = (int *) malloc(count * sizeof(int));
+    if (!coo->recorder || !coo->time || !coo->tp || !coo->p1 || !coo->p2 || !coo->n) {
+        fprintf(stderr, "TableManager ERROR: Failed to allocate memory for sparse output.\n");
+        _table_manager_coo_free(coo);
+        return -1;
+    }
+    for (size_t b = 0; b < data->n_blocks; ++b) {
+        if (!data->blocks[b])
+            continue;
+        for (int k = 0; k < TABLE_MANAGER_SPARSE_BLOCK; ++k) {
+            const struct TableManagerBin * cell = &data->blocks[b][k];
+            if (!cell->n)
+                continue;
+            size_t idx = b * TABLE_MANAGER_SPARSE_BLOCK + (size_t) k;
+            coo->recorder[coo->nnz] = (int) (idx / (size_t) data->bins);
+            coo->time[coo->nnz] = (int) (idx % (size_t) data->bins);
+            coo->tp[coo->nnz] = cell->tp;
+            coo->p1[coo->nnz] = cell->p1;
+            coo->p2[coo->nnz] = cell->p2;
+            coo->n[coo->nnz] = cell->n;
+            coo->nnz++;
+        }
+    }
+    return 0;
+}
+
 int table_manager_write_output_file(const char * filename,
                                     struct TableManagerData * data) {
-    if (!_tof_table_manager_state) {
+    return table_manager_write_output(filename, data, TABLE_MANAGER_FORMAT_JSON);
+}
+
+int table_manager_ctx_write_output(struct TableManagerState * state, const char * filename,
+                                   struct TableManagerData * data, int format) {
+    if (format != TABLE_MANAGER_FORMAT_JSON && format != TABLE_MANAGER_FORMAT_NPY) {
+        fprintf(stderr, "TableManager ERROR: Unknown output format %d.\n", format);
+        return -1;
+    }
+    if (!state) {
         fprintf(stderr, "TableManager ERROR: state must be allocated before writing output file.\n");
         return -1;
     }
+    if (!data || (!data->blocks && !data->tp)) {
+        fprintf(stderr, "TableManager ERROR: The table must be reduced before it is written to %s.\n",
+                filename);
+        return -1;
+    }
 
-    int nr = _tof_table_manager_state->n_recorders;
+    int nr = state->n_recorders;
 
     /* Collect recorder info and compute time bin edges. */
     char   ** names     = (char **)   malloc((size_t)nr * sizeof(char *));
     double  * distances = (double *)  malloc((size_t)nr * sizeof(double));
-    double  * t_edges   = (double *)  malloc((size_t)(data->bins + 1) * sizeof(double));
+    double  * t_edges   = (double *)  malloc((size_t) nr * (size_t)(data->bins + 1) * sizeof(double));
     if (!names || !distances || !t_edges) {
         fprintf(stderr, "TableManager ERROR: Failed to allocate memory for output file.\n");
         free(names); free(distances); free(t_edges);
         return -1;
     }
-    struct TableManagerLinkedListNode * node = _tof_table_manager_state->recorders.head;
+    struct TableManagerLinkedListNode * node = state->recorders.head;
     for (int i = 0; i < nr; ++i, node = node->next) {
         names[i]     = node->name;
         distances[i] = node->distance;
     }
-    double step = (data->t_max - data->t_min) / data->bins;
-    for (int i = 0; i <= data->bins; ++i)
-        t_edges[i] = data->t_min + i * step;
+    /* One row of edges when every recorder uses the table-wide window,
+     * otherwise one row per recorder. */
+    int per_recorder = 0;
+    for (int i = 0; i < nr && i < data->recorders; ++i)
+        if (data->r_min[i] != data->t_min || data->r_max[i] != data->t_max)
+            per_recorder = 1;
+    int edge_rows = per_recorder ? nr : 1;
+    for (int r = 0; r < edge_rows; ++r)
+        table_manager_data_edges(data, per_recorder ? r : -1, &t_edges[(size_t) r * (size_t) (data->bins + 1)]);
 
     FILE * f = fopen(filename, "w");
     if (!f) {
@@ -491,7 +3676,23 @@ int table_manager_write_output_file(const char * filename,
      * Each variable follows the niess.io.scipp.variable_to_dict convention:
      *   {"unit": <str|null>, "dtype": "...", "dims": [...], "values": [...]}
      * The recorder coord has unit null (scipp "no unit") since names are strings.
-     * The time coord holds bin edges (bins+1 values). */
+     * The time coord holds bin edges (bins+1 values), with dims
+     * ["recorder", "time"] when the recorders have their own windows.
+     * In the npy format the data items carry "file" (a sibling .npy file)
+     * instead of "values"; the coords are always inline.
+     * A sparse table adds a "sparse" section with the recorder and time
+     * indices of its non-empty bins, and its data items have dims
+     * ["entry"], one value per index. */
+    int npy = format == TABLE_MANAGER_FORMAT_NPY;
+    int sparse = data->blocks != NULL;
+    const char * entry = "[\"entry\"]";
+    struct TableManagerCoo coo;
+    memset(&coo, 0, sizeof(coo));
+    if (sparse && _table_manager_coo_collect(data, &coo) != 0) {
+        fclose(f);
+        free(names); free(distances); free(t_edges);
+        return -1;
+    }
     int ok =
         fprintf(f, "{\n") > 0 &&
         table_manager_json_indent(f, 1) == 0 &&
@@ -499,8 +3700,11 @@ int table_manager_write_output_file(const char * filename,
         /* coords */
         table_manager_json_indent(f, 1) == 0 &&
         fprintf(f, "\"coords\": {\n") > 0 &&
-        _json_scipp_var_header(f, 2, "time", "s", "float64", "[\"time\"]") == 0 &&
-        table_manager_json_array_double(f, t_edges, data->bins + 1) == 0 &&
+        (per_recorder
+         ? _json_scipp_var_header(f, 2, "time", "s", "float64", "[\"recorder\", \"time\"]") == 0 &&
+           table_manager_json_matrix_double(f, t_edges, nr, data->bins + 1, 2) == 0
+         : _json_scipp_var_header(f, 2, "time", "s", "float64", "[\"time\"]") == 0 &&
+           table_manager_json_array_double(f, t_edges, data->bins + 1) == 0) &&
         fprintf(f, "},\n") > 0 &&
         _json_scipp_var_header(f, 2, "distance", "m", "float64", "[\"recorder\"]") == 0 &&
         table_manager_json_array_double(f, distances, nr) == 0 &&
@@ -509,32 +3713,267 @@ int table_manager_write_output_file(const char * filename,
         table_manager_json_array_string(f, names, nr) == 0 &&
         fprintf(f, "}\n") > 0 &&
         table_manager_json_indent(f, 1) == 0 &&
-        fprintf(f, "},\n") > 0 &&
+        fprintf(f, "},\n") > 0;
+    if (ok && sparse) {
+        /* COO index of the non-empty bins; the data items hold one value
+         * per entry. */
+        ok = table_manager_json_indent(f, 1) == 0 &&
+             fprintf(f, "\"sparse\": {\n") > 0 &&
+             table_manager_json_indent(f, 2) == 0 &&
+             fprintf(f, "\"format\": \"coo\",\n") > 0 &&
+             table_manager_json_indent(f, 2) == 0 &&
+             fprintf(f, "\"shape\": [%d, %d],\n", data->recorders, data->bins) > 0 &&
+             _table_manager_write_data_item(f, filename, npy, "recorder_index", NULL, entry,
+                                            NULL, coo.recorder, -1, coo.nnz) == 0 &&
+             fprintf(f, "},\n") > 0 &&
+             _table_manager_write_data_item(f, filename, npy, "time_index", NULL, entry,
+                                            NULL, coo.time, -1, coo.nnz) == 0 &&
+             fprintf(f, "}\n") > 0 &&
+             table_manager_json_indent(f, 1) == 0 &&
+             fprintf(f, "},\n") > 0;
+    }
+    const char * dims = sparse ? entry : "[\"recorder\", \"time\"]";
+    int m = sparse ? -1 : data->recorders;
+    int n = sparse ? coo.nnz : data->bins;
+    ok = ok &&
         /* data */
         table_manager_json_indent(f, 1) == 0 &&
         fprintf(f, "\"data\": {\n") > 0 &&
-        _json_scipp_var_header(f, 2, "tp", "s", "float64", "[\"recorder\", \"time\"]") == 0 &&
-        table_manager_json_matrix_double(f, data->tp, data->recorders, data->bins, 2) == 0 &&
+        _table_manager_write_data_item(f, filename, npy, "tp", "s", dims,
+                                       sparse ? coo.tp : data->tp, NULL, m, n) == 0 &&
         fprintf(f, "},\n") > 0 &&
-        _json_scipp_var_header(f, 2, "p1", "dimensionless", "float64", "[\"recorder\", \"time\"]") == 0 &&
-        table_manager_json_matrix_double(f, data->p1, data->recorders, data->bins, 2) == 0 &&
+        _table_manager_write_data_item(f, filename, npy, "p1", "dimensionless", dims,
+                                       sparse ? coo.p1 : data->p1, NULL, m, n) == 0 &&
         fprintf(f, "},\n") > 0 &&
-        _json_scipp_var_header(f, 2, "p2", "dimensionless", "float64", "[\"recorder\", \"time\"]") == 0 &&
-        table_manager_json_matrix_double(f, data->p2, data->recorders, data->bins, 2) == 0 &&
+        _table_manager_write_data_item(f, filename, npy, "p2", "dimensionless", dims,
+                                       sparse ? coo.p2 : data->p2, NULL, m, n) == 0 &&
         fprintf(f, "},\n") > 0 &&
-        _json_scipp_var_header(f, 2, "n", "dimensionless", "int32", "[\"recorder\", \"time\"]") == 0 &&
-        table_manager_json_matrix_int(f, data->n, data->recorders, data->bins, 2) == 0 &&
+        _table_manager_write_data_item(f, filename, npy, "n", "dimensionless", dims,
+                                       NULL, sparse ? coo.n : data->n, m, n) == 0 &&
         fprintf(f, "}\n") > 0 &&
         table_manager_json_indent(f, 1) == 0 &&
         fprintf(f, "}\n") > 0 &&
         fprintf(f, "}\n") > 0;
 
     free(names); free(distances); free(t_edges);
-    if (!ok) {
+    _table_manager_coo_free(&coo);
+    if (fclose(f) != 0 || !ok) {
         fprintf(stderr, "TableManager ERROR: Failed to write to file '%s'.\n", filename);
-        fclose(f);
+        remove(filename);
+        return -1;
+    }
+    return 0;
+}
+
+/* Writes the merged ray sample of s as a second scipp.Dataset JSON file:
+ * coords distance and recorder as in table_manager_write_output plus the
+ * per-sample weight, and data items t and p with dims ["sample",
+ * "recorder"] (NaN and 0 for recorders a ray did not reach). */
+int table_manager_ctx_write_samples(struct TableManagerState * state,
+                                    const char * filename,
+                                    const struct TableManagerSampler * s, int format) {
+    if (format != TABLE_MANAGER_FORMAT_JSON && format != TABLE_MANAGER_FORMAT_NPY) {
+        fprintf(stderr, "TableManager ERROR: Unknown output format %d.\n", format);
+        return -1;
+    }
+    if (!state || !s || s->recorders != state->n_recorders) {
+        fprintf(stderr, "TableManager ERROR: state and a matching ray sampler must exist before writing samples.\n");
+        return -1;
+    }
+    int nr = s->recorders;
+    char   ** names     = (char **)  malloc((size_t) nr * sizeof(char *));
+    double  * distances = (double *) malloc((size_t) nr * sizeof(double));
+    double  * t         = (double *) malloc((size_t) s->size * (size_t) nr * sizeof(double));
+    double  * p         = (double *) malloc((size_t) s->size * (size_t) nr * sizeof(double));
+    double  * weight    = (double *) malloc((size_t) s->size * sizeof(double));
+    int n = names && distances && t && p && weight ? table_manager_sampler_collect(s, t, p, weight) : -1;
+    FILE * f = n >= 0 ? fopen(filename, "w") : NULL;
+    if (!f) {
+        if (n >= 0)
+            fprintf(stderr, "TableManager ERROR: Failed to open file '%s' for writing.\n", filename);
+        else
+            fprintf(stderr, "TableManager ERROR: Failed to allocate memory for the ray sample.\n");
+        free(names); free(distances); free(t); free(p); free(weight);
+        return -1;
+    }
+    struct TableManagerLinkedListNode * node = state->recorders.head;
+    for (int i = 0; i < nr; ++i, node = node->next) {
+        names[i]     = node->name;
+        distances[i] = node->distance;
+    }
+    int npy = format == TABLE_MANAGER_FORMAT_NPY;
+    const char * dims = "[\"sample\", \"recorder\"]";
+    int ok =
+        fprintf(f, "{\n") > 0 &&
+        table_manager_json_indent(f, 1) == 0 &&
+        fprintf(f, "\"type\": \"scipp.Dataset\",\n") > 0 &&
+        table_manager_json_indent(f, 1) == 0 &&
+        fprintf(f, "\"coords\": {\n") > 0 &&
+        _json_scipp_var_header(f, 2, "distance", "m", "float64", "[\"recorder\"]") == 0 &&
+        table_manager_json_array_double(f, distances, nr) == 0 &&
+        fprintf(f, "},\n") > 0 &&
+        _json_scipp_var_header(f, 2, "recorder", NULL, "string", "[\"recorder\"]") == 0 &&
+        table_manager_json_array_string(f, names, nr) == 0 &&
+        fprintf(f, "},\n") > 0 &&
+        _json_scipp_var_header(f, 2, "weight", "dimensionless", "float64", "[\"sample\"]") == 0 &&
+        table_manager_json_array_double(f, weight, n) == 0 &&
+        fprintf(f, "}\n") > 0 &&
+        table_manager_json_indent(f, 1) == 0 &&
+        fprintf(f, "},\n") > 0 &&
+        table_manager_json_indent(f, 1) == 0 &&
+        fprintf(f, "\"data\": {\n") > 0 &&
+        _table_manager_write_data_item(f, filename, npy, "t", "s", dims, t, NULL, n, nr) == 0 &&
+        fprintf(f, "},\n") > 0 &&
+        _table_manager_write_data_item(f, filename, npy, "p", "dimensionless", dims, p, NULL, n, nr) == 0 &&
+        fprintf(f, "}\n") > 0 &&
+        table_manager_json_indent(f, 1) == 0 &&
+        fprintf(f, "}\n") > 0 &&
+        fprintf(f, "}\n") > 0;
+
+    free(names); free(distances); free(t); free(p); free(weight);
+    if (fclose(f) != 0 || !ok) {
+        fprintf(stderr, "TableManager ERROR: Failed to write to file '%s'.\n", filename);
+        remove(filename);
         return -1;
     }
-    fclose(f);
     return 0;
 }
+
+
+/* ---------------------------------------------------------------------------
+ * Functions on the calling thread's table group
+ * (see table_manager_group_select); each forwards to its ctx counterpart.
+ * ------------------------------------------------------------------------- */
+
+int table_manager_state_n_recorders(void) {
+    return table_manager_ctx_n_recorders(_table_manager_state());
+}
+
+int table_manager_state_add_recorder(const char * name, double distance) {
+    return table_manager_ctx_add_recorder(_table_manager_state(), name, distance);
+}
+
+int table_manager_state_set_recorder_window(int recorder_index,
+                                            double t_min, double t_max) {
+    return table_manager_ctx_set_recorder_window(_table_manager_state(), recorder_index, t_min, t_max);
+}
+
+int table_manager_state_apply_windows(struct TableManagerData * data) {
+    return table_manager_ctx_apply_windows(_table_manager_state(), data);
+}
+
+int table_manager_state_set_cull_table(const struct TableManagerData * data) {
+    return table_manager_ctx_set_cull_table(_table_manager_state(), data);
+}
+
+long long table_manager_state_report_clipping(const struct TableManagerData * data) {
+    return table_manager_ctx_report_clipping(_table_manager_state(), data);
+}
+
+void table_manager_state_finalize(int manager_index,
+                                  const char * t_name,
+                                  const char * p_name,
+                                  const char * n_name,
+                                  const char * z_name) {
+    table_manager_ctx_finalize(_table_manager_state(), manager_index, t_name, p_name, n_name, z_name);
+}
+
+void table_manager_state_pool_stats(long long * hits, long long * misses,
+                                    long long * reclaimed) {
+    table_manager_ctx_pool_stats(_table_manager_state(), hits, misses, reclaimed);
+}
+
+int table_manager_state_reclaim(void) {
+    return table_manager_ctx_reclaim(_table_manager_state());
+}
+
+double ** table_manager_particle_t_array_ptr(_class_particle * p) {
+    return table_manager_ctx_particle_t_array_ptr(_table_manager_state(), p);
+}
+
+double ** table_manager_particle_p_array_ptr(_class_particle * p) {
+    return table_manager_ctx_particle_p_array_ptr(_table_manager_state(), p);
+}
+
+int * table_manager_particle_n_ptr(_class_particle * p) {
+    return table_manager_ctx_particle_n_ptr(_table_manager_state(), p);
+}
+
+double * table_manager_particle_t_array(_class_particle * p) {
+    return table_manager_ctx_particle_t_array(_table_manager_state(), p);
+}
+
+double * table_manager_particle_p_array(_class_particle * p) {
+    return table_manager_ctx_particle_p_array(_table_manager_state(), p);
+}
+
+void table_manager_particle_alloc(_class_particle * p, double t_zero) {
+    table_manager_ctx_particle_alloc(_table_manager_state(), p, t_zero);
+}
+
+int table_manager_particle_record(_class_particle * p, int recorder_index) {
+    return table_manager_ctx_particle_record(_table_manager_state(), p, recorder_index);
+}
+
+int table_manager_particle_record_planes(_class_particle * p, int first_recorder,
+                                         const double * z, int n, double vz) {
+    return table_manager_ctx_particle_record_planes(_table_manager_state(), p, first_recorder, z, n, vz);
+}
+
+int table_manager_particles_record(_class_particle * ps, int count, int recorder_index) {
+    return table_manager_ctx_particles_record(_table_manager_state(), ps, count, recorder_index);
+}
+
+int table_manager_particle_recorded(_class_particle * p, int recorder_index) {
+    return table_manager_ctx_particle_recorded(_table_manager_state(), p, recorder_index);
+}
+
+int table_manager_particle_cull(_class_particle * p, int recorder_index, double v_max) {
+    /* ABSORB takes the ray from every group, not only from the one whose
+     * table says it is too late. */
+    if (_tof_table_manager_groups && _tof_table_manager_groups->next &&
+        _table_manager_group_states() > 1) {
+        int refused;
+        #pragma omp atomic capture
+        refused = _tof_table_manager_cull_refused++;
+        if (!refused)
+            fprintf(stderr, "TableManager WARNING: Culling is off, as an absorbed ray would be lost to every table group.\n");
+        return 0;
+    }
+    return table_manager_ctx_particle_cull(_table_manager_state(), p, recorder_index, v_max);
+}
+
+int table_manager_particle_to_table(_class_particle * p, struct TableManagerData * data) {
+    return table_manager_ctx_particle_to_table(_table_manager_state(), p, data);
+}
+
+int table_manager_particles_to_table(_class_particle * ps, int count,
+                                     struct TableManagerData * data) {
+    return table_manager_ctx_particles_to_table(_table_manager_state(), ps, count, data);
+}
+
+int table_manager_particle_free(_class_particle * p) {
+    return table_manager_ctx_particle_free(_table_manager_state(), p);
+}
+
+int table_manager_particles_free(_class_particle * ps, int count) {
+    return table_manager_ctx_particles_free(_table_manager_state(), ps, count);
+}
+
+int table_manager_particle_to_events(_class_particle * p, struct TableManagerEvents * ev) {
+    return table_manager_ctx_particle_to_events(_table_manager_state(), p, ev);
+}
+
+int table_manager_particle_to_sampler(_class_particle * p, struct TableManagerSampler * s) {
+    return table_manager_ctx_particle_to_sampler(_table_manager_state(), p, s);
+}
+
+int table_manager_write_output(const char * filename,
+                               struct TableManagerData * data, int format) {
+    return table_manager_ctx_write_output(_table_manager_state(), filename, data, format);
+}
+
+int table_manager_write_samples(const char * filename,
+                                const struct TableManagerSampler * s, int format) {
+    return table_manager_ctx_write_samples(_table_manager_state(), filename, s, format);
+}
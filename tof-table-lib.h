@@ -1,6 +1,17 @@
 #ifndef TOF_TABLE_LIB_H
 #define TOF_TABLE_LIB_H
 
+/* Per-particle storage for n recorders, in doubles: the t array, the p array
+ * and one 64-bit hit-mask word per 64 recorders. */
+#define TABLE_MANAGER_HIT_WORDS(n)     (((n) + 63) / 64)
+#define TABLE_MANAGER_INLINE_SIZE(n)   (2 * (n) + TABLE_MANAGER_HIT_WORDS(n))
+
+/* Memory the auto-range warm-up may buffer rays in, in bytes; the warm-up
+ * ends early, on the rays it holds, once that is full. */
+#ifndef TABLE_MANAGER_WARMUP_BYTES
+#define TABLE_MANAGER_WARMUP_BYTES ((size_t) 256 << 20)
+#endif
+
 /* When compiled outside of McStas, provide minimal stubs for the types and
  * functions that the McStas runtime normally supplies. */
 #ifndef MCSTAS
@@ -16,6 +27,15 @@ struct _struct_particle {
     double * table_manager_t_9;
     double * table_manager_p_9;
     int table_manager_n_9;
+    double table_manager_z_9;
+    /* fields of a second TableManager group (test/test_state.c) */
+    double * table_manager_t_12;
+    double * table_manager_p_12;
+    int table_manager_n_12;
+    double table_manager_z_12;
+#ifdef TOF_TABLE_MAX_RECORDERS
+    double table_manager_ray[TABLE_MANAGER_INLINE_SIZE(TOF_TABLE_MAX_RECORDERS)];
+#endif
 };
 typedef struct _struct_particle _class_particle;
 
@@ -24,23 +44,167 @@ typedef struct _struct_particle _class_particle;
 void * particle_getvar_void(_class_particle * p, char * name, int * success);
 #endif /* MCSTAS */
 
+/* Optional inline per-particle storage.  Compiling with
+ * -DTOF_TABLE_MAX_RECORDERS=N and declaring the instrument-level user variable
+ *   USERVARS %{ double table_manager_ray[2 * N + (N + 63) / 64]; %}
+ * (i.e. TABLE_MANAGER_INLINE_SIZE(N), spelled out because USERVARS are
+ * emitted before this header) keeps every particle's t array, p array and
+ * hit mask inside _struct_particle instead of in heap blocks.  The array
+ * used to be called table_manager_inline and hold only 2 * N doubles, too
+ * few for the hit mask; finalize refuses that name rather than overrun it. */
+#define TABLE_MANAGER_INLINE_NAME "table_manager_ray"
+#define TABLE_MANAGER_INLINE_OLD_NAME "table_manager_inline"
+
+/* How table_manager_particle_to_table accumulates into a TableManagerData.
+ *   CRITICAL  every thread updates the shared arrays inside one omp critical
+ *   PRIVATE   every thread updates its own slab; table_manager_data_reduce
+ *             folds the slabs into the shared arrays (at SAVE time)
+ *   ATOMIC    every thread updates the shared arrays with omp atomic, so
+ *             threads only contend when they hit the same bin */
+enum TableManagerAccumulation {
+    TABLE_MANAGER_ACCUMULATE_CRITICAL = 0,
+    TABLE_MANAGER_ACCUMULATE_PRIVATE  = 1,
+    TABLE_MANAGER_ACCUMULATE_ATOMIC   = 2
+};
+
+/* Where table_manager_particle_to_table accumulates.
+ *   SOA          straight into the tp, p1, p2 and n arrays
+ *   INTERLEAVED  into one 32-byte TableManagerBin record per bin, so a hit
+ *                touches a single cache line instead of four; the records
+ *                are folded into the arrays by table_manager_data_reduce
+ *   SPARSE       into blocks of TABLE_MANAGER_SPARSE_BLOCK TableManagerBin
+ *                records that are only allocated when first hit; the dense
+ *                arrays are not allocated at all, and the output file lists
+ *                the non-empty bins only.  Not available with ATOMIC
+ *                accumulation, since blocks are created while binning */
+enum TableManagerLayout {
+    TABLE_MANAGER_LAYOUT_SOA         = 0,
+    TABLE_MANAGER_LAYOUT_INTERLEAVED = 1,
+    TABLE_MANAGER_LAYOUT_SPARSE      = 2
+};
+
+#define TABLE_MANAGER_SPARSE_BLOCK 256
+
+/* How a time window is split into bins.
+ *   LINEAR  bins of equal width
+ *   LOG     bins of equal width in log(t), for windows starting after 0
+ *   EDGES   user-supplied edges, shared by all recorders */
+enum TableManagerBinning {
+    TABLE_MANAGER_BINNING_LINEAR = 0,
+    TABLE_MANAGER_BINNING_LOG    = 1,
+    TABLE_MANAGER_BINNING_EDGES  = 2
+};
+
+/* Rays buffered by the automatic time-range warm-up (see
+ * table_manager_data_set_auto_range); defined in tof-table-lib.c. */
+struct TableManagerWarmup;
+
+/* One interleaved histogram bin; cells are 32-byte aligned. */
+struct TableManagerBin {
+    double tp;
+    double p1;
+    double p2;
+    int    n;
+    int    pad;
+};
+
 /* Aggregated histogram data for all recorders.
- * Arrays are row-major with shape [recorders][bins]. */
+ * Arrays are row-major with shape [recorders][bins].  Every recorder has
+ * the same number of bins, over its own window [r_min[i], r_max[i]), which
+ * defaults to the table-wide [t_min, t_max). */
 struct TableManagerData {
     int     recorders;
     int     bins;
     double  t_min;
     double  t_max;
+    double  t_scale;  /* bins per unit (log-)time, or 0 for an empty window */
     double * tp;   /* probability-weighted time sum  */
     double * p1;   /* probability sum                */
     double * p2;   /* squared-probability sum        */
     int    * n;    /* hit count                      */
+    double * r_min;    /* per-recorder window start         */
+    double * r_max;    /* per-recorder window end           */
+    double * r_scale;  /* index scale of each window, 0 if empty */
+    int     accumulation;              /* enum TableManagerAccumulation   */
+    int     n_slabs;                   /* per-thread slabs (PRIVATE mode) */
+    struct TableManagerData ** slabs;  /* indexed by OpenMP thread number */
+    int     layout;                    /* enum TableManagerLayout         */
+    struct TableManagerBin * cells;    /* [recorders][bins] (INTERLEAVED) */
+    void  * cells_mem;                 /* unaligned allocation of cells   */
+    struct TableManagerBin ** blocks;  /* n_blocks, or NULL (SPARSE)       */
+    size_t  n_blocks;
+    int     binning;                   /* enum TableManagerBinning        */
+    double * edges;                    /* bins + 1 values (EDGES), or NULL */
+    long long * clip_low;   /* per-recorder hits before r_min   */
+    long long * clip_high;  /* per-recorder hits at/after r_max */
+    int     warming;                   /* 1 while rays are being buffered */
+    struct TableManagerWarmup * warmup;  /* NULL unless auto-ranging      */
+};
+
+/* A pass of table_manager_data_rel_error_step over a table, in progress;
+ * a zeroed one starts a pass.  Each step visits TABLE_MANAGER_ERROR_CHUNK
+ * bins and files their errors into TABLE_MANAGER_ERROR_BUCKETS buckets,
+ * eight per factor of two from 2^-24 up to 2^8. */
+#define TABLE_MANAGER_ERROR_CHUNK   65536
+#define TABLE_MANAGER_ERROR_BUCKETS 256
+struct TableManagerErrorScan {
+    size_t next;                             /* first bin of the next step    */
+    double largest;                          /* largest error seen this pass  */
+    double p1[TABLE_MANAGER_ERROR_BUCKETS];  /* probability per error bucket  */
 };
 
 /* --- Data lifetime --- */
 struct TableManagerData * table_manager_data_alloc(int recorders, int bins,
                                                    double t_min, double t_max);
+struct TableManagerData * table_manager_data_alloc_layout(int recorders, int bins,
+                                                          double t_min, double t_max,
+                                                          int layout);
 void table_manager_data_free(struct TableManagerData * data);
+int  table_manager_accumulation_from_name(const char * name);
+int  table_manager_data_set_accumulation(struct TableManagerData * data,
+                                         int accumulation, int n_threads);
+int  table_manager_layout_from_name(const char * name);
+int  table_manager_data_set_layout(struct TableManagerData * data, int layout);
+int  table_manager_binning_from_name(const char * name);
+int  table_manager_data_set_binning(struct TableManagerData * data, int binning,
+                                    const double * edges);
+int  table_manager_data_set_window(struct TableManagerData * data, int recorder,
+                                   double t_min, double t_max);
+int  table_manager_data_edges(const struct TableManagerData * data, int recorder,
+                              double * out);
+int  table_manager_data_set_auto_range(struct TableManagerData * data,
+                                       long rays, double padding);
+int  table_manager_data_reduce(struct TableManagerData * data);
+int  table_manager_data_get_bin(const struct TableManagerData * data,
+                                int recorder, int bin,
+                                struct TableManagerBin * out);
+int  table_manager_data_rel_error(const struct TableManagerData * data, double quantile,
+                                  double * error);
+int  table_manager_data_rel_error_step(const struct TableManagerData * data,
+                                       struct TableManagerErrorScan * scan,
+                                       double quantile, double * error);
+struct TableManagerData * table_manager_data_alloc_like(const struct TableManagerData * data);
+int  table_manager_data_merge(struct TableManagerData * dst,
+                              const struct TableManagerData * src);
+
+/* --- Summing over MPI ranks (compiled with -DUSE_MPI, as McStas does) --- */
+#ifdef USE_MPI
+#include <mpi.h>
+int  table_manager_data_mpi_reduce(const struct TableManagerData * data,
+                                   struct TableManagerData ** total,
+                                   int root, MPI_Comm comm);
+char * table_manager_mpi_rank_filename(const char * filename, int rank);
+#endif
+
+/* --- Table groups ---
+ * Every group of TableSetup, TableRecorder and TableManager components has
+ * its own state (recorders, particle fields and pools).  The
+ * table_manager_state_* and table_manager_particle_* functions work on the
+ * group selected by the calling thread, the default group unless
+ * table_manager_group_select says otherwise. */
+struct TableManagerGroup;
+struct TableManagerGroup * table_manager_group(const char * name);
+void table_manager_group_select(struct TableManagerGroup * group);
 
 /* --- Global state lifetime --- */
 void table_manager_state_alloc(void);
@@ -48,23 +212,72 @@ void table_manager_state_free(void);
 int  table_manager_state_exists(void);
 int  table_manager_state_n_recorders(void);
 int  table_manager_state_add_recorder(const char * name, double distance);
+int  table_manager_state_set_recorder_window(int recorder_index,
+                                             double t_min, double t_max);
+int  table_manager_state_apply_windows(struct TableManagerData * data);
+int  table_manager_state_set_cull_table(const struct TableManagerData * data);
+long long table_manager_state_report_clipping(const struct TableManagerData * data);
+void table_manager_state_pool_stats(long long * hits, long long * misses,
+                                    long long * reclaimed);
+int  table_manager_state_reclaim(void);
 void table_manager_state_finalize(int manager_index,
                                   const char * t_name,
                                   const char * p_name,
-                                  const char * n_name);
+                                  const char * n_name,
+                                  const char * z_name);
 
 /* --- Per-particle accessors (require a finalised state) --- */
 double ** table_manager_particle_t_array_ptr(_class_particle * p);
 double ** table_manager_particle_p_array_ptr(_class_particle * p);
 int *     table_manager_particle_n_ptr(_class_particle * p);
+double *  table_manager_particle_t_array(_class_particle * p);
+double *  table_manager_particle_p_array(_class_particle * p);
 
 /* --- Per-particle operations --- */
 void table_manager_particle_alloc(_class_particle * p, double t_zero);
 int  table_manager_particle_record(_class_particle * p, int recorder_index);
+int  table_manager_particle_record_planes(_class_particle * p, int first_recorder,
+                                          const double * z, int n, double vz);
+int  table_manager_particle_recorded(_class_particle * p, int recorder_index);
+int  table_manager_particle_cull(_class_particle * p, int recorder_index, double v_max);
 int  table_manager_particle_to_table(_class_particle * p,
                                      struct TableManagerData * data);
 int  table_manager_particle_free(_class_particle * p);
 
+/* --- Batched per-particle operations (count consecutive particles) --- */
+int  table_manager_particles_record(_class_particle * ps, int count,
+                                    int recorder_index);
+int  table_manager_particles_to_table(_class_particle * ps, int count,
+                                      struct TableManagerData * data);
+int  table_manager_particles_free(_class_particle * ps, int count);
+
+/* --- Event streaming (per-ray records in a binary file; see
+ *     table_manager_events_open for the layout) --- */
+struct TableManagerEvents;
+struct TableManagerEvents * table_manager_events_open(const char * filename, int recorders,
+                                                      size_t ring_bytes);
+int  table_manager_events_push(struct TableManagerEvents * ev,
+                               const double * tof_t, const double * tof_p,
+                               const double * hits);
+long long table_manager_events_written(const struct TableManagerEvents * ev);
+int  table_manager_events_close(struct TableManagerEvents * ev);
+int  table_manager_particle_to_events(_class_particle * p,
+                                      struct TableManagerEvents * ev);
+
+/* --- Weighted ray sampling (a fixed-size sample of whole rays, chosen with
+ *     probability proportional to their weight) --- */
+struct TableManagerSampler;
+struct TableManagerSampler * table_manager_sampler_alloc(int recorders, int size,
+                                                         unsigned long long seed);
+void table_manager_sampler_free(struct TableManagerSampler * s);
+int  table_manager_sampler_add(struct TableManagerSampler * s,
+                               const double * tof_t, const double * tof_p,
+                               const double * hits, double weight);
+int  table_manager_particle_to_sampler(_class_particle * p,
+                                       struct TableManagerSampler * s);
+int  table_manager_sampler_collect(const struct TableManagerSampler * s,
+                                   double * t, double * p, double * weight);
+
 /* --- JSON helpers (write to an already-open FILE) --- */
 int table_manager_json_indent(FILE * f, int level);
 int table_manager_json_array_double(FILE * f, double * x, int n);
@@ -75,8 +288,111 @@ int table_manager_json_matrix_double(FILE * f, double * x, int m, int n,
 int table_manager_json_matrix_int(FILE * f, int * x, int m, int n,
                                   int indent_level);
 
+/* --- NumPy .npy helpers (m x n C-ordered arrays, or 1-D arrays of n values
+ *     with m < 0, in host byte order) --- */
+int table_manager_npy_write_double(const char * filename, const double * x,
+                                   int m, int n);
+int table_manager_npy_write_int(const char * filename, const int * x,
+                                int m, int n);
+
 /* --- Output --- */
+/* Output file formats.
+ *   JSON  one scipp.Dataset JSON file holding every value
+ *   NPY   the same JSON with coords only; each data item is stored in
+ *         <filename>.<item>.npy and referenced by a "file" key */
+enum TableManagerFormat {
+    TABLE_MANAGER_FORMAT_JSON = 0,
+    TABLE_MANAGER_FORMAT_NPY  = 1
+};
+
+int table_manager_format_from_name(const char * name);
+int table_manager_write_output(const char * filename,
+                               struct TableManagerData * data, int format);
 int table_manager_write_output_file(const char * filename,
                                     struct TableManagerData * data);
+int table_manager_write_samples(const char * filename,
+                                const struct TableManagerSampler * s, int format);
+
+/* --- Contexts ---
+ * A context is a state of its own, passed explicitly, for programs that
+ * embed the library: every table_manager_state_*, table_manager_particle_*
+ * and output function that works on the selected table group has a
+ * table_manager_ctx_* counterpart taking the context first, and the former
+ * simply forward to the latter.  Separate contexts can be used from
+ * different threads at once.  They share only:
+ *   - the particles' inline array (TABLE_MANAGER_INLINE_NAME), which the
+ *     first context to be finalised takes, under a named OpenMP critical
+ *     section; without OpenMP, allocate, finalise and free contexts on one
+ *     thread;
+ *   - the unnamed OpenMP critical section that CRITICAL accumulation and
+ *     the auto-range warm-up bin under, so such tables of different
+ *     contexts wait for each other.
+ * Threads started by the program itself rather than by OpenMP must each
+ * call table_manager_thread_bind with their own number below the context's
+ * n_threads before using it. */
+struct TableManagerState;
+struct TableManagerState * table_manager_ctx_alloc(int n_threads);
+void table_manager_ctx_free(struct TableManagerState * state);
+void table_manager_thread_bind(int index);
+int  table_manager_ctx_n_recorders(struct TableManagerState * state);
+int  table_manager_ctx_add_recorder(struct TableManagerState * state, const char * name,
+                                    double distance);
+int  table_manager_ctx_set_recorder_window(struct TableManagerState * state,
+                                           int recorder_index, double t_min, double t_max);
+int  table_manager_ctx_apply_windows(struct TableManagerState * state,
+                                     struct TableManagerData * data);
+int  table_manager_ctx_set_cull_table(struct TableManagerState * state,
+                                      const struct TableManagerData * data);
+long long table_manager_ctx_report_clipping(struct TableManagerState * state,
+                                            const struct TableManagerData * data);
+void table_manager_ctx_pool_stats(struct TableManagerState * state, long long * hits,
+                                  long long * misses, long long * reclaimed);
+int  table_manager_ctx_reclaim(struct TableManagerState * state);
+void table_manager_ctx_finalize(struct TableManagerState * state, int manager_index,
+                                const char * t_name, const char * p_name,
+                                const char * n_name, const char * z_name);
+double ** table_manager_ctx_particle_t_array_ptr(struct TableManagerState * state,
+                                                 _class_particle * p);
+double ** table_manager_ctx_particle_p_array_ptr(struct TableManagerState * state,
+                                                 _class_particle * p);
+int *     table_manager_ctx_particle_n_ptr(struct TableManagerState * state,
+                                           _class_particle * p);
+double *  table_manager_ctx_particle_t_array(struct TableManagerState * state,
+                                             _class_particle * p);
+double *  table_manager_ctx_particle_p_array(struct TableManagerState * state,
+                                             _class_particle * p);
+void table_manager_ctx_particle_alloc(struct TableManagerState * state,
+                                      _class_particle * p, double t_zero);
+int  table_manager_ctx_particle_record(struct TableManagerState * state,
+                                       _class_particle * p, int recorder_index);
+int  table_manager_ctx_particle_record_planes(struct TableManagerState * state,
+                                              _class_particle * p, int first_recorder,
+                                              const double * z, int n, double vz);
+int  table_manager_ctx_particle_recorded(struct TableManagerState * state,
+                                         _class_particle * p, int recorder_index);
+int  table_manager_ctx_particle_cull(struct TableManagerState * state, _class_particle * p,
+                                     int recorder_index, double v_max);
+int  table_manager_ctx_particle_to_table(struct TableManagerState * state,
+                                         _class_particle * p,
+                                         struct TableManagerData * data);
+int  table_manager_ctx_particle_free(struct TableManagerState * state, _class_particle * p);
+int  table_manager_ctx_particles_record(struct TableManagerState * state,
+                                        _class_particle * ps, int count, int recorder_index);
+int  table_manager_ctx_particles_to_table(struct TableManagerState * state,
+                                          _class_particle * ps, int count,
+                                          struct TableManagerData * data);
+int  table_manager_ctx_particles_free(struct TableManagerState * state,
+                                      _class_particle * ps, int count);
+int  table_manager_ctx_particle_to_events(struct TableManagerState * state,
+                                          _class_particle * p,
+                                          struct TableManagerEvents * ev);
+int  table_manager_ctx_particle_to_sampler(struct TableManagerState * state,
+                                           _class_particle * p,
+                                           struct TableManagerSampler * s);
+int  table_manager_ctx_write_output(struct TableManagerState * state, const char * filename,
+                                    struct TableManagerData * data, int format);
+int  table_manager_ctx_write_samples(struct TableManagerState * state,
+                                     const char * filename,
+                                     const struct TableManagerSampler * s, int format);
 
 #endif /* TOF_TABLE_LIB_H */
@@ -3,7 +3,12 @@
 The file format is a JSON representation of a ``scipp.Dataset``:
 
   coords
-    time      (time [bin-edge]) – bin edges in seconds
+    time      (time [bin-edge]) – bin edges in seconds, or
+              (recorder, time [bin-edge]) when recorders have their own
+              time windows (TableRecorder t_min/t_max or lambda_min/lambda_max);
+              every recorder then has the same number of bins over its own
+              range.  The edges are uniform, logarithmic or user-supplied
+              following the TableManager ``binning`` parameter
     distance  (recorder)       – recorder distance from source in metres
     recorder  (recorder)       – recorder name strings
 
@@ -20,38 +25,359 @@ Each variable follows the ``niess.io.scipp.variable_to_dict`` convention::
 String variables (e.g. ``recorder``) carry ``"unit": null``, which JSON
 decodes to Python ``None``; ``sc.array(unit=None)`` correctly creates a
 variable with no unit.
+
+With ``TableManager(format="npy")`` the data items carry ``"file"`` instead
+of ``"values"``: the name, relative to the JSON file, of a NumPy ``.npy``
+file holding the C-ordered (recorder, time) array.  The coords stay inline.
+
+With ``TableManager(layout="sparse")`` only the non-empty bins are written,
+in coordinate (COO) form.  A top-level ``sparse`` section holds
+``{"format": "coo", "shape": [recorders, bins], "recorder_index": ...,
+"time_index": ...}`` (``int32`` variables with dims ``entry``), and every
+data item has dims ``entry``, one value per index pair.  Both loaders expand
+such files to dense (recorder, time) arrays.
+
+With ``TableManager(events_file=...)`` every ray that reached a recorder is
+also written to a binary event file: a 64-byte header (``b"TOFEVENT"``,
+then ``uint32`` version, number of recorders, record size in bytes and the
+marker ``0x01020304``, all in the byte order of the writing machine)
+followed by one record per ray of ``float64`` times and then ``float64``
+probabilities, one per recorder (NaN and 0 where the ray did not reach the
+recorder).  :func:`iter_events` reads such files in chunks.
+
+With ``TableManager(samples=N)`` a weighted sample of at most N whole rays
+is written to ``<filename>.samples``: a Dataset with coords ``distance``,
+``recorder`` and ``weight`` (dims ``sample``) and data items ``t`` and ``p``
+with dims (sample, recorder), NaN and 0 where a ray did not reach the
+recorder.  Both :func:`load` and :func:`load_arrays` read it.
+
+Tables of independent runs (e.g. jobs with different seeds) are combined
+with :func:`merge`, or from the command line::
+
+    python tof_table.py merge -o combined.json run_*.json
 """
 from __future__ import annotations
 
+import argparse
 import json
+import sys
 from pathlib import Path
 
 
+def _read_header(path) -> dict:
+    with open(path) as f:
+        obj = json.load(f)
+    if obj.get("type") != "scipp.Dataset":
+        raise ValueError(
+            f"Expected type 'scipp.Dataset', got {obj.get('type')!r}"
+        )
+    return obj
+
+
+def _memmap(path, item: dict):
+    """Memory-map the ``.npy`` file referenced by a data item."""
+    import numpy as np
+
+    return np.load(Path(path).parent / item["file"], mmap_mode="r")
+
+
+def _values(path, item: dict):
+    import numpy as np
+
+    if "file" in item:
+        return _memmap(path, item)
+    return np.asarray(item["values"], dtype=item["dtype"])
+
+
+def _expand(obj: dict, path, values):
+    """Scatter the per-entry values of a sparse file into a dense array."""
+    import numpy as np
+
+    sparse = obj["sparse"]
+    if sparse.get("format") != "coo":
+        raise ValueError(f"Unsupported sparse format {sparse.get('format')!r}")
+    dense = np.zeros(sparse["shape"], dtype=values.dtype)
+    dense[_values(path, sparse["recorder_index"]),
+          _values(path, sparse["time_index"])] = values
+    return dense
+
+
+def _arrays(obj: dict, path) -> dict:
+    """The data items of an already parsed file, expanded if sparse."""
+    arrays = {k: _values(path, v) for k, v in obj["data"].items()}
+    if "sparse" in obj:
+        arrays = {k: _expand(obj, path, v) for k, v in arrays.items()}
+    return arrays
+
+
+def load_arrays(path) -> dict:
+    """Return the data items of a TableManager output file as NumPy arrays.
+
+    Items written with ``format="npy"`` are read-only ``np.memmap`` views
+    of their ``.npy`` files, so nothing is read until it is accessed; inline
+    JSON items are converted with ``np.asarray``.  Sparse files are expanded
+    into dense (in-memory) arrays.
+
+    Parameters
+    ----------
+    path:
+        Path to the JSON file written by ``table_manager_write_output``.
+
+    Returns
+    -------
+    dict
+        Mapping of ``tp``, ``p1``, ``p2`` and ``n`` to (recorder, time)
+        arrays.
+    """
+    return _arrays(_read_header(path), path)
+
+
 def load(path) -> "scipp.Dataset":
     """Load a TableManager output file and return a :class:`scipp.Dataset`.
 
+    Data items stored in ``.npy`` files are memory-mapped rather than parsed
+    from JSON.  Note that ``scipp`` variables own their buffers, so each of
+    them is copied once (at memory bandwidth) into the Dataset; use
+    :func:`load_arrays` for copy-free access to the raw arrays.
+
     Parameters
     ----------
     path:
-        Path to the JSON file written by ``table_manager_write_output_file``.
+        Path to the JSON file written by ``table_manager_write_output``.
 
     Returns
     -------
     scipp.Dataset
         Dataset with coords ``time``, ``distance``, ``recorder`` and data
-        items ``tp``, ``p1``, ``p2``, ``n``.
+        items ``tp``, ``p1``, ``p2``, ``n``.  ``time`` is two-dimensional
+        (one row of bin edges per recorder) if any recorder used its own
+        window.
     """
     import scipp as sc
     from niess.io.scipp import dict_to_variable
 
-    with open(path) as f:
-        obj = json.load(f)
+    obj = _read_header(path)
 
-    if obj.get("type") != "scipp.Dataset":
-        raise ValueError(
-            f"Expected type 'scipp.Dataset', got {obj.get('type')!r}"
-        )
+    def item_to_variable(v):
+        if "sparse" in obj:
+            return sc.array(dims=["recorder", "time"],
+                            values=_expand(obj, path, _values(path, v)),
+                            unit=v["unit"], dtype=v["dtype"])
+        if "file" not in v:
+            return dict_to_variable(v)
+        return sc.array(dims=v["dims"], values=_memmap(path, v),
+                        unit=v["unit"], dtype=v["dtype"])
 
     coords = {k: dict_to_variable(v) for k, v in obj["coords"].items()}
-    data   = {k: dict_to_variable(v) for k, v in obj["data"].items()}
+    data   = {k: item_to_variable(v) for k, v in obj["data"].items()}
     return sc.Dataset(data=data, coords=coords)
+
+
+_EVENT_MAGIC = b"TOFEVENT"
+_EVENT_HEADER_SIZE = 64
+
+
+def _event_dtype(header: bytes):
+    """Record dtype of an event file, from its 64-byte header."""
+    import numpy as np
+
+    if len(header) != _EVENT_HEADER_SIZE or header[:8] != _EVENT_MAGIC:
+        raise ValueError("Not a TableManager event file")
+    order = "<" if np.frombuffer(header, "<u4", 1, 20)[0] == 0x01020304 else ">"
+    version, recorders, record_bytes, _ = np.frombuffer(header, order + "u4", 4, 8)
+    if version != 1 or record_bytes != 16 * recorders:
+        raise ValueError(f"Unsupported event file version {version}")
+    return np.dtype([("t", order + "f8", (int(recorders),)),
+                     ("p", order + "f8", (int(recorders),))])
+
+
+def iter_events(path, chunk_size: int = 1 << 20):
+    """Iterate over the rays of a TableManager event file in chunks.
+
+    Only one chunk is held in memory at a time, so files of billions of
+    events can be processed with bounded memory.  Rays written by one
+    thread keep their order; rays of different threads are interleaved.
+
+    Parameters
+    ----------
+    path:
+        Path to the file written with ``TableManager(events_file=...)``.
+    chunk_size:
+        Maximum number of rays per chunk.
+
+    Yields
+    ------
+    tuple
+        ``(t, p)`` arrays of shape (rays, recorders); ``t`` is NaN and ``p``
+        is 0 for recorders a ray did not reach.
+    """
+    import numpy as np
+
+    with open(path, "rb") as f:
+        dtype = _event_dtype(f.read(_EVENT_HEADER_SIZE))
+        while True:
+            chunk = np.fromfile(f, dtype=dtype, count=chunk_size)
+            if chunk.size == 0:
+                return
+            yield chunk["t"], chunk["p"]
+
+
+_DATA_UNITS = {"tp": "s", "p1": "dimensionless", "p2": "dimensionless",
+               "n": "dimensionless"}
+
+
+def _json_write_array(f, values, chunk: int = 1 << 16):
+    """Write a 1-D array on one line, a chunk of values at a time."""
+    f.write("[")
+    for begin in range(0, len(values), chunk):
+        if begin:
+            f.write(", ")
+        f.write(json.dumps(values[begin:begin + chunk].tolist())[1:-1])
+    f.write("]")
+
+
+def _json_write_matrix(f, values, indent_level: int):
+    """Write a 2-D array one row per line, as the C library does."""
+    f.write("[\n")
+    for i, row in enumerate(values):
+        f.write("  " * (indent_level + 1) + json.dumps(row.tolist()))
+        f.write(",\n" if i + 1 < len(values) else "\n")
+    f.write("  " * indent_level + "]")
+
+
+def _write_table(path, coords: dict, arrays: dict, fmt: str, sparse: bool):
+    """Write arrays in the TableManager output format of the C library.
+
+    The layout follows ``table_manager_write_output``: one variable per line
+    and matrices one row per line, so that only a row (or chunk) of values
+    is turned into Python objects at a time.
+    """
+    import numpy as np
+
+    path = Path(path)
+    shape = list(arrays["n"].shape)
+    if sparse:
+        recorder, time = np.nonzero(arrays["n"])
+        index = {"recorder_index": recorder.astype("int32"),
+                 "time_index": time.astype("int32")}
+        arrays = {k: v[recorder, time] for k, v in arrays.items()}
+    dims = ["entry"] if sparse else ["recorder", "time"]
+
+    def variable(f, key, header, values, last):
+        f.write(f"    {json.dumps(key)}: ")
+        if fmt == "npy" and key not in coords:
+            name = f"{path.name}.{key}.npy"
+            np.save(path.parent / name, np.ascontiguousarray(values))
+            f.write(json.dumps({**header, "file": name}))
+        else:
+            f.write(json.dumps(header)[:-1] + ', "values": ')
+            if values.ndim == 2:
+                _json_write_matrix(f, values, 2)
+            else:
+                _json_write_array(f, values)
+            f.write("}")
+        f.write("\n" if last else ",\n")
+
+    with open(path, "w") as f:
+        f.write('{\n  "type": "scipp.Dataset",\n  "coords": {\n')
+        for i, (k, v) in enumerate(coords.items()):
+            header = {key: value for key, value in v.items() if key != "values"}
+            variable(f, k, header, np.asarray(v["values"]), i + 1 == len(coords))
+        f.write("  },\n")
+        if sparse:
+            f.write('  "sparse": {\n    "format": "coo",\n'
+                    f'    "shape": {json.dumps(shape)},\n')
+            for i, (k, v) in enumerate(index.items()):
+                header = {"unit": None, "dtype": "int32", "dims": ["entry"]}
+                variable(f, k, header, v, i + 1 == len(index))
+            f.write("  },\n")
+        f.write('  "data": {\n')
+        for i, (k, v) in enumerate(arrays.items()):
+            header = {"unit": _DATA_UNITS[k], "dtype": str(v.dtype), "dims": dims}
+            variable(f, k, header, v, i + 1 == len(arrays))
+        f.write("  }\n}\n")
+
+
+def merge(paths, output, fmt: str | None = None):
+    """Sum the tables of independent runs into one output file.
+
+    The inputs are read one at a time and added into a single set of
+    (recorder, time) arrays, so hundreds of files can be merged with the
+    memory of one table (``.npy`` items are memory-mapped).  All inputs
+    must have the same time bins, recorder names and distances.  Hit
+    counts are summed as ``int64`` and written back as ``int32``, as the C
+    library writes them; a ``ValueError`` is raised if a sum does not fit.
+
+    Parameters
+    ----------
+    paths:
+        The TableManager output files to combine.
+    output:
+        Path of the combined JSON file.
+    fmt:
+        ``"json"`` or ``"npy"`` (see ``TableManager(format=...)``); by
+        default that of the first input.  The output is sparse when every
+        input is.
+
+    Returns
+    -------
+    int
+        The number of files merged.
+    """
+    import numpy as np
+
+    paths = list(paths)
+    if not paths:
+        raise ValueError("Nothing to merge")
+    coords = total = None
+    sparse = True
+    for path in paths:
+        obj = _read_header(path)
+        if coords is None:
+            coords = obj["coords"]
+            if fmt is None:
+                fmt = "npy" if any("file" in v for v in obj["data"].values()) else "json"
+        elif obj["coords"] != coords:
+            raise ValueError(f"{path}: time bins or recorders differ from {paths[0]}")
+        sparse = sparse and "sparse" in obj
+        arrays = _arrays(obj, path)
+        del obj
+        if total is None:
+            total = {k: np.array(v, dtype="int64" if k == "n" else "float64")
+                     for k, v in arrays.items()}
+        else:
+            for k, v in arrays.items():
+                total[k] += v
+        del arrays
+    if fmt not in ("json", "npy"):
+        raise ValueError(f"Unknown output format {fmt!r}")
+    if total["n"].size and total["n"].max() > np.iinfo("int32").max:
+        raise ValueError("Merged hit counts overflow int32")
+    total["n"] = total["n"].astype("int32")
+    _write_table(output, coords, total, fmt, sparse)
+    return len(paths)
+
+
+def main(argv=None) -> int:
+    parser = argparse.ArgumentParser(
+        prog="tof_table.py", description="TableManager output utilities.")
+    commands = parser.add_subparsers(dest="command", required=True)
+    merge_parser = commands.add_parser(
+        "merge", help="sum the tables of independent runs into one file")
+    merge_parser.add_argument("inputs", nargs="+", help="TableManager output files")
+    merge_parser.add_argument("-o", "--output", required=True,
+                              help="path of the combined JSON file")
+    merge_parser.add_argument("--format", choices=("json", "npy"),
+                              help="output format (default: that of the first input)")
+    args = parser.parse_args(argv)
+    try:
+        count = merge(args.inputs, args.output, args.format)
+    except (OSError, ValueError) as error:
+        print(f"tof_table.py: {error}", file=sys.stderr)
+        return 1
+    print(f"Merged {count} tables into {args.output}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())